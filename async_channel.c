@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "async_channel.h"
+
+#define ASYNC_CHANNEL_MIN_CAPACITY 16
+
+const char async_channel_closed_reason[] = "channel closed";
+
+typedef struct
+{
+    promise_data_t data;
+    void(*free_data)(void*,void*);
+    void* free_ctx;
+} async_channel_item_t;
+
+typedef struct
+{
+    promise_handle_t promise;
+    async_channel_item_t item;
+} async_channel_sender_t;
+
+/** a ring of entries, the capacity is a power of 2 */
+typedef struct
+{
+    void* entries;
+    size_t entry_size;
+    size_t capacity;
+    size_t head;
+    size_t count;
+} async_channel_queue_t;
+
+typedef struct
+{
+    promise_manager_handle_t manager;
+    bool closed;
+    int capacity;
+    /** the buffer, a ring of exactly capacity items */
+    async_channel_item_t* items;
+    int head;
+    int count;
+    async_channel_queue_t receivers;    /** promise_handle_t, only while the buffer is empty */
+    async_channel_queue_t senders;      /** async_channel_sender_t, only while the buffer is full */
+} async_channel_t;
+
+static int async_channel_queue_push(async_channel_queue_t* queue, const void* entry);
+static void* async_channel_queue_peek(async_channel_queue_t* queue);
+static void async_channel_queue_pop(async_channel_queue_t* queue);
+static void* async_channel_queue_at(async_channel_queue_t* queue, size_t index);
+static void async_channel_queue_remove(async_channel_queue_t* queue, size_t index);
+static void async_channel_receiver_freed(promise_handle_t promise, void* ctx);
+static void async_channel_sender_freed(promise_handle_t promise, void* ctx);
+static void async_channel_item_free(async_channel_item_t* item);
+static int async_channel_deliver(async_channel_t* channel, async_channel_item_t* item);
+static bool async_channel_take_sender(async_channel_t* channel, async_channel_item_t* item);
+static void async_channel_refill(async_channel_t* channel);
+
+async_channel_handle_t async_channel_new(promise_manager_handle_t manager, int capacity)
+{
+    async_channel_t* channel = NULL;
+    if(!manager || capacity < 0)
+        goto error;
+    channel = malloc(sizeof(async_channel_t));
+    if(!channel)
+        goto error;
+    memset(channel,0,sizeof(async_channel_t));
+    channel->manager = manager;
+    channel->capacity = capacity;
+    channel->receivers.entry_size = sizeof(promise_handle_t);
+    channel->senders.entry_size = sizeof(async_channel_sender_t);
+    if(capacity > 0)
+    {
+        channel->items = malloc(sizeof(async_channel_item_t)*capacity);
+        if(!channel->items)
+            goto error;
+    }
+    return (async_channel_handle_t)channel;
+error:
+    async_channel_free((async_channel_handle_t)channel);
+    return NULL;
+}
+
+void async_channel_free(async_channel_handle_t channel_handle)
+{
+    async_channel_t* channel = (async_channel_t*)channel_handle;
+    if(!channel)
+        return;
+    for(int i=0;i<channel->count;i++)
+        async_channel_item_free(&channel->items[(channel->head + i)%channel->capacity]);
+    /** empty the queues first, each cancelled waiter looks itself up in them */
+    async_channel_queue_t senders = channel->senders;
+    async_channel_queue_t receivers = channel->receivers;
+    channel->senders.count = 0;
+    channel->receivers.count = 0;
+    async_channel_sender_t* sender;
+    while((sender = async_channel_queue_peek(&senders)))
+    {
+        promise_cancel(channel->manager,sender->promise);
+        async_channel_item_free(&sender->item);
+        async_channel_queue_pop(&senders);
+    }
+    promise_handle_t* receiver;
+    while((receiver = async_channel_queue_peek(&receivers)))
+    {
+        promise_cancel(channel->manager,*receiver);
+        async_channel_queue_pop(&receivers);
+    }
+    free(senders.entries);
+    free(receivers.entries);
+    free(channel->items);
+    free(channel);
+}
+
+promise_handle_t async_channel_send(
+    async_channel_handle_t channel_handle,
+    promise_data_t data, void(*free_data)(void*,void*), void* free_ctx)
+{
+    async_channel_t* channel = (async_channel_t*)channel_handle;
+    async_channel_sender_t sender = {.item = {.data = data,.free_data = free_data,.free_ctx = free_ctx}};
+    if(!channel)
+        goto error;
+    sender.promise = promise_new(channel->manager);
+    if(!sender.promise)
+        goto error;
+    if(channel->closed)
+    {
+        async_channel_item_free(&sender.item);
+        promise_reject(channel->manager,sender.promise,(promise_data_t){.ptr = ASYNC_CHANNEL_CLOSED},NULL,NULL);
+        return sender.promise;
+    }
+    /** 
+     * nobody awaits the send promise yet, settling it runs nothing.
+     * The receiver runs though, the channel may be gone afterwards.
+     */
+    promise_manager_handle_t manager = channel->manager;
+    if(async_channel_deliver(channel,&sender.item) == 0)
+    {
+        promise_resolve(manager,sender.promise,(promise_data_t){.ptr = NULL},NULL,NULL);
+        return sender.promise;
+    }
+    if(channel->count < channel->capacity)
+    {
+        channel->items[(channel->head + channel->count)%channel->capacity] = sender.item;
+        channel->count++;
+        promise_resolve(channel->manager,sender.promise,(promise_data_t){.ptr = NULL},NULL,NULL);
+        return sender.promise;
+    }
+    /** backpressure, wait for room */
+    if(async_channel_queue_push(&channel->senders,&sender) != 0)
+    {
+        promise_destroy(channel->manager,sender.promise);
+        goto error;
+    }
+    /** a cancelled or destroyed send leaves the queue right away and drops its item */
+    if(promise_set_free_handler(channel->manager,sender.promise,async_channel_sender_freed,channel) != 0)
+    {
+        channel->senders.count--;
+        promise_destroy(channel->manager,sender.promise);
+        goto error;
+    }
+    return sender.promise;
+error:
+    async_channel_item_free(&sender.item);
+    return NULL;
+}
+
+promise_handle_t async_channel_recv(async_channel_handle_t channel_handle)
+{
+    async_channel_t* channel = (async_channel_t*)channel_handle;
+    if(!channel)
+        return NULL;
+    /** resolving a sender runs it, the channel may be gone afterwards */
+    promise_manager_handle_t manager = channel->manager;
+    promise_handle_t promise = promise_new(manager);
+    if(!promise)
+        return NULL;
+    async_channel_item_t item;
+    if(channel->count > 0)
+    {
+        item = channel->items[channel->head];
+        channel->head = (channel->head + 1)%channel->capacity;
+        channel->count--;
+        async_channel_refill(channel);
+    }
+    else if(!async_channel_take_sender(channel,&item))
+    {
+        if(channel->closed)
+        {
+            promise_reject(channel->manager,promise,(promise_data_t){.ptr = ASYNC_CHANNEL_CLOSED},NULL,NULL);
+            return promise;
+        }
+        if(async_channel_queue_push(&channel->receivers,&promise) != 0)
+        {
+            promise_destroy(channel->manager,promise);
+            return NULL;
+        }
+        /** a cancelled or destroyed receive leaves the queue right away */
+        if(promise_set_free_handler(channel->manager,promise,async_channel_receiver_freed,channel) != 0)
+        {
+            channel->receivers.count--;
+            promise_destroy(channel->manager,promise);
+            return NULL;
+        }
+        return promise;
+    }
+    promise_resolve(manager,promise,item.data,item.free_data,item.free_ctx);
+    return promise;
+}
+
+int async_channel_close(async_channel_handle_t channel_handle)
+{
+    async_channel_t* channel = (async_channel_t*)channel_handle;
+    if(!channel || channel->closed)
+        return -1;
+    channel->closed = true;
+    /** 
+     * rejecting runs handlers, which may use or free the channel:
+     * take both queues out first and leave the channel empty
+     */
+    promise_manager_handle_t manager = channel->manager;
+    async_channel_queue_t senders = channel->senders;
+    async_channel_queue_t receivers = channel->receivers;
+    memset(&channel->senders,0,sizeof(async_channel_queue_t));
+    memset(&channel->receivers,0,sizeof(async_channel_queue_t));
+    channel->senders.entry_size = senders.entry_size;
+    channel->receivers.entry_size = receivers.entry_size;
+    async_channel_sender_t* sender;
+    while((sender = async_channel_queue_peek(&senders)))
+    {
+        async_channel_queue_pop(&senders);
+        async_channel_item_free(&sender->item);
+        promise_set_free_handler(manager,sender->promise,NULL,NULL);
+        promise_reject(manager,sender->promise,(promise_data_t){.ptr = ASYNC_CHANNEL_CLOSED},NULL,NULL);
+    }
+    promise_handle_t* receiver;
+    while((receiver = async_channel_queue_peek(&receivers)))
+    {
+        async_channel_queue_pop(&receivers);
+        promise_set_free_handler(manager,*receiver,NULL,NULL);
+        promise_reject(manager,*receiver,(promise_data_t){.ptr = ASYNC_CHANNEL_CLOSED},NULL,NULL);
+    }
+    free(senders.entries);
+    free(receivers.entries);
+    return 0;
+}
+
+int async_channel_length(async_channel_handle_t channel_handle)
+{
+    async_channel_t* channel = (async_channel_t*)channel_handle;
+    if(!channel)
+        return 0;
+    return channel->count;
+}
+
+/** hand item to the oldest live receiver, without touching the buffer */
+static int async_channel_deliver(async_channel_t* channel, async_channel_item_t* item)
+{
+    promise_handle_t* receiver;
+    while((receiver = async_channel_queue_peek(&channel->receivers)))
+    {
+        promise_handle_t promise = *receiver;
+        async_channel_queue_pop(&channel->receivers);
+        /** out of the queue, the channel may be gone once it is freed */
+        promise_set_free_handler(channel->manager,promise,NULL,NULL);
+        if(promise_resolve(channel->manager,promise,item->data,item->free_data,item->free_ctx) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+/** take the item of the oldest live sender waiting for room and resolve its send */
+static bool async_channel_take_sender(async_channel_t* channel, async_channel_item_t* item)
+{
+    async_channel_sender_t* peek;
+    while((peek = async_channel_queue_peek(&channel->senders)))
+    {
+        async_channel_sender_t sender = *peek;
+        async_channel_queue_pop(&channel->senders);
+        promise_set_free_handler(channel->manager,sender.promise,NULL,NULL);
+        if(promise_resolve(channel->manager,sender.promise,(promise_data_t){.ptr = NULL},NULL,NULL) == 0)
+        {
+            *item = sender.item;
+            return true;
+        }
+        /** the send is gone, its item is dropped */
+        async_channel_item_free(&sender.item);
+    }
+    return false;
+}
+
+/** move the item of the oldest live sender waiting for room into the buffer */
+static void async_channel_refill(async_channel_t* channel)
+{
+    async_channel_sender_t* peek;
+    while(channel->count < channel->capacity && (peek = async_channel_queue_peek(&channel->senders)))
+    {
+        async_channel_sender_t sender = *peek;
+        async_channel_queue_pop(&channel->senders);
+        promise_set_free_handler(channel->manager,sender.promise,NULL,NULL);
+        async_channel_item_t* slot = &channel->items[(channel->head + channel->count)%channel->capacity];
+        *slot = sender.item;
+        channel->count++;
+        /** the buffer is consistent before the sender runs */
+        if(promise_resolve(channel->manager,sender.promise,(promise_data_t){.ptr = NULL},NULL,NULL) == 0)
+            return;
+        /** the send is gone, nothing ran, its item is dropped */
+        channel->count--;
+        async_channel_item_free(slot);
+    }
+}
+
+static void async_channel_item_free(async_channel_item_t* item)
+{
+    if(item->free_data)
+        item->free_data(item->data.ptr,item->free_ctx);
+    item->free_data = NULL;
+}
+
+static int async_channel_queue_push(async_channel_queue_t* queue, const void* entry)
+{
+    if(queue->count == queue->capacity)
+    {
+        /** grow the ring, keep the capacity a power of 2 */
+        size_t new_capacity = queue->capacity ? queue->capacity*2 : ASYNC_CHANNEL_MIN_CAPACITY;
+        char* new_entries = malloc(queue->entry_size*new_capacity);
+        if(!new_entries)
+            return -1;
+        for(size_t i=0;i<queue->count;i++)
+        {
+            memcpy(new_entries + i*queue->entry_size,
+                (char*)queue->entries + ((queue->head + i)&(queue->capacity - 1))*queue->entry_size,
+                queue->entry_size);
+        }
+        free(queue->entries);
+        queue->entries = new_entries;
+        queue->capacity = new_capacity;
+        queue->head = 0;
+    }
+    memcpy((char*)queue->entries + ((queue->head + queue->count)&(queue->capacity - 1))*queue->entry_size,
+        entry,queue->entry_size);
+    queue->count++;
+    return 0;
+}
+
+static void* async_channel_queue_peek(async_channel_queue_t* queue)
+{
+    if(queue->count == 0)
+        return NULL;
+    return (char*)queue->entries + queue->head*queue->entry_size;
+}
+
+static void async_channel_queue_pop(async_channel_queue_t* queue)
+{
+    queue->head = (queue->head + 1)&(queue->capacity - 1);
+    queue->count--;
+}
+
+static void* async_channel_queue_at(async_channel_queue_t* queue, size_t index)
+{
+    return (char*)queue->entries + ((queue->head + index)&(queue->capacity - 1))*queue->entry_size;
+}
+
+/** close the gap, later entries keep their order */
+static void async_channel_queue_remove(async_channel_queue_t* queue, size_t index)
+{
+    for(size_t i=index+1;i<queue->count;i++)
+        memcpy(async_channel_queue_at(queue,i-1),async_channel_queue_at(queue,i),queue->entry_size);
+    queue->count--;
+}
+
+static void async_channel_receiver_freed(promise_handle_t promise, void* ctx)
+{
+    async_channel_t* channel = (async_channel_t*)ctx;
+    for(size_t i=0;i<channel->receivers.count;i++)
+    {
+        if(*(promise_handle_t*)async_channel_queue_at(&channel->receivers,i) == promise)
+        {
+            async_channel_queue_remove(&channel->receivers,i);
+            return;
+        }
+    }
+}
+
+static void async_channel_sender_freed(promise_handle_t promise, void* ctx)
+{
+    async_channel_t* channel = (async_channel_t*)ctx;
+    for(size_t i=0;i<channel->senders.count;i++)
+    {
+        async_channel_sender_t* sender = async_channel_queue_at(&channel->senders,i);
+        if(sender->promise == promise)
+        {
+            async_channel_item_t item = sender->item;
+            async_channel_queue_remove(&channel->senders,i);
+            /** last, free_data may run anything */
+            async_channel_item_free(&item);
+            return;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef __ASYNC_CHANNEL_H
+#define __ASYNC_CHANNEL_H
+
+#include "promise.h"
+
+typedef void* async_channel_handle_t;
+
+/** reject reason of sends and receives on a closed channel, compare reason.ptr with it */
+extern const char async_channel_closed_reason[];
+#define ASYNC_CHANNEL_CLOSED ((void*)async_channel_closed_reason)
+
+/**
+ * @brief Create a bounded channel passing owned items between the promises of a manager.
+ *
+ * @param manager not nullable, owned by the calling thread
+ * @param capacity items buffered, >= 0. With 0 every send waits for a receiver.
+ * @return async_channel_handle_t or NULL on error
+ */
+async_channel_handle_t async_channel_new(promise_manager_handle_t manager, int capacity);
+
+/**
+ * @brief Free the channel before the manager.
+ * Buffered items are freed, pending sends and receives are cancelled.
+ *
+ * @param channel
+ */
+void async_channel_free(async_channel_handle_t channel);
+
+/**
+ * @brief Send an item, the channel owns it from now on.
+ * A waiting receiver gets it directly. Otherwise it is buffered,
+ * or waits for room when the buffer is full.
+ * The promise is resolved once the item is buffered or received,
+ * or rejected with ASYNC_CHANNEL_CLOSED, the item is freed then.
+ * Cancelling a pending send drops the item.
+ *
+ * @param channel
+ * @param data
+ * @param free_data nullable
+ * @param free_ctx
+ * @return promise_handle_t or NULL on error, the item is freed then
+ */
+promise_handle_t async_channel_send(
+    async_channel_handle_t channel,
+    promise_data_t data, void(*free_data)(void*,void*), void* free_ctx);
+
+/**
+ * @brief Receive the oldest item. Receivers are served in order.
+ * The promise is resolved with the item, take it over to own it.
+ * It is rejected with ASYNC_CHANNEL_CLOSED once the channel is closed and drained.
+ *
+ * @param channel
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t async_channel_recv(async_channel_handle_t channel);
+
+/**
+ * @brief Close the channel. Buffered items can still be received.
+ * Pending sends and waiting receives are rejected with ASYNC_CHANNEL_CLOSED.
+ *
+ * @param channel
+ * @return int 0 on success, -1 if it is already closed
+ */
+int async_channel_close(async_channel_handle_t channel);
+
+/**
+ * @brief Get the number of buffered items.
+ *
+ * @param channel
+ * @return int
+ */
+int async_channel_length(async_channel_handle_t channel);
+
+/**
+ * @brief Send an item in an async function, waits while the channel is full.
+ * See RETURN for the arguments.
+ */
+#define AWAIT_SEND(channel,type,value,free_ptr,free_ctx) \
+    AWAIT(async_channel_send((channel),(promise_data_t){.type=(value)},(free_ptr),(free_ctx)))
+
+/**
+ * @brief Receive an item in an async function and take it over. See AWAIT_TAKE.
+ */
+#define AWAIT_RECV(channel,type,dst,free_dst,free_ctx_dst) \
+    AWAIT_TAKE(type,dst,free_dst,free_ctx_dst,async_channel_recv(channel))
+
+#endif
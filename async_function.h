@@ -6,34 +6,44 @@
 #include <stddef.h>
 #include "promise.h"
 
-typedef struct async_data_list_s
+#ifndef ASYNC_INLINE_DATA_SLOTS
+/** async data kept in the frame before spilling to a heap buffer */
+#define ASYNC_INLINE_DATA_SLOTS 4
+#endif
+
+typedef struct
 {
-    struct async_data_list_s* next;
     void* ptr;
     void(*free_ptr)(void*, void*);
     void* free_ctx;
-} async_data_list_t;
+} async_data_t;
 
 typedef struct async_ctx_s
 {
     void* variables;
     /** internal */
     void(*func)(struct async_ctx_s*);
+    size_t frame_size;              /** ctx and variables are one block of promise_manager_alloc */
     int step;
     bool is_error;
     bool has_catch;
     promise_handle_t promise;
     promise_manager_handle_t manager;
+    promise_handle_t awaiting;      /** the promise awaited, cancelled with the frame */
     promise_data_t last_async_data;
     void(*last_async_data_free)(void*, void*);
     void* last_async_data_ctx;
-    /** all async data taken over during the process with a free_ptr */
-    async_data_list_t* async_data_list;
+    /** all async data taken over during the process with a free_ptr, freed with the frame */
+    async_data_t* async_data;       /** inline_async_data or a heap buffer once it is full */
+    int async_data_count;
+    int async_data_capacity;
+    async_data_t inline_async_data[ASYNC_INLINE_DATA_SLOTS];
 } async_ctx_t;
 
-static void async_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+static inline void async_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
 {
     async_ctx_t* async_ctx = (async_ctx_t*)ctx;
+    async_ctx->awaiting = NULL;
     async_ctx->is_error = false;
     async_ctx->last_async_data = data;
     async_ctx->last_async_data_free = free_ptr;
@@ -41,9 +51,10 @@ static void async_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,voi
     async_ctx->func(async_ctx);
 }
 
-static void async_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+static inline void async_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
 {
     async_ctx_t* async_ctx = (async_ctx_t*)ctx;
+    async_ctx->awaiting = NULL;
     async_ctx->is_error = true;
     async_ctx->last_async_data = reason;
     async_ctx->last_async_data_free = free_ptr;
@@ -51,23 +62,110 @@ static void async_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,
     async_ctx->func(async_ctx);
 }
 
-static int async_push_async_data(async_ctx_t* ctx)
+static inline void async_free(async_ctx_t* ctx)
+{
+    for(int i=0;i<ctx->async_data_count;i++)
+        ctx->async_data[i].free_ptr(ctx->async_data[i].ptr,ctx->async_data[i].free_ctx);
+    if(ctx->async_data != ctx->inline_async_data)
+        free(ctx->async_data);
+    promise_manager_release(ctx->manager,ctx,ctx->frame_size);
+}
+
+/** cancel handler of the async promise, the frame is suspended on ctx->awaiting */
+static inline void async_cancel(void* ctx)
+{
+    async_ctx_t* async_ctx = (async_ctx_t*)ctx;
+    promise_cancel(async_ctx->manager,async_ctx->awaiting);
+    async_free(async_ctx);
+}
+
+/** runs the function up to its first await, the promise is known by now */
+static inline void async_start(void* ctx)
+{
+    async_ctx_t* async_ctx = (async_ctx_t*)ctx;
+    promise_set_cancel_handler(async_ctx->manager,async_ctx->promise,async_cancel,async_ctx);
+    async_ctx->func(async_ctx);
+}
+
+/** discard handler of a lazy async promise freed before it is awaited */
+static inline void async_discard(void* ctx)
+{
+    async_free((async_ctx_t*)ctx);
+}
+
+/** 
+ * make room for one more async data before it arrives, 
+ * so pushing it after an await or in CATCH never fails 
+ */
+static inline int async_reserve_async_data(async_ctx_t* ctx)
+{
+    if(ctx->async_data_count < ctx->async_data_capacity)
+        return 0;
+    int new_capacity = ctx->async_data_capacity*2;
+    async_data_t* new_data = malloc(sizeof(async_data_t)*new_capacity);
+    if(!new_data)
+        return -1;
+    memcpy(new_data,ctx->async_data,sizeof(async_data_t)*ctx->async_data_count);
+    if(ctx->async_data != ctx->inline_async_data)
+        free(ctx->async_data);
+    ctx->async_data = new_data;
+    ctx->async_data_capacity = new_capacity;
+    return 0;
+}
+
+/** room MUST be reserved with async_reserve_async_data */
+static inline int async_push_async_data(async_ctx_t* ctx)
 {
     if(ctx->last_async_data_free)
     {
-        async_data_list_t* node = (async_data_list_t*)malloc(sizeof(async_data_list_t));
-        if(!node)
-            return -1;
-        memset(node,0,sizeof(async_data_list_t));
-        node->ptr = ctx->last_async_data.ptr;
-        node->free_ptr = ctx->last_async_data_free;
-        node->free_ctx = ctx->last_async_data_ctx;
-        node->next = ctx->async_data_list;
-        ctx->async_data_list = node;
+        async_data_t* slot = &ctx->async_data[ctx->async_data_count++];
+        slot->ptr = ctx->last_async_data.ptr;
+        slot->free_ptr = ctx->last_async_data_free;
+        slot->free_ctx = ctx->last_async_data_ctx;
+    }
+    return 0;
+}
+
+/** await ctx->awaiting, with room reserved for what it settles with */
+static inline int async_await(async_ctx_t* ctx, bool takeover_data)
+{
+    if(async_reserve_async_data(ctx) != 0)
+    {
+        /** nobody else knows the promise yet, drop it instead of leaking it */
+        promise_cancel(ctx->manager,ctx->awaiting);
+        ctx->awaiting = NULL;
+        return -1;
+    }
+    if(promise_await(ctx->manager,ctx->awaiting,async_then,ctx,takeover_data,async_catch,ctx,true) != 0)
+    {
+        ctx->awaiting = NULL;
+        return -1;
     }
     return 0;
 }
 
+/** THROW in TRY, drop the value if there is no room to keep it for CATCH */
+static inline void async_throw_in_try(async_ctx_t* ctx)
+{
+    ctx->is_error = true;
+    if(async_reserve_async_data(ctx) != 0)
+    {
+        if(ctx->last_async_data_free)
+            ctx->last_async_data_free(ctx->last_async_data.ptr,ctx->last_async_data_ctx);
+        ctx->last_async_data = (promise_data_t){.ptr=NULL};
+        ctx->last_async_data_free = NULL;
+        ctx->last_async_data_ctx = NULL;
+    }
+}
+
+/** build with -DPROMISE_TRACE to record where each AWAIT waits, see promise_manager_trace_start */
+#ifdef PROMISE_TRACE
+#define _ASYNC_TRACE_STEP() \
+    promise_trace_step(ctx_545bb8c->manager,ctx_545bb8c->promise,ctx_545bb8c->awaiting,__FILE__,__LINE__)
+#else
+#define _ASYNC_TRACE_STEP() do{ }while(0)
+#endif
+
 #define _UNIQUE_PROMISE_NAME2(x,y) x ## y
 #define _UNIQUE_PROMISE_NAME(x,y) _UNIQUE_PROMISE_NAME2(x,y)
 #define UNIQUE_PROMISE_NAME _UNIQUE_PROMISE_NAME(promise_,__LINE__)
@@ -82,76 +180,88 @@ static int async_push_async_data(async_ctx_t* ctx)
  */
 #define VAR(v) (variables_545bb8c->v)
 
-/**
- * @brief Define an async function
- * 
- * @param name function name
- * @param params function parameters
- * @param var_list context data, NEEDS to include function parameters
- * @param arg_init_script copy function parameters into context data using ARG_INIT() macro
- * 
- * @return promise_handle_t
- */
-#define ASYNC(name,params,var_list,arg_init_script) \
+/** shared by ASYNC and LAZY_ASYNC, lazy is a constant */
+#define _ASYNC_DEFINE(name,params,var_list,arg_init_script,lazy) \
+struct _##name##_variables_545bb8c\
+{\
+    int dummy_545bb8c;\
+    var_list\
+};\
+struct _##name##_frame_545bb8c\
+{\
+    async_ctx_t ctx;\
+    struct _##name##_variables_545bb8c variables;\
+};\
 static void _##name (async_ctx_t* ctx); \
 promise_handle_t name params\
 {\
-    async_ctx_t* ctx = malloc(sizeof(async_ctx_t));\
-    if(!ctx) return NULL;\
-    memset(ctx,0,sizeof(async_ctx_t));\
-    promise_handle_t promise = promise_new(GLOBAL_PROMISE_MANAGER);\
-    if(!promise)\
-    {\
-        free(ctx);\
-        return NULL;\
-    }\
-    ctx->manager = GLOBAL_PROMISE_MANAGER;\
-    ctx->promise = promise;\
+    promise_manager_handle_t manager_545bb8c = GLOBAL_PROMISE_MANAGER;\
+    struct _##name##_frame_545bb8c* frame_545bb8c = promise_manager_alloc(manager_545bb8c,sizeof(struct _##name##_frame_545bb8c));\
+    if(!frame_545bb8c) return NULL;\
+    memset(frame_545bb8c,0,sizeof(*frame_545bb8c));\
+    async_ctx_t* ctx = &frame_545bb8c->ctx;\
+    ctx->frame_size = sizeof(*frame_545bb8c);\
+    ctx->async_data = ctx->inline_async_data;\
+    ctx->async_data_capacity = ASYNC_INLINE_DATA_SLOTS;\
+    ctx->manager = manager_545bb8c;\
     ctx->step = 0;\
     ctx->func = _##name;\
-    struct\
-    {\
-        int dummy_545bb8c;\
-        var_list\
-    }* variables = malloc(sizeof(*variables));\
-    if(!variables)\
+    struct _##name##_variables_545bb8c* variables = &frame_545bb8c->variables;\
+    arg_init_script\
+    ctx->variables = variables;\
+    promise_handle_t promise = (lazy) ?\
+        promise_new_lazy(manager_545bb8c,async_start,async_discard,ctx) : promise_new(manager_545bb8c);\
+    if(!promise)\
     {\
-        promise_destroy(ctx->manager,promise);\
-        free(ctx);\
+        promise_manager_release(manager_545bb8c,frame_545bb8c,sizeof(*frame_545bb8c));\
         return NULL;\
     }\
-    memset(variables,0,sizeof(*variables));\
-    arg_init_script\
-    ctx->variables = variables;\
-    _##name(ctx);\
+    ctx->promise = promise;\
+    if(!(lazy))\
+        async_start(ctx);\
     return promise;\
 };\
 static void _##name(async_ctx_t* ctx_545bb8c)\
 {\
-    struct\
-    {\
-        int dummy_545bb8c;\
-        var_list\
-    }* variables_545bb8c = ctx_545bb8c->variables;\
+    struct _##name##_variables_545bb8c* variables_545bb8c = ctx_545bb8c->variables;\
     switch(ctx_545bb8c->step)\
     {\
     case 0:
 
+/**
+ * @brief Define an async function
+ * 
+ * @param name function name
+ * @param params function parameters
+ * @param var_list context data, NEEDS to include function parameters
+ * @param arg_init_script copy function parameters into context data using ARG_INIT() macro
+ * The context and the context data share one frame, recycled by the pools of the manager.
+ * 
+ * @return promise_handle_t
+ */
+#define ASYNC(name,params,var_list,arg_init_script) \
+    _ASYNC_DEFINE(name,params,var_list,arg_init_script,0)
+
+/**
+ * @brief Define a lazy async function, see ASYNC.
+ * Calling it only captures the arguments. The body starts when the promise is first awaited,
+ * directly or by promise_all/promise_any/promise_then/promise_timeout.
+ * Destroying or cancelling the promise before that frees the frame without running anything.
+ * 
+ * @return promise_handle_t
+ */
+#define LAZY_ASYNC(name,params,var_list,arg_init_script) \
+    _ASYNC_DEFINE(name,params,var_list,arg_init_script,1)
+
 /**
  * @brief End an async function.
  */
 #define ASYNC_END()\
     }}\
 final:\
-    while(ctx_545bb8c->async_data_list)\
-    {\
-        ctx_545bb8c->async_data_list->free_ptr(ctx_545bb8c->async_data_list->ptr,ctx_545bb8c->async_data_list->free_ctx);\
-        async_data_list_t* next = ctx_545bb8c->async_data_list->next;\
-        free(ctx_545bb8c->async_data_list);\
-        ctx_545bb8c->async_data_list = next;\
-    }\
-    free(ctx_545bb8c->variables);\
-    free(ctx_545bb8c);\
+    /** the promise is left pending if the function ends without RETURN */\
+    promise_set_cancel_handler(ctx_545bb8c->manager,ctx_545bb8c->promise,NULL,NULL);\
+    async_free(ctx_545bb8c);\
     return;
 
 /**
@@ -180,10 +290,10 @@ do{\
 do{\
     if(ctx_545bb8c->has_catch)\
     {\
-        ctx_545bb8c->is_error=true;\
         ctx_545bb8c->last_async_data=(promise_data_t){.type=value};\
         ctx_545bb8c->last_async_data_free=free_ptr;\
         ctx_545bb8c->last_async_data_ctx=free_ctx;\
+        async_throw_in_try(ctx_545bb8c);\
     }\
     else\
     {\
@@ -240,7 +350,9 @@ do{\
     if(!ctx_545bb8c->is_error)\
     {\
         ctx_545bb8c->step = __LINE__;\
-        if(promise_await(ctx_545bb8c->manager,expr,async_then,ctx_545bb8c,false,async_catch,ctx_545bb8c,true)!=0)\
+        ctx_545bb8c->awaiting = (expr);\
+        _ASYNC_TRACE_STEP();\
+        if(async_await(ctx_545bb8c,false)!=0)\
         {\
             ctx_545bb8c->is_error=true;\
             ctx_545bb8c->last_async_data=(promise_data_t){.ptr=NULL};\
@@ -270,7 +382,9 @@ do{\
     if(!ctx_545bb8c->is_error)\
     {\
         ctx_545bb8c->step = __LINE__;\
-        if(promise_await(ctx_545bb8c->manager,expr,async_then,ctx_545bb8c,true,async_catch,ctx_545bb8c,true)!=0)\
+        ctx_545bb8c->awaiting = (expr);\
+        _ASYNC_TRACE_STEP();\
+        if(async_await(ctx_545bb8c,true)!=0)\
         {\
             ctx_545bb8c->is_error=true;\
             ctx_545bb8c->last_async_data=(promise_data_t){.ptr=NULL};\
@@ -293,6 +407,63 @@ do{\
     }\
 }while(0);
 
+/**
+ * @brief Await a promise and take its result over. Unlike AWAIT_RESULT, the data is not
+ * kept with the frame: free it with free_dst once done, loops that await many results stay bounded.
+ * 
+ * @param type type of data to copy 
+ * @param dst double, booelan or pointer
+ * @param free_dst set to the free function of dst, NULL if it owns nothing
+ * @param free_ctx_dst set to the free context of dst
+ * @param expr the code to generate a promise
+ */
+#define AWAIT_TAKE(type,dst,free_dst,free_ctx_dst,expr)\
+do{\
+    if(!ctx_545bb8c->is_error)\
+    {\
+        ctx_545bb8c->step = __LINE__;\
+        ctx_545bb8c->awaiting = (expr);\
+        _ASYNC_TRACE_STEP();\
+        if(async_await(ctx_545bb8c,true)!=0)\
+        {\
+            ctx_545bb8c->is_error=true;\
+            ctx_545bb8c->last_async_data=(promise_data_t){.ptr=NULL};\
+            ctx_545bb8c->last_async_data_free=NULL;\
+            ctx_545bb8c->last_async_data_ctx=NULL;\
+            ctx_545bb8c->func(ctx_545bb8c);\
+        }\
+        return;\
+    case __LINE__:\
+        if(!ctx_545bb8c->is_error)\
+        {\
+            dst = ctx_545bb8c->last_async_data.type;\
+            free_dst = ctx_545bb8c->last_async_data_free;\
+            free_ctx_dst = ctx_545bb8c->last_async_data_ctx;\
+        }\
+        else if(!ctx_545bb8c->has_catch)\
+        {\
+            promise_reject(ctx_545bb8c->manager, ctx_545bb8c->promise, ctx_545bb8c->last_async_data, ctx_545bb8c->last_async_data_free, ctx_545bb8c->last_async_data_ctx);\
+            goto final;\
+        }\
+    }\
+}while(0);
+
+/**
+ * @brief Await a promise with a deadline. It is rejected with PROMISE_TIMEOUT if it takes longer.
+ * 
+ * @param expr the code to generate a promise
+ * @param ms timeout in ms of the manager's time, see promise_manager_advance_time
+ */
+#define AWAIT_TIMEOUT(expr,ms) AWAIT(promise_timeout(ctx_545bb8c->manager,(expr),(ms)))
 
+/**
+ * @brief Await a promise with a deadline and assign the result to dst. See AWAIT_TIMEOUT.
+ * 
+ * @param type type of data to copy 
+ * @param dst double, booelan or pointer
+ * @param expr the code to generate a promise
+ * @param ms timeout in ms
+ */
+#define AWAIT_RESULT_TIMEOUT(type,dst,expr,ms) AWAIT_RESULT(type,dst,promise_timeout(ctx_545bb8c->manager,(expr),(ms)))
 
 #endif
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include "async_semaphore.h"
+
+#define ASYNC_SEMAPHORE_MIN_CAPACITY 16
+
+typedef struct
+{
+    promise_manager_handle_t manager;
+    int permits;
+    /** pending acquires in order, a ring with a power of 2 capacity */
+    promise_handle_t* waiters;
+    size_t capacity;
+    size_t head;
+    size_t count;
+} async_semaphore_t;
+
+static int async_semaphore_push(async_semaphore_t* semaphore, promise_handle_t promise);
+static void async_semaphore_waiter_freed(promise_handle_t promise, void* ctx);
+
+async_semaphore_handle_t async_semaphore_new(promise_manager_handle_t manager, int permits)
+{
+    if(!manager || permits < 0)
+        return NULL;
+    async_semaphore_t* semaphore = malloc(sizeof(async_semaphore_t));
+    if(!semaphore)
+        return NULL;
+    memset(semaphore,0,sizeof(async_semaphore_t));
+    semaphore->manager = manager;
+    semaphore->permits = permits;
+    return (async_semaphore_handle_t)semaphore;
+}
+
+void async_semaphore_free(async_semaphore_handle_t semaphore_handle)
+{
+    async_semaphore_t* semaphore = (async_semaphore_t*)semaphore_handle;
+    if(!semaphore)
+        return;
+    /** empty the ring first, each cancelled waiter looks itself up in it */
+    size_t count = semaphore->count;
+    semaphore->count = 0;
+    for(size_t i=0;i<count;i++)
+        promise_cancel(semaphore->manager,semaphore->waiters[(semaphore->head + i)&(semaphore->capacity - 1)]);
+    free(semaphore->waiters);
+    free(semaphore);
+}
+
+promise_handle_t async_semaphore_acquire(async_semaphore_handle_t semaphore_handle)
+{
+    async_semaphore_t* semaphore = (async_semaphore_t*)semaphore_handle;
+    if(!semaphore)
+        return NULL;
+    promise_handle_t promise = promise_new(semaphore->manager);
+    if(!promise)
+        return NULL;
+    /** nobody awaits it yet, resolving it runs nothing */
+    if(semaphore->count == 0 && semaphore->permits > 0)
+    {
+        semaphore->permits--;
+        promise_resolve(semaphore->manager,promise,(promise_data_t){.ptr = NULL},NULL,NULL);
+        return promise;
+    }
+    if(async_semaphore_push(semaphore,promise) != 0)
+    {
+        promise_destroy(semaphore->manager,promise);
+        return NULL;
+    }
+    /** a cancelled or destroyed acquire leaves the ring right away */
+    if(promise_set_free_handler(semaphore->manager,promise,async_semaphore_waiter_freed,semaphore) != 0)
+    {
+        semaphore->count--;
+        promise_destroy(semaphore->manager,promise);
+        return NULL;
+    }
+    return promise;
+}
+
+int async_semaphore_try_acquire(async_semaphore_handle_t semaphore_handle)
+{
+    async_semaphore_t* semaphore = (async_semaphore_t*)semaphore_handle;
+    if(!semaphore || semaphore->count > 0 || semaphore->permits == 0)
+        return -1;
+    semaphore->permits--;
+    return 0;
+}
+
+void async_semaphore_release(async_semaphore_handle_t semaphore_handle)
+{
+    async_semaphore_t* semaphore = (async_semaphore_t*)semaphore_handle;
+    if(!semaphore)
+        return;
+    while(semaphore->count > 0)
+    {
+        promise_handle_t waiter = semaphore->waiters[semaphore->head];
+        semaphore->head = (semaphore->head + 1)&(semaphore->capacity - 1);
+        semaphore->count--;
+        /** granted, it is no longer in the ring */
+        promise_set_free_handler(semaphore->manager,waiter,NULL,NULL);
+        if(promise_resolve(semaphore->manager,waiter,(promise_data_t){.ptr = NULL},NULL,NULL) == 0)
+            return;
+    }
+    semaphore->permits++;
+}
+
+int async_semaphore_available(async_semaphore_handle_t semaphore_handle)
+{
+    async_semaphore_t* semaphore = (async_semaphore_t*)semaphore_handle;
+    if(!semaphore)
+        return 0;
+    return semaphore->permits;
+}
+
+static int async_semaphore_push(async_semaphore_t* semaphore, promise_handle_t promise)
+{
+    if(semaphore->count == semaphore->capacity)
+    {
+        /** grow the ring, keep the capacity a power of 2 */
+        size_t new_capacity = semaphore->capacity ? semaphore->capacity*2 : ASYNC_SEMAPHORE_MIN_CAPACITY;
+        promise_handle_t* new_waiters = malloc(sizeof(promise_handle_t)*new_capacity);
+        if(!new_waiters)
+            return -1;
+        for(size_t i=0;i<semaphore->count;i++)
+            new_waiters[i] = semaphore->waiters[(semaphore->head + i)&(semaphore->capacity - 1)];
+        free(semaphore->waiters);
+        semaphore->waiters = new_waiters;
+        semaphore->capacity = new_capacity;
+        semaphore->head = 0;
+    }
+    semaphore->waiters[(semaphore->head + semaphore->count)&(semaphore->capacity - 1)] = promise;
+    semaphore->count++;
+    return 0;
+}
+
+static void async_semaphore_waiter_freed(promise_handle_t promise, void* ctx)
+{
+    async_semaphore_t* semaphore = (async_semaphore_t*)ctx;
+    size_t mask = semaphore->capacity - 1;
+    for(size_t i=0;i<semaphore->count;i++)
+    {
+        if(semaphore->waiters[(semaphore->head + i)&mask] != promise)
+            continue;
+        /** close the gap, later waiters keep their order */
+        for(size_t j=i+1;j<semaphore->count;j++)
+            semaphore->waiters[(semaphore->head + j - 1)&mask] = semaphore->waiters[(semaphore->head + j)&mask];
+        semaphore->count--;
+        return;
+    }
+}
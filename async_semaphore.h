@@ -0,0 +1,63 @@
+#ifndef __ASYNC_SEMAPHORE_H
+#define __ASYNC_SEMAPHORE_H
+
+#include "promise.h"
+
+typedef void* async_semaphore_handle_t;
+
+/**
+ * @brief Create a counting semaphore for the promises of a manager.
+ *
+ * @param manager not nullable, owned by the calling thread
+ * @param permits initial number of permits, >= 0
+ * @return async_semaphore_handle_t or NULL on error
+ */
+async_semaphore_handle_t async_semaphore_new(promise_manager_handle_t manager, int permits);
+
+/**
+ * @brief Free the semaphore before the manager. Pending acquires are cancelled.
+ *
+ * @param semaphore
+ */
+void async_semaphore_free(async_semaphore_handle_t semaphore);
+
+/**
+ * @brief Take a permit. The promise is resolved once it is granted, right away if one is free.
+ * Waiters are granted in order. The permit belongs to the caller once the promise is resolved,
+ * release it with async_semaphore_release even if the promise is destroyed before its handler runs.
+ * Cancelling a pending acquire gives up its place.
+ *
+ * @param semaphore
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t async_semaphore_acquire(async_semaphore_handle_t semaphore);
+
+/**
+ * @brief Take a permit without waiting.
+ *
+ * @param semaphore
+ * @return int 0 if a permit is taken, -1 otherwise
+ */
+int async_semaphore_try_acquire(async_semaphore_handle_t semaphore);
+
+/**
+ * @brief Give a permit back. It goes to the oldest pending acquire if there is one.
+ *
+ * @param semaphore
+ */
+void async_semaphore_release(async_semaphore_handle_t semaphore);
+
+/**
+ * @brief Get the number of free permits.
+ *
+ * @param semaphore
+ * @return int
+ */
+int async_semaphore_available(async_semaphore_handle_t semaphore);
+
+/**
+ * @brief Wait for a permit in an async function, release it with async_semaphore_release.
+ */
+#define AWAIT_ACQUIRE(semaphore) AWAIT(async_semaphore_acquire(semaphore))
+
+#endif
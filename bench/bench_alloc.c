@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "promise.h"
+#include "bench_util.h"
+
+#define ROUNDS 2000000
+#define BATCH 1000
+
+static void bench_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    (*(int*)ctx)++;
+}
+
+static void bench_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+}
+
+/** create, await and resolve one promise at a time */
+static void bench_round_trip(const char* name, promise_manager_handle_t manager)
+{
+    int count = 0;
+    bench_t bench = bench_start(name);
+    for(int i=0;i<ROUNDS;i++)
+    {
+        promise_handle_t promise = promise_new(manager);
+        promise_await(manager,promise,bench_then,&count,false,bench_catch,NULL,false);
+        promise_resolve(manager,promise,(promise_data_t){.number=i},NULL,NULL);
+    }
+    bench_report(&bench,1,ROUNDS);
+    if(count != ROUNDS)
+        fprintf(stderr,"round trip lost %d promises\n",ROUNDS-count);
+}
+
+/** keep BATCH promises pending before settling them */
+static void bench_batch(const char* name, promise_manager_handle_t manager)
+{
+    static promise_handle_t promises[BATCH];
+    int count = 0;
+    bench_t bench = bench_start(name);
+    for(int i=0;i<ROUNDS/BATCH;i++)
+    {
+        for(int j=0;j<BATCH;j++)
+        {
+            promises[j] = promise_new(manager);
+            promise_await(manager,promises[j],bench_then,&count,false,bench_catch,NULL,false);
+        }
+        for(int j=0;j<BATCH;j++)
+            promise_resolve(manager,promises[j],(promise_data_t){.number=j},NULL,NULL);
+    }
+    bench_report(&bench,BATCH,ROUNDS);
+    if(count != ROUNDS)
+        fprintf(stderr,"batch lost %d promises\n",ROUNDS-count);
+}
+
+int main(int argc, char const *argv[])
+{
+    promise_manager_options_t malloc_only = {.initial_capacity = 0, .max_retained_bytes = 0};
+    promise_manager_options_t pooled = {.initial_capacity = BATCH, .max_retained_bytes = 1024*1024};
+    promise_manager_handle_t manager = promise_manager_new_with_options(&malloc_only);
+    if(!manager)
+        return 1;
+    bench_round_trip("alloc_round_trip_malloc",manager);
+    bench_batch("alloc_batch_malloc",manager);
+    promise_manager_free(manager);
+    manager = promise_manager_new_with_options(&pooled);
+    if(!manager)
+        return 1;
+    bench_round_trip("alloc_round_trip_pool",manager);
+    bench_batch("alloc_batch_pool",manager);
+    promise_manager_free(manager);
+    return 0;
+}
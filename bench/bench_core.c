@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "promise.h"
+#include "async_function.h"
+#include "bench_util.h"
+
+#define ROUND_TRIPS 1000000
+#define MAX_FAN_IN 1000000
+#define CHAIN_DEPTH 1000
+#define CHAIN_REPEAT 200
+#define PENDING 1000000
+#define PIPELINE_LENGTH 10
+#define PIPELINE_REPEAT 100000
+
+static promise_manager_handle_t manager = NULL;
+static long handled = 0;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+static void bench_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    handled++;
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+static void bench_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    handled++;
+    if(free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+}
+
+static void bench_round_trip(bool late)
+{
+    bench_t bench = bench_start(late ? "round_trip_late_await" : "round_trip_early_await");
+    for(int i=0;i<ROUND_TRIPS;i++)
+    {
+        promise_handle_t promise = promise_new(manager);
+        if(late)
+        {
+            promise_resolve(manager,promise,(promise_data_t){.number=i},NULL,NULL);
+            promise_await(manager,promise,bench_then,NULL,true,bench_catch,NULL,true);
+        }
+        else
+        {
+            promise_await(manager,promise,bench_then,NULL,true,bench_catch,NULL,true);
+            promise_resolve(manager,promise,(promise_data_t){.number=i},NULL,NULL);
+        }
+    }
+    bench_report(&bench,0,ROUND_TRIPS);
+}
+
+static void bench_fan_in(bool any, int n)
+{
+    promise_handle_t* promises = malloc(sizeof(promise_handle_t)*n);
+    promise_handle_t* subs = malloc(sizeof(promise_handle_t)*n);
+    if(!promises || !subs)
+        exit(1);
+    bench_t bench = bench_start(any ? "promise_any_n" : "promise_all_n");
+    for(int i=0;i<n;i++)
+        promises[i] = subs[i] = promise_new(manager);
+    promise_handle_t group = any ? promise_any_n(manager,n,promises) : promise_all_n(manager,n,promises);
+    promise_await(manager,group,bench_then,NULL,true,bench_catch,NULL,true);
+    /** the group settles on the last sub promise */
+    for(int i=0;i<n;i++)
+    {
+        if(any)
+            promise_reject(manager,subs[i],(promise_data_t){.number=i},NULL,NULL);
+        else
+            promise_resolve(manager,subs[i],(promise_data_t){.number=i},NULL,NULL);
+    }
+    bench_report(&bench,n,n);
+    free(promises);
+    free(subs);
+}
+
+static promise_handle_t chain_leaf = NULL;
+
+static promise_handle_t leaf()
+{
+    chain_leaf = promise_new(manager);
+    return chain_leaf;
+}
+
+ASYNC(chain,(int depth),
+    int depth;,
+    ARG_INIT(depth);)
+{
+    if(VAR(depth) == 0)
+    {
+        AWAIT(leaf());
+    }
+    else
+    {
+        AWAIT(chain(VAR(depth)-1));
+    }
+    RETURN(number,VAR(depth),NULL,NULL);
+    ASYNC_END();
+}
+
+static void bench_async_chain()
+{
+    bench_t bench = bench_start("async_await_chain");
+    for(int i=0;i<CHAIN_REPEAT;i++)
+    {
+        promise_await(manager,chain(CHAIN_DEPTH),bench_then,NULL,true,bench_catch,NULL,true);
+        promise_resolve(manager,chain_leaf,(promise_data_t){.number=0},NULL,NULL);
+    }
+    bench_report(&bench,CHAIN_DEPTH,(long)CHAIN_DEPTH*CHAIN_REPEAT);
+}
+
+static void add_one(promise_value_t* value, void* ctx)
+{
+    value->data.number += 1;
+}
+
+/** the stages are fused, one derived promise per pipeline */
+static void bench_then_pipeline()
+{
+    bench_t bench = bench_start("promise_then_pipeline");
+    for(int i=0;i<PIPELINE_REPEAT;i++)
+    {
+        promise_handle_t source = promise_new(manager);
+        promise_handle_t derived = source;
+        for(int j=0;j<PIPELINE_LENGTH;j++)
+            derived = promise_then(manager,derived,add_one,NULL);
+        promise_await(manager,derived,bench_then,NULL,true,bench_catch,NULL,true);
+        promise_resolve(manager,source,(promise_data_t){.number=0},NULL,NULL);
+    }
+    bench_report(&bench,PIPELINE_LENGTH,(long)PIPELINE_LENGTH*PIPELINE_REPEAT);
+}
+
+static void bench_timeout(int n)
+{
+    promise_handle_t* inners = malloc(sizeof(promise_handle_t)*n);
+    if(!inners)
+        exit(1);
+    bench_t bench = bench_start("promise_timeout_schedule_cancel");
+    for(int i=0;i<n;i++)
+    {
+        inners[i] = promise_new(manager);
+        promise_handle_t timeout = promise_timeout(manager,inners[i],1000 + i%60000);
+        promise_await(manager,timeout,bench_then,NULL,true,bench_catch,NULL,true);
+    }
+    /** every request beats its deadline, removing its timer */
+    for(int i=0;i<n;i++)
+        promise_resolve(manager,inners[i],(promise_data_t){.number=i},NULL,NULL);
+    bench_report(&bench,n,n);
+    free(inners);
+}
+
+/** memory held by pending promises with one handler each, then the cost to settle them */
+static void bench_pending()
+{
+    promise_manager_handle_t pending = promise_manager_new();
+    promise_handle_t* promises = malloc(sizeof(promise_handle_t)*PENDING);
+    if(!pending || !promises)
+        exit(1);
+    bench_t bench = bench_start("promise_new_await_pending");
+    for(int i=0;i<PENDING;i++)
+    {
+        promises[i] = promise_new(pending);
+        promise_await(pending,promises[i],bench_then,NULL,true,bench_catch,NULL,true);
+    }
+    bench_report(&bench,PENDING,PENDING);
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(pending,&stats) == 0)
+        printf("{\"bench\":\"pending_memory\",\"param\":%d,\"bytes_held\":%zu,\"bytes_per_promise\":%.1f}\n",
+            PENDING,stats.bytes_held,(double)stats.bytes_held/PENDING);
+    bench = bench_start("promise_settle_pending");
+    for(int i=0;i<PENDING;i++)
+        promise_resolve(pending,promises[i],(promise_data_t){.number=i},NULL,NULL);
+    bench_report(&bench,PENDING,PENDING);
+    promise_manager_free(pending);
+    free(promises);
+}
+
+static void bench_manager_free()
+{
+    promise_manager_handle_t pending = promise_manager_new();
+    for(int i=0;i<PENDING;i++)
+    {
+        promise_handle_t promise = promise_new(pending);
+        promise_await(pending,promise,bench_then,NULL,true,bench_catch,NULL,true);
+    }
+    bench_t bench = bench_start("promise_manager_free_pending");
+    promise_manager_free(pending);
+    bench_report(&bench,PENDING,PENDING);
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    if(!manager)
+        return 1;
+    bench_round_trip(false);
+    bench_round_trip(true);
+    for(int n=1;n<=MAX_FAN_IN;n*=10)
+        bench_fan_in(false,n);
+    for(int n=1;n<=MAX_FAN_IN;n*=10)
+        bench_fan_in(true,n);
+    bench_async_chain();
+    bench_then_pipeline();
+    bench_timeout(PENDING);
+    bench_pending();
+    bench_manager_free();
+    promise_manager_free(manager);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include "promise.h"
+#include "promise_executor.h"
+#include "bench_util.h"
+
+#define JOBS 200000
+#define WORK 2000
+
+static int settled = 0;
+
+static promise_handle_t cpu_job(promise_manager_handle_t shard, void* ctx)
+{
+    /** some cpu work that can not be optimized away */
+    volatile double x = (double)(long)ctx;
+    for(int i=0;i<WORK;i++)
+        x = x*1.0000001 + 1;
+    promise_handle_t promise = promise_new(shard);
+    promise_resolve(shard,promise,(promise_data_t){.number=x},NULL,NULL);
+    return promise;
+}
+
+static void bench_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    settled++;
+}
+
+static void bench_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    settled++;
+}
+
+int main(int argc, char const *argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 32;
+    promise_manager_options_t options = {
+        .initial_capacity = 4096,
+        .max_retained_bytes = 4*1024*1024,
+        .remote_settle = true
+    };
+    for(int threads=1;threads<=max_threads;threads*=2)
+    {
+        promise_manager_handle_t manager = promise_manager_new_with_options(&options);
+        promise_executor_handle_t executor = promise_executor_new(threads);
+        if(!manager || !executor)
+        {
+            fprintf(stderr,"setup failed\n");
+            return 1;
+        }
+        settled = 0;
+        bench_t bench = bench_start("executor_cpu_jobs");
+        for(long i=0;i<JOBS;i++)
+        {
+            promise_handle_t promise = promise_executor_submit(executor,manager,cpu_job,(void*)i);
+            promise_await(manager,promise,bench_then,NULL,false,bench_catch,NULL,false);
+        }
+        struct pollfd pfd = {.fd = promise_manager_get_fd(manager), .events = POLLIN};
+        while(settled < JOBS)
+        {
+            if(poll(&pfd,1,10000) <= 0)
+                break;
+            promise_manager_process_remote(manager);
+        }
+        bench_report(&bench,threads,settled);
+        promise_executor_free(executor);
+        promise_manager_free(manager);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "bench_util.h"
+
+/** linked with -Wl,--wrap=malloc,... see Makefile */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_aligned_alloc(size_t alignment, size_t size);
+
+static atomic_size_t malloc_count = 0;
+
+void* __wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&malloc_count,1,memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add_explicit(&malloc_count,1,memory_order_relaxed);
+    return __real_calloc(n,size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&malloc_count,1,memory_order_relaxed);
+    return __real_realloc(ptr,size);
+}
+
+void* __wrap_aligned_alloc(size_t alignment, size_t size)
+{
+    atomic_fetch_add_explicit(&malloc_count,1,memory_order_relaxed);
+    return __real_aligned_alloc(alignment,size);
+}
+
+double bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+size_t bench_malloc_count()
+{
+    return atomic_load(&malloc_count);
+}
+
+/** VmHWM can be reset by writing 5 to clear_refs */
+static void bench_reset_peak_rss()
+{
+    FILE* f = fopen("/proc/self/clear_refs","w");
+    if(!f)
+        return;
+    fputs("5",f);
+    fclose(f);
+}
+
+static long bench_peak_rss_kb()
+{
+    FILE* f = fopen("/proc/self/status","r");
+    if(!f)
+        return -1;
+    char line[256];
+    long kb = -1;
+    while(fgets(line,sizeof(line),f))
+    {
+        if(strncmp(line,"VmHWM:",6)==0)
+        {
+            kb = strtol(line+6,NULL,10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+bench_t bench_start(const char* name)
+{
+    bench_reset_peak_rss();
+    bench_t bench = {
+        .name = name,
+        .start_mallocs = bench_malloc_count(),
+        .start_ns = bench_now_ns()
+    };
+    return bench;
+}
+
+void bench_report(const bench_t* bench, long param, long ops)
+{
+    double elapsed = bench_now_ns() - bench->start_ns;
+    size_t mallocs = bench_malloc_count() - bench->start_mallocs;
+    if(ops <= 0)
+        ops = 1;
+    printf("{\"bench\":\"%s\",\"param\":%ld,\"ops\":%ld,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,"
+        "\"peak_rss_kb\":%ld,\"mallocs\":%zu,\"mallocs_per_op\":%.3f}\n",
+        bench->name,param,ops,elapsed/ops,ops/(elapsed*1e-9),
+        bench_peak_rss_kb(),mallocs,(double)mallocs/ops);
+    fflush(stdout);
+}
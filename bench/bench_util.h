@@ -0,0 +1,44 @@
+#ifndef __BENCH_UTIL_H
+#define __BENCH_UTIL_H
+
+#include <stddef.h>
+
+/**
+ * @brief Snapshot taken by bench_start and consumed by bench_report.
+ */
+typedef struct
+{
+    const char* name;
+    double start_ns;
+    size_t start_mallocs;
+} bench_t;
+
+/**
+ * @brief Current monotonic time in ns.
+ */
+double bench_now_ns();
+
+/**
+ * @brief Number of malloc/calloc/realloc/aligned_alloc calls so far.
+ * Counted through the linker's --wrap, so only calls from the library and the bench count.
+ */
+size_t bench_malloc_count();
+
+/**
+ * @brief Reset the peak RSS and start measuring.
+ * 
+ * @param name benchmark name, reported as is
+ * @return bench_t 
+ */
+bench_t bench_start(const char* name);
+
+/**
+ * @brief Print one JSON line with ops/sec, ns/op, peak RSS and malloc count since bench_start.
+ * 
+ * @param bench 
+ * @param param the size parameter of the benchmark, e.g. n of promise_all_n
+ * @param ops number of operations done
+ */
+void bench_report(const bench_t* bench, long param, long ops);
+
+#endif
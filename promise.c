@@ -1,14 +1,231 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/eventfd.h>
+/** the library calls the plain creation functions, see PROMISE_CENSUS */
+#define PROMISE_CENSUS_NO_SITES
 #include "promise.h"
-#include "map/map.h"
+
+/** build with -DPROMISE_NO_STATS to compile the counters out */
+#ifndef PROMISE_NO_STATS
+#define PROMISE_STATS(statement) do{ statement; }while(0)
+#else
+#define PROMISE_STATS(statement) do{ }while(0)
+#endif
+
+/** build with -DPROMISE_TRACE to compile the trace events in, see promise_manager_trace_start */
+#ifdef PROMISE_TRACE
+#define PROMISE_TRACE_EVENT(manager,type,promise,other) \
+    promise_trace_record(manager,type,promise,other,NULL,0,0)
+#else
+#define PROMISE_TRACE_EVENT(manager,type,promise,other) do{ }while(0)
+#endif
+
+#define PROMISE_POOL_DEFAULT_CAPACITY 64
+#define PROMISE_POOL_DEFAULT_MAX_RETAINED (256*1024)
+/** promise_t is kept within a cache line */
+#define PROMISE_CACHE_LINE 64
+/** size classes of promise_manager_alloc, larger blocks go to malloc */
+#define PROMISE_FRAME_CLASS_SIZE 64
+#define PROMISE_FRAME_CLASSES 16
+
+typedef struct promise_pool_node_s
+{
+    struct promise_pool_node_s* next;
+} promise_pool_node_t;
+
+/** 
+ * Fixed size object pool. Objects are carved from a preallocated slab first, 
+ * overflow objects are malloced and kept on the free list up to max_retained bytes.
+ */
+typedef struct
+{
+    size_t object_size;
+    char* slab;
+    char* slab_end;
+    promise_pool_node_t* free_list;
+    size_t retained;                /** bytes of overflow objects on the free list */
+    size_t max_retained;
+    size_t overflow_bytes;          /** bytes of overflow objects, live or retained */
+} promise_pool_t;
+
+/** 
+ * promise_handle_t layout: generation in the high half, slot index in the low half.
+ * The generation is never 0, so a valid handle is never NULL.
+ */
+#define PROMISE_SLOT_INDEX_BITS (sizeof(uintptr_t)*4)
+#define PROMISE_SLOT_INDEX_MASK ((((uintptr_t)1)<<PROMISE_SLOT_INDEX_BITS)-1)
+#define PROMISE_SLOT_NONE PROMISE_SLOT_INDEX_MASK
+#define PROMISE_SLOT_MIN_CAPACITY 16
+#define PROMISE_MICROTASK_MIN_CAPACITY 64
+#define PROMISE_SLOT_HANDLE(generation,index) ((promise_handle_t)((((uintptr_t)(generation))<<PROMISE_SLOT_INDEX_BITS)|(index)))
+
+#ifdef PROMISE_TRACE
+typedef enum
+{
+    PROMISE_TRACE_CREATE,
+    PROMISE_TRACE_RESOLVE,
+    PROMISE_TRACE_REJECT,
+    PROMISE_TRACE_CANCEL,           /** freed before it settled */
+    PROMISE_TRACE_DISPATCH,
+    PROMISE_TRACE_LINK,             /** promise waits for other: group member, chain source, timeout */
+    PROMISE_TRACE_STEP              /** an ASYNC function awaits other at file:line */
+} promise_trace_type_t;
+
+typedef struct
+{
+    uint64_t ns;
+    uint64_t duration_ns;           /** dispatch only */
+    promise_handle_t promise;
+    promise_handle_t other;
+    const char* file;
+    int line;
+    promise_trace_type_t type;
+} promise_trace_event_t;
+#endif
+
+#ifdef PROMISE_CENSUS
+/** creation record of a slot, see promise_manager_dump_pending */
+typedef struct
+{
+    uint64_t created_ms;
+    const char* file;               /** NULL until promise_census_site */
+    int line;
+} promise_census_t;
+#endif
+
+/** entry of the deferred dispatch ring */
+typedef struct
+{
+    promise_handle_t promise;
+#ifndef PROMISE_NO_STATS
+    uint64_t settled_ns;
+#endif
+} promise_microtask_t;
+
+typedef struct
+{
+    struct promise_s* promise;      /** NULL if the slot is free */
+    uint32_t generation;
+    uint32_t next_free;
+} promise_slot_t;
+
+/** 
+ * Rarely used fields of a promise, allocated on first use. 
+ * Promises owned by internal objects (timers, groups, chains) use one embedded in their owner.
+ */
+typedef struct
+{
+    struct promise_handler_s* first_handler;    /** handlers after the inline one, in order */
+    struct promise_handler_s* last_handler;
+    promise_cancel_handler_t on_cancel;
+    void* cancel_ctx;
+    /** the owner of the promise, or the promise itself for promise_set_free_handler */
+    void* internal_data;
+    void(*internal_free)(void*, void*);
+    void* internal_free_ctx;
+    bool embedded;                  /** part of internal_data, not from the ext pool */
+    /** lazy promises, see promise_new_lazy. Cleared once started */
+    promise_start_handler_t on_start;
+    promise_cancel_handler_t on_discard;
+    void* start_ctx;
+} promise_ext_t;
+
+/** 
+ * Timers live in a hierarchical timing wheel of PROMISE_WHEEL_LEVELS levels with 
+ * PROMISE_WHEEL_SLOTS slots each. Level l slots are 64^l ms wide. A timer is kept in the level 
+ * its deadline falls in and moves down a level each time the level below wraps around.
+ */
+#define PROMISE_WHEEL_BITS 6
+#define PROMISE_WHEEL_SLOTS (1<<PROMISE_WHEEL_BITS)
+#define PROMISE_WHEEL_MASK ((uint64_t)PROMISE_WHEEL_SLOTS - 1)
+#define PROMISE_WHEEL_LEVELS 6
+
+typedef struct promise_timer_link_s
+{
+    struct promise_timer_link_s* prev;
+    struct promise_timer_link_s* next;
+} promise_timer_link_t;
+
+/** timer of promise_delay and promise_timeout, intrusive node of a wheel slot */
+typedef struct
+{
+    promise_timer_link_t link;      /** MUST be the first member, unlinked if next is NULL */
+    promise_manager_handle_t manager;
+    int level;                      /** wheel level, -1 on the due list */
+    uint64_t expire_ms;
+    promise_handle_t promise;       /** the delay or timeout promise, owns the timer */
+    promise_handle_t inner;         /** promise_timeout: the promise raced against the timer */
+    promise_ext_t ext;              /** of promise */
+} promise_timer_t;
+
+/** settle request from another thread, intrusive node of the remote queue */
+typedef struct promise_remote_node_s
+{
+    _Atomic(struct promise_remote_node_s*) next;
+    promise_handle_t promise;
+    bool rejected;
+    promise_data_t data;
+    void(*free_data)(void*,void*);
+    void* free_ctx;
+} promise_remote_node_t;
 
 typedef struct
 {
-    /** @type {Map<promise_handle_t, promise_t*>} */
-    map_handle_t promises;
-    void* id_seed;
+    promise_slot_t* slots;
+    uintptr_t slot_capacity;
+    uintptr_t slot_count;           /** slots ever used, [0,slot_count) */
+    uintptr_t free_slot;            /** head of the free slot list */
+    promise_pool_t promise_pool;
+    promise_pool_t handler_pool;
+    promise_pool_t ext_pool;
+    promise_pool_t group_pool;
+    promise_pool_t frame_pools[PROMISE_FRAME_CLASSES];
+    /** deferred dispatch, a ring of settled promises waiting for promise_manager_run */
+    bool deferred_dispatch;
+    promise_microtask_t* microtasks;
+    size_t microtask_capacity;
+    size_t microtask_head;
+    size_t microtask_count;
+    /** 
+     * remote settle, a multi producer single consumer queue.
+     * Producers push at remote_head, the owner thread pops at remote_tail.
+     */
+    int remote_fd;
+    _Atomic(promise_remote_node_t*) remote_head;
+    promise_remote_node_t* remote_tail;
+    promise_remote_node_t remote_stub;
+    atomic_bool remote_signaled;    /** set if remote_fd is already signaled */
+    /** timers, see promise_manager_advance_time */
+    promise_pool_t timer_pool;
+    uint64_t now_ms;
+    size_t timer_count;             /** timers in the wheel */
+    size_t wheel_count[PROMISE_WHEEL_LEVELS];
+    promise_timer_link_t wheel[PROMISE_WHEEL_LEVELS][PROMISE_WHEEL_SLOTS];
+    promise_timer_link_t timers_due;    /** timers being fired by promise_manager_advance_time */
+#ifndef PROMISE_NO_STATS
+    promise_manager_stats_t stats;
+    size_t group_bytes;             /** bytes of group arrays outside the group pool */
+#endif
+#ifdef PROMISE_TRACE
+    /** 
+     * trace events, a ring overwriting the oldest ones. 
+     * Only the owner thread writes it, so it takes no lock.
+     */
+    promise_trace_event_t* trace_events;
+    size_t trace_capacity;          /** a power of 2 */
+    uint64_t trace_next;            /** events ever recorded */
+#endif
+#ifdef PROMISE_CENSUS
+    promise_census_t* census;       /** parallel to slots, slot_capacity entries */
+#endif
 } promise_manager_t;
 
 typedef struct promise_handler_s
@@ -22,47 +239,206 @@ typedef struct promise_handler_s
     bool takeover_reason;
 } promise_handler_t;
 
-typedef struct
+/** state bits of promise_t */
+#define PROMISE_RESOLVED                0x0001
+#define PROMISE_REJECTED                0x0002
+#define PROMISE_SETTLED                 (PROMISE_RESOLVED|PROMISE_REJECTED)
+#define PROMISE_DATA_BOOKED             0x0004  /** a handler booked the data */
+#define PROMISE_REASON_BOOKED           0x0008  /** a handler booked the reason */
+#define PROMISE_TAKEN_OVER              0x0010  /** the value is taken over by a handler */
+#define PROMISE_QUEUED                  0x0020  /** waiting in the microtask ring */
+#define PROMISE_INLINE_HANDLER          0x0040  /** the inline handler is set */
+#define PROMISE_INLINE_TAKEOVER_DATA    0x0080
+#define PROMISE_INLINE_TAKEOVER_REASON  0x0100
+
+/** 
+ * A promise is resolved or rejected, never both, so the data and the reason share the value.
+ * The first handler is stored inline when its then and catch share a ctx, most promises
+ * have only that one. Everything else lives in ext. 
+ */
+typedef struct promise_s
 {
-    promise_handler_t* first_handler;
-    promise_handler_t* last_handler;
-    /** resolve */
-    bool resolved;
-    promise_data_t resolve_data;
-    void(*free_data)(void* data, void* ctx);
-    void* free_data_ctx;
-    bool data_booked;               /** if there is already a handler booked the data */
-    bool data_taken_over;           /** if the data is already taken over by a handler */
-    /** reject */
-    bool rejected;
-    promise_data_t reject_reason;
-    void(*free_reason)(void* reason, void* ctx);
-    void* free_reason_ctx;
-    bool reason_booked;             /** if there is already a handler booked the reason */
-    bool reason_taken_over;         /** if the reason is already taken over by a handler */
-    /** internal use */
+    promise_data_t value;
+    void(*free_value)(void* value, void* ctx);
+    void* free_value_ctx;
+    promise_then_handler_t then;
+    promise_catch_handler_t catch;
+    void* handler_ctx;
+    promise_ext_t* ext;             /** NULL until a rare field is needed */
+    uint16_t state;
+} promise_t;
+
+_Static_assert(sizeof(promise_t) <= PROMISE_CACHE_LINE,"promise_t should fit in a cache line");
+
+/** promise group, see promise.all/promise.any */
+typedef struct promise_group_s promise_group_t;
+typedef struct promise_group_sub_promise_ctx_s promise_group_sub_promise_ctx_t;
+
+struct promise_group_sub_promise_ctx_s
+{
+    int index;
+    promise_handle_t promise;
+    promise_group_t* group;
+};
+
+/** 
+ * A group is a single block: this header, then length sub promise contexts, then length data list items.
+ * Groups of up to PROMISE_GROUP_POOL_LENGTH sub promises come from the group pool.
+ */
+struct promise_group_s
+{
+    promise_manager_handle_t manager;
+    promise_handle_t promise;
+    int length;
+    promise_group_sub_promise_ctx_t* sub_promises;
+    promise_data_list_t data_list;
+    int data_count;
+    bool list_handed_out;           /** the data list is the result of the group promise */
+    bool list_released;             /** the data list is freed, see promise_group_free_data_list_with_ctx */
+    bool group_released;            /** the group promise is freed */
+    int busy;                       /** in a callback that may free the group promise, keep the block */
+    promise_ext_t ext;              /** of promise */
+    /** promise_map_limited, sub promises are started on demand */
     struct
     {
-        void* data;
-        void(*free_data)(void*, void*);
-        void* free_ctx;  
-    } internal;
-} promise_t;
+        promise_map_func_t func;
+        void* ctx;
+        int started;
+        int in_flight;
+        int max_in_flight;
+        bool filling;               /** settling is left to promise_map_fill */
+        bool failed;
+        promise_data_t reason;
+        void(*free_reason)(void*,void*);
+        void* free_reason_ctx;
+    } map;
+    /** promise_all_stream_n, sub results go to on_item instead of the data list */
+    struct
+    {
+        promise_stream_item_t on_item;
+        void* ctx;
+    } stream;
+};
+
+#define PROMISE_GROUP_POOL_LENGTH 4
+#define PROMISE_GROUP_BLOCK_SIZE(n) (sizeof(promise_group_t) \
+    + (sizeof(promise_group_sub_promise_ctx_t) + sizeof(promise_data_list_item_t))*(n))
+
+static int promise_pool_init(promise_pool_t* pool, size_t object_size, int capacity, size_t max_retained);
+static void promise_pool_destroy(promise_pool_t* pool);
+static void* promise_pool_alloc(promise_pool_t* pool);
+static void promise_pool_release(promise_pool_t* pool, void* object);
+
+static promise_handle_t promise_slot_add(promise_manager_t* manager, promise_t* promise);
+static promise_t* promise_slot_get(promise_manager_t* manager, promise_handle_t handle);
+static promise_t* promise_slot_remove(promise_manager_t* manager, promise_handle_t handle);
+
+static void promise_remote_push(promise_manager_t* manager, promise_remote_node_t* node);
+static promise_remote_node_t* promise_remote_pop(promise_manager_t* manager);
 
-static void promise_free(promise_t* promise);
-static void promise_free_with_ctx(void* data, void* ctx);
+static void promise_timer_tick(promise_manager_t* manager);
+static int promise_timer_fire_due(promise_manager_t* manager);
+
+static int promise_settle_n(
+    promise_manager_t* manager, int count, const promise_handle_t promises[],
+    const promise_data_t values[], void(*const free_values[])(void*,void*), void* const ctx[], bool reject);
+static void promise_settled(promise_manager_t* manager, promise_handle_t promise_handle, promise_t* promise);
+static int promise_dispatch(promise_manager_t* manager, promise_handle_t promise_handle, promise_t* promise);
+static void promise_free(promise_manager_t* manager, promise_t* promise);
+#if !defined(PROMISE_NO_STATS) || defined(PROMISE_TRACE)
+static uint64_t promise_now_ns();
+#endif
+#ifndef PROMISE_NO_STATS
+static void promise_stats_record_delay(promise_manager_t* manager, uint64_t delay_ns);
+static size_t promise_pool_bytes(promise_pool_t* pool);
+#endif
+#ifdef PROMISE_TRACE
+static void promise_trace_record(
+    promise_manager_t* manager, promise_trace_type_t type,
+    promise_handle_t promise, promise_handle_t other,
+    const char* file, int line, uint64_t start_ns);
+static void promise_trace_write(FILE* file, const promise_trace_event_t* event);
+#endif
+#ifdef PROMISE_CENSUS
+static uint64_t promise_census_now_ms();
+static size_t promise_census_bytes(promise_t* promise);
+#endif
 
 promise_manager_handle_t promise_manager_new()
 {
-    promise_manager_t* manager = malloc(sizeof(promise_manager_t));
+    promise_manager_options_t options = {
+        .initial_capacity = PROMISE_POOL_DEFAULT_CAPACITY,
+        .max_retained_bytes = PROMISE_POOL_DEFAULT_MAX_RETAINED
+    };
+    return promise_manager_new_with_options(&options);
+}
+
+promise_manager_handle_t promise_manager_new_with_options(const promise_manager_options_t* options)
+{
+    promise_manager_t* manager = NULL;
+    if(!options)
+        goto error;
+    if(options->initial_capacity < 0)
+        goto error;
+    manager = malloc(sizeof(promise_manager_t));
     if(!manager)
         goto error;
     memset(manager,0,sizeof(promise_manager_t));
+    manager->remote_fd = -1;
     
-    manager->id_seed = NULL+1;
-    manager->promises = map_create();
-    if(!manager->promises)
+    if(promise_pool_init(&manager->promise_pool,sizeof(promise_t),
+        options->initial_capacity,options->max_retained_bytes)!=0)
+        goto error;
+    if(promise_pool_init(&manager->handler_pool,sizeof(promise_handler_t),
+        options->initial_capacity,options->max_retained_bytes)!=0)
+        goto error;
+    if(promise_pool_init(&manager->ext_pool,sizeof(promise_ext_t),
+        options->initial_capacity/4,options->max_retained_bytes)!=0)
         goto error;
+    if(promise_pool_init(&manager->group_pool,PROMISE_GROUP_BLOCK_SIZE(PROMISE_GROUP_POOL_LENGTH),
+        options->initial_capacity/4,options->max_retained_bytes)!=0)
+        goto error;
+    for(int i=0;i<PROMISE_FRAME_CLASSES;i++)
+    {
+        if(promise_pool_init(&manager->frame_pools[i],PROMISE_FRAME_CLASS_SIZE*(i+1),
+            0,options->max_retained_bytes)!=0)
+            goto error;
+    }
+    if(promise_pool_init(&manager->timer_pool,sizeof(promise_timer_t),
+        options->initial_capacity/4,options->max_retained_bytes)!=0)
+        goto error;
+    for(int level=0;level<PROMISE_WHEEL_LEVELS;level++)
+    {
+        for(int slot=0;slot<PROMISE_WHEEL_SLOTS;slot++)
+            manager->wheel[level][slot].prev = manager->wheel[level][slot].next = &manager->wheel[level][slot];
+    }
+    manager->timers_due.prev = manager->timers_due.next = &manager->timers_due;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    manager->now_ms = (uint64_t)now.tv_sec*1000 + now.tv_nsec/1000000;
+    manager->slot_capacity = options->initial_capacity > PROMISE_SLOT_MIN_CAPACITY ?
+        options->initial_capacity : PROMISE_SLOT_MIN_CAPACITY;
+    manager->slots = malloc(sizeof(promise_slot_t)*manager->slot_capacity);
+    if(!manager->slots)
+        goto error;
+#ifdef PROMISE_CENSUS
+    manager->census = malloc(sizeof(promise_census_t)*manager->slot_capacity);
+    if(!manager->census)
+        goto error;
+#endif
+    manager->slot_count = 0;
+    manager->free_slot = PROMISE_SLOT_NONE;
+    manager->deferred_dispatch = options->deferred_dispatch;
+    atomic_init(&manager->remote_stub.next,NULL);
+    atomic_init(&manager->remote_head,&manager->remote_stub);
+    manager->remote_tail = &manager->remote_stub;
+    atomic_init(&manager->remote_signaled,false);
+    if(options->remote_settle)
+    {
+        manager->remote_fd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+        if(manager->remote_fd < 0)
+            goto error;
+    }
 
     return (promise_manager_handle_t)manager;
 error:
@@ -75,50 +451,136 @@ void promise_manager_free(promise_manager_handle_t manager_handle)
     promise_manager_t* manager = (promise_manager_t*)manager_handle;
     if(manager)
     {
-        if(manager->promises)
-            map_delete(manager->promises,promise_free_with_ctx,NULL);
+        if(manager->slots)
+        {
+            /** freeing a promise may destroy others, always go through the slot table */
+            for(uintptr_t i=0;i<manager->slot_count;i++)
+            {
+                if(manager->slots[i].promise)
+                {
+                    promise_handle_t handle = PROMISE_SLOT_HANDLE(manager->slots[i].generation,i);
+                    promise_free(manager,promise_slot_remove(manager,handle));
+                }
+            }
+            free(manager->slots);
+        }
+        free(manager->microtasks);
+        if(manager->remote_fd >= 0)
+        {
+            /** drop settle requests nobody will process */
+            promise_remote_node_t* node = NULL;
+            while((node = promise_remote_pop(manager)))
+            {
+                if(node->free_data)
+                    node->free_data(node->data.ptr,node->free_ctx);
+                free(node);
+            }
+            close(manager->remote_fd);
+        }
+        /** pools go last, freeing promises returns objects to them */
+        promise_pool_destroy(&manager->promise_pool);
+        promise_pool_destroy(&manager->handler_pool);
+        promise_pool_destroy(&manager->ext_pool);
+        promise_pool_destroy(&manager->group_pool);
+        for(int i=0;i<PROMISE_FRAME_CLASSES;i++)
+            promise_pool_destroy(&manager->frame_pools[i]);
+        promise_pool_destroy(&manager->timer_pool);
+#ifdef PROMISE_TRACE
+        free(manager->trace_events);
+#endif
+#ifdef PROMISE_CENSUS
+        free(manager->census);
+#endif
         free(manager);
     }
 }
 
+/** ext is embedded in user_data, set only with free_user_data */
 static promise_handle_t promise_new_internal(
     promise_manager_handle_t manager_handle, 
-    void* user_data, void(*free_user_data)(void*,void*),void* free_user_data_ctx)
+    void* user_data, void(*free_user_data)(void*,void*),void* free_user_data_ctx, promise_ext_t* ext)
 {
     promise_manager_t* manager = (promise_manager_t*)manager_handle;
     promise_t* promise = NULL;
     if(!manager)
         goto error;
-    promise = malloc(sizeof(promise_t));
+    promise = promise_pool_alloc(&manager->promise_pool);
     if(!promise)
         goto error;
     memset(promise,0,sizeof(promise_t));
-    promise->internal.data = user_data;
-    promise->internal.free_data = free_user_data;
-    promise->internal.free_ctx = free_user_data_ctx;
-    promise->first_handler = NULL;
-    promise->last_handler = NULL;
-    promise->resolved = false;
-    promise->rejected = false;
-    promise->free_data = NULL;
-    promise->free_reason = NULL;
-    promise->data_taken_over = false;
-    promise->reason_taken_over = false;
-    promise->data_booked = false;
-    promise->reason_booked = false;
-    promise_handle_t promise_handle = manager->id_seed++;
-    /** promise handle should never overlap, not handled here */
-    if(map_add(manager->promises,&promise_handle,sizeof(promise_handle),promise)==NULL)
+    if(free_user_data)
+    {
+        memset(ext,0,sizeof(promise_ext_t));
+        ext->internal_data = user_data;
+        ext->internal_free = free_user_data;
+        ext->internal_free_ctx = free_user_data_ctx;
+        ext->embedded = true;
+        promise->ext = ext;
+    }
+    promise_handle_t promise_handle = promise_slot_add(manager,promise);
+    if(!promise_handle)
         goto error;
+    PROMISE_STATS(
+        manager->stats.created++;
+        if(++manager->stats.live_promises > manager->stats.peak_live_promises)
+            manager->stats.peak_live_promises = manager->stats.live_promises;
+    );
+    PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_CREATE,promise_handle,NULL);
+#ifdef PROMISE_CENSUS
+    promise_census_t* census = &manager->census[((uintptr_t)promise_handle)&PROMISE_SLOT_INDEX_MASK];
+    census->created_ms = promise_census_now_ms();
+    census->file = NULL;
+    census->line = 0;
+#endif
     return promise_handle;
 error:
-    promise_free(promise);
+    /** nothing is attached yet, the caller keeps user_data */
+    if(promise)
+        promise_pool_release(&manager->promise_pool,promise);
     return NULL;
 }
 
+static promise_ext_t* promise_ext_get(promise_manager_t* manager, promise_t* promise)
+{
+    if(!promise->ext)
+    {
+        promise->ext = promise_pool_alloc(&manager->ext_pool);
+        if(promise->ext)
+            memset(promise->ext,0,sizeof(promise_ext_t));
+    }
+    return promise->ext;
+}
+
+static bool promise_has_handler(promise_t* promise)
+{
+    return (promise->state & PROMISE_INLINE_HANDLER) || (promise->ext && promise->ext->first_handler);
+}
+
 promise_handle_t promise_new(promise_manager_handle_t manager_handle)
 {
-    return promise_new_internal(manager_handle,NULL,NULL,NULL);
+    return promise_new_internal(manager_handle,NULL,NULL,NULL,NULL);
+}
+
+promise_handle_t promise_new_lazy(
+    promise_manager_handle_t manager_handle, 
+    promise_start_handler_t on_start, promise_cancel_handler_t on_discard, void* ctx)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || !on_start)
+        return NULL;
+    promise_handle_t promise_handle = promise_new_internal(manager,NULL,NULL,NULL,NULL);
+    if(!promise_handle)
+        return NULL;
+    promise_ext_t* ext = promise_ext_get(manager,promise_slot_get(manager,promise_handle));
+    if(!ext)
+    {
+        promise_destroy(manager,promise_handle);
+        return NULL;
+    }
+    ext->on_start = on_start;
+    ext->on_discard = on_discard;
+    ext->start_ctx = ctx;
+    return promise_handle;
 }
 
 void promise_destroy(promise_manager_handle_t manager_handle, promise_handle_t promise_handle)
@@ -126,8 +588,81 @@ void promise_destroy(promise_manager_handle_t manager_handle, promise_handle_t p
     promise_manager_t* manager = (promise_manager_t*)manager_handle;
     if(!manager)
         return;
-    promise_t* promise = map_remove(manager->promises,&promise_handle,sizeof(promise_handle));
-    promise_free(promise);
+    promise_t* promise = promise_slot_remove(manager,promise_handle);
+    PROMISE_STATS(if(promise) manager->stats.destroyed++);
+    PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_CANCEL,
+        promise && !(promise->state & PROMISE_SETTLED) ? promise_handle : NULL,NULL);
+    promise_free(manager,promise);
+}
+
+int promise_set_cancel_handler(
+    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, 
+    promise_cancel_handler_t on_cancel, void* ctx)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        goto error;
+    promise_t* promise = promise_slot_get(manager,promise_handle);
+    if(!promise)
+        goto error;
+    if(promise->state & PROMISE_SETTLED)
+        goto error;
+    if(!on_cancel && !promise->ext)
+        return 0;
+    promise_ext_t* ext = promise_ext_get(manager,promise);
+    if(!ext)
+        goto error;
+    ext->on_cancel = on_cancel;
+    ext->cancel_ctx = ctx;
+    return 0;
+error:
+    return -1;
+}
+
+int promise_set_free_handler(
+    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, 
+    promise_free_handler_t on_free, void* ctx)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        goto error;
+    promise_t* promise = promise_slot_get(manager,promise_handle);
+    if(!promise)
+        goto error;
+    /** the internal free of timers, chains and groups is taken */
+    if(promise->ext && promise->ext->embedded)
+        goto error;
+    if(!on_free && !promise->ext)
+        return 0;
+    promise_ext_t* ext = promise_ext_get(manager,promise);
+    if(!ext)
+        goto error;
+    ext->internal_data = promise_handle;
+    ext->internal_free = on_free;
+    ext->internal_free_ctx = ctx;
+    return 0;
+error:
+    return -1;
+}
+
+int promise_cancel(promise_manager_handle_t manager_handle, promise_handle_t promise_handle)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        goto error;
+    /** detach first, the cancel handler may cancel other promises or try to settle this one */
+    promise_t* promise = promise_slot_remove(manager,promise_handle);
+    if(!promise)
+        goto error;
+    PROMISE_STATS(manager->stats.cancelled++);
+    PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_CANCEL,
+        !(promise->state & PROMISE_SETTLED) ? promise_handle : NULL,NULL);
+    if(!(promise->state & PROMISE_SETTLED) && promise->ext && promise->ext->on_cancel)
+        promise->ext->on_cancel(promise->ext->cancel_ctx);
+    promise_free(manager,promise);
+    return 0;
+error:
+    return -1;
 }
 
 int promise_resolve(
@@ -137,321 +672,1556 @@ int promise_resolve(
     promise_manager_t* manager = (promise_manager_t*)manager_handle;
     if(!manager)
         goto error;
-    promise_t* promise = map_get(manager->promises,&promise_handle,sizeof(promise_handle));
+    promise_t* promise = promise_slot_get(manager,promise_handle);
+    if(!promise)
+        goto error;
+    if(promise->state & PROMISE_SETTLED)
+        goto error;
+    promise->state |= PROMISE_RESOLVED;
+    PROMISE_STATS(manager->stats.resolved++);
+    PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_RESOLVE,promise_handle,NULL);
+    promise->value = data;
+    promise->free_value = free_data;
+    promise->free_value_ctx = ctx;
+    if(promise_has_handler(promise))
+        promise_settled(manager,promise_handle,promise);
+    return 0;
+error:
+    return -1;
+}
+
+int promise_reject(
+    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, 
+    promise_data_t reason, void(*free_reason)(void*,void*), void* ctx)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        goto error;
+    promise_t* promise = promise_slot_get(manager,promise_handle);
+    if(!promise)
+        goto error;
+    if(promise->state & PROMISE_SETTLED)
+        goto error;
+    promise->state |= PROMISE_REJECTED;
+    PROMISE_STATS(manager->stats.rejected++);
+    PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_REJECT,promise_handle,NULL);
+    promise->value = reason;
+    promise->free_value = free_reason;
+    promise->free_value_ctx = ctx;
+    if(promise_has_handler(promise))
+        promise_settled(manager,promise_handle,promise);
+    return 0;
+error:
+    return -1;
+}
+
+int promise_resolve_n(
+    promise_manager_handle_t manager, int count, const promise_handle_t promises[],
+    const promise_data_t data[], void(*const free_data[])(void*,void*), void* const ctx[])
+{
+    return promise_settle_n((promise_manager_t*)manager,count,promises,data,free_data,ctx,false);
+}
+
+int promise_reject_n(
+    promise_manager_handle_t manager, int count, const promise_handle_t promises[],
+    const promise_data_t reasons[], void(*const free_reasons[])(void*,void*), void* const ctx[])
+{
+    return promise_settle_n((promise_manager_t*)manager,count,promises,reasons,free_reasons,ctx,true);
+}
+
+int promise_await(
+    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, 
+    promise_then_handler_t then, void* then_ctx, bool takeover_data,
+    promise_catch_handler_t catch, void* catch_ctx, bool takeover_reason)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        goto error;
+    promise_t* promise = promise_slot_get(manager,promise_handle);
     if(!promise)
         goto error;
-    if(promise->resolved || promise->rejected)
+    if((!then) || (!catch))
+        goto error;
+    if((promise->state & PROMISE_DATA_BOOKED) && takeover_data)
         goto error;
-    promise->resolved = true;
-    promise->resolve_data = data;
-    promise->free_data = free_data;
-    promise->free_data_ctx = ctx;
-    if(promise->first_handler != NULL)
+    if((promise->state & PROMISE_REASON_BOOKED) && takeover_reason)
+        goto error;
+    if(!promise_has_handler(promise) && then_ctx == catch_ctx)
+    {
+        promise->then = then;
+        promise->catch = catch;
+        promise->handler_ctx = then_ctx;
+        promise->state |= PROMISE_INLINE_HANDLER
+            | (takeover_data ? PROMISE_INLINE_TAKEOVER_DATA : 0)
+            | (takeover_reason ? PROMISE_INLINE_TAKEOVER_REASON : 0);
+    }
+    else
+    {
+        promise_ext_t* ext = promise_ext_get(manager,promise);
+        if(!ext)
+            goto error;
+        promise_handler_t* new_handler = promise_pool_alloc(&manager->handler_pool);
+        if(!new_handler)
+            goto error;
+        new_handler->then = then;
+        new_handler->then_ctx = then_ctx;
+        new_handler->catch = catch;
+        new_handler->catch_ctx = catch_ctx;
+        new_handler->takeover_data = takeover_data;
+        new_handler->takeover_reason = takeover_reason;
+        new_handler->next = NULL;
+        if(ext->last_handler == NULL)
+            ext->first_handler = new_handler;
+        else
+            ext->last_handler->next = new_handler;
+        ext->last_handler = new_handler;
+    }
+    PROMISE_STATS(manager->stats.live_handlers++);
+    if(takeover_data)
+        promise->state |= PROMISE_DATA_BOOKED;
+    if(takeover_reason)
+        promise->state |= PROMISE_REASON_BOOKED;
+    /** take the start handler first, dispatching below may free the promise */
+    promise_start_handler_t on_start = NULL;
+    void* start_ctx = NULL;
+    if(promise->ext && promise->ext->on_start)
+    {
+        on_start = promise->ext->on_start;
+        start_ctx = promise->ext->start_ctx;
+        promise->ext->on_start = NULL;
+        promise->ext->on_discard = NULL;
+    }
+    /** Promise is already resolved or rejected but not handled */
+    if(promise->state & PROMISE_SETTLED)
+        promise_settled(manager,promise_handle,promise);
+    if(on_start)
+        on_start(start_ctx);
+    return 0;
+error:
+    return -1;
+}
+
+bool promise_manager_run(promise_manager_handle_t manager_handle, int budget)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return false;
+    int called = 0;
+    while((manager->microtask_count > 0) && ((budget <= 0) || (called < budget)))
+    {
+        promise_microtask_t* task = &manager->microtasks[manager->microtask_head];
+        promise_handle_t promise_handle = task->promise;
+#ifndef PROMISE_NO_STATS
+        uint64_t settled_ns = task->settled_ns;
+#endif
+        manager->microtask_head = (manager->microtask_head + 1)&(manager->microtask_capacity - 1);
+        manager->microtask_count--;
+        /** the promise may have been destroyed while queued */
+        promise_t* promise = promise_slot_get(manager,promise_handle);
+        if(!promise)
+            continue;
+        PROMISE_STATS(promise_stats_record_delay(manager,promise_now_ns() - settled_ns));
+        promise->state &= ~PROMISE_QUEUED;
+        called += promise_dispatch(manager,promise_handle,promise);
+    }
+    return manager->microtask_count > 0;
+}
+
+int promise_manager_get_stats(promise_manager_handle_t manager_handle, promise_manager_stats_t* stats)
+{
+#ifndef PROMISE_NO_STATS
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || !stats)
+        return -1;
+    *stats = manager->stats;
+    stats->bytes_held = sizeof(promise_manager_t)
+        + promise_pool_bytes(&manager->promise_pool)
+        + promise_pool_bytes(&manager->handler_pool)
+        + promise_pool_bytes(&manager->ext_pool)
+        + promise_pool_bytes(&manager->group_pool)
+        + promise_pool_bytes(&manager->timer_pool)
+        + manager->group_bytes
+        + sizeof(promise_slot_t)*manager->slot_capacity
+        + sizeof(promise_microtask_t)*manager->microtask_capacity;
+#ifdef PROMISE_CENSUS
+    stats->bytes_held += sizeof(promise_census_t)*manager->slot_capacity;
+#endif
+    for(int i=0;i<PROMISE_FRAME_CLASSES;i++)
+        stats->bytes_held += promise_pool_bytes(&manager->frame_pools[i]);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int promise_manager_trace_start(promise_manager_handle_t manager_handle, size_t capacity)
+{
+#ifdef PROMISE_TRACE
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || capacity == 0)
+        return -1;
+    /** keep the capacity a power of 2 */
+    size_t rounded = 1;
+    while(rounded < capacity)
+        rounded <<= 1;
+    promise_trace_event_t* events = malloc(sizeof(promise_trace_event_t)*rounded);
+    if(!events)
+        return -1;
+    free(manager->trace_events);
+    manager->trace_events = events;
+    manager->trace_capacity = rounded;
+    manager->trace_next = 0;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void promise_manager_trace_stop(promise_manager_handle_t manager_handle)
+{
+#ifdef PROMISE_TRACE
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return;
+    free(manager->trace_events);
+    manager->trace_events = NULL;
+    manager->trace_capacity = 0;
+    manager->trace_next = 0;
+#endif
+}
+
+void promise_trace_step(
+    promise_manager_handle_t manager_handle, promise_handle_t promise, promise_handle_t awaiting,
+    const char* file, int line)
+{
+#ifdef PROMISE_TRACE
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(manager)
+        promise_trace_record(manager,PROMISE_TRACE_STEP,promise,awaiting,file,line,0);
+#endif
+}
+
+int promise_manager_trace_dump(promise_manager_handle_t manager_handle, FILE* file)
+{
+#ifdef PROMISE_TRACE
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || !file || !manager->trace_events)
+        return -1;
+    uint64_t count = manager->trace_next < manager->trace_capacity ? manager->trace_next : manager->trace_capacity;
+    fprintf(file,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for(uint64_t i=manager->trace_next - count;i<manager->trace_next;i++)
+    {
+        promise_trace_event_t* event = &manager->trace_events[i&(manager->trace_capacity - 1)];
+        fprintf(file,"%s\n",i == manager->trace_next - count ? "" : ",");
+        promise_trace_write(file,event);
+    }
+    fprintf(file,"\n]}\n");
+    return (int)count;
+#else
+    return -1;
+#endif
+}
+
+#ifdef PROMISE_CENSUS
+/** live promises of one creation site */
+typedef struct
+{
+    const char* file;
+    int line;
+    uint64_t age_ms;
+    size_t bytes;
+    bool settled;
+} promise_census_entry_t;
+
+typedef struct
+{
+    const char* file;
+    int line;
+    size_t count;
+    size_t settled;
+    size_t bytes;
+    uint64_t oldest_ms;
+    size_t ages[7];                 /** <1ms <10ms <100ms <1s <10s <1min >=1min */
+} promise_census_group_t;
+
+static int promise_census_compare_site(const void* a, const void* b)
+{
+    const promise_census_entry_t* left = a;
+    const promise_census_entry_t* right = b;
+    if(left->file != right->file)
+    {
+        if(!left->file || !right->file)
+            return left->file ? 1 : -1;
+        int result = strcmp(left->file,right->file);
+        if(result)
+            return result;
+    }
+    return left->line - right->line;
+}
+
+static int promise_census_compare_count(const void* a, const void* b)
+{
+    const promise_census_group_t* left = a;
+    const promise_census_group_t* right = b;
+    if(left->count != right->count)
+        return left->count < right->count ? 1 : -1;
+    if(left->bytes != right->bytes)
+        return left->bytes < right->bytes ? 1 : -1;
+    return 0;
+}
+#endif
+
+int promise_manager_dump_pending(promise_manager_handle_t manager_handle, FILE* file)
+{
+#ifdef PROMISE_CENSUS
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    promise_census_entry_t* entries = NULL;
+    promise_census_group_t* groups = NULL;
+    if(!manager || !file)
+        goto error;
+    size_t count = 0;
+    for(uintptr_t i=0;i<manager->slot_count;i++)
+    {
+        if(manager->slots[i].promise)
+            count++;
+    }
+    entries = malloc(sizeof(promise_census_entry_t)*(count ? count : 1));
+    groups = malloc(sizeof(promise_census_group_t)*(count ? count : 1));
+    if(!entries || !groups)
+        goto error;
+    uint64_t now_ms = promise_census_now_ms();
+    size_t total_bytes = 0;
+    count = 0;
+    for(uintptr_t i=0;i<manager->slot_count;i++)
+    {
+        promise_t* promise = manager->slots[i].promise;
+        if(!promise)
+            continue;
+        promise_census_t* census = &manager->census[i];
+        promise_census_entry_t* entry = &entries[count++];
+        entry->file = census->file;
+        entry->line = census->line;
+        entry->age_ms = now_ms > census->created_ms ? now_ms - census->created_ms : 0;
+        entry->bytes = promise_census_bytes(promise);
+        entry->settled = promise->state & PROMISE_SETTLED;
+        total_bytes += entry->bytes;
+    }
+    /** sort by site, then fold each run of a site into a group */
+    qsort(entries,count,sizeof(promise_census_entry_t),promise_census_compare_site);
+    size_t group_count = 0;
+    for(size_t i=0;i<count;i++)
+    {
+        promise_census_entry_t* entry = &entries[i];
+        if(i == 0 || promise_census_compare_site(&entries[i-1],entry) != 0)
+        {
+            memset(&groups[group_count],0,sizeof(promise_census_group_t));
+            groups[group_count].file = entry->file;
+            groups[group_count].line = entry->line;
+            group_count++;
+        }
+        promise_census_group_t* group = &groups[group_count - 1];
+        group->count++;
+        group->settled += entry->settled;
+        group->bytes += entry->bytes;
+        if(entry->age_ms > group->oldest_ms)
+            group->oldest_ms = entry->age_ms;
+        int bucket = 0;
+        for(uint64_t limit = 1;bucket < 5 && entry->age_ms >= limit;limit *= 10)
+            bucket++;
+        if(bucket == 5 && entry->age_ms >= 60000)
+            bucket = 6;
+        group->ages[bucket]++;
+    }
+    qsort(groups,group_count,sizeof(promise_census_group_t),promise_census_compare_count);
+    fprintf(file,"%zu pending promises, %zu bytes, %zu sites\n",count,total_bytes,group_count);
+    fprintf(file,"%8s %8s %10s %10s %6s %6s %6s %6s %6s %6s %6s  %s\n",
+        "count","settled","bytes","oldest_ms","<1ms","<10ms","<100ms","<1s","<10s","<1min",">=1min","site");
+    for(size_t i=0;i<group_count;i++)
+    {
+        promise_census_group_t* group = &groups[i];
+        fprintf(file,"%8zu %8zu %10zu %10" PRIu64 " %6zu %6zu %6zu %6zu %6zu %6zu %6zu  ",
+            group->count,group->settled,group->bytes,group->oldest_ms,
+            group->ages[0],group->ages[1],group->ages[2],group->ages[3],
+            group->ages[4],group->ages[5],group->ages[6]);
+        if(group->file)
+            fprintf(file,"%s:%d\n",group->file,group->line);
+        else
+            fprintf(file,"unknown\n");
+    }
+    free(entries);
+    free(groups);
+    return (int)count;
+error:
+    free(entries);
+    free(groups);
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+promise_handle_t promise_census_site(
+    promise_manager_handle_t manager_handle, promise_handle_t promise, const char* file, int line)
+{
+#ifdef PROMISE_CENSUS
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(manager && promise && promise_slot_get(manager,promise))
+    {
+        /** a fused promise_then keeps the site of its first stage */
+        promise_census_t* census = &manager->census[((uintptr_t)promise)&PROMISE_SLOT_INDEX_MASK];
+        if(!census->file)
+        {
+            census->file = file;
+            census->line = line;
+        }
+    }
+#endif
+    return promise;
+}
+
+void* promise_manager_alloc(promise_manager_handle_t manager_handle, size_t size)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || size == 0)
+        return NULL;
+    size_t size_class = (size - 1)/PROMISE_FRAME_CLASS_SIZE;
+    if(size_class >= PROMISE_FRAME_CLASSES)
+        return malloc(size);
+    return promise_pool_alloc(&manager->frame_pools[size_class]);
+}
+
+void promise_manager_release(promise_manager_handle_t manager_handle, void* block, size_t size)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || !block || size == 0)
+        return;
+    size_t size_class = (size - 1)/PROMISE_FRAME_CLASS_SIZE;
+    if(size_class >= PROMISE_FRAME_CLASSES)
+        free(block);
+    else
+        promise_pool_release(&manager->frame_pools[size_class],block);
+}
+
+uint64_t promise_manager_now(promise_manager_handle_t manager_handle)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return 0;
+    return manager->now_ms;
+}
+
+int promise_manager_advance_time(promise_manager_handle_t manager_handle, uint64_t now_ms)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return -1;
+    int fired = 0;
+    while(manager->now_ms < now_ms)
+    {
+        if(manager->timer_count == 0)
+        {
+            manager->now_ms = now_ms;
+            break;
+        }
+        int level = 0;
+        while(manager->wheel_count[level] == 0)
+            level++;
+        if(level > 0)
+        {
+            /** nothing moves before the lowest non empty level cascades, jump to the tick before it */
+            uint64_t skip_to = manager->now_ms | ((((uint64_t)1) << (PROMISE_WHEEL_BITS*level)) - 1);
+            if(skip_to >= now_ms)
+            {
+                manager->now_ms = now_ms;
+                break;
+            }
+            manager->now_ms = skip_to;
+        }
+        promise_timer_tick(manager);
+        fired += promise_timer_fire_due(manager);
+    }
+    return fired;
+}
+
+int promise_manager_next_timeout(promise_manager_handle_t manager_handle)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager || manager->timer_count == 0)
+        return -1;
+    if(manager->wheel_count[0] != 0)
+    {
+        /** level 0 slots are 1ms wide, find the next non empty one */
+        for(uint64_t ms=1;ms<=PROMISE_WHEEL_SLOTS;ms++)
+        {
+            promise_timer_link_t* head = &manager->wheel[0][(manager->now_ms + ms) & PROMISE_WHEEL_MASK];
+            if(head->next != head)
+                return (int)ms;
+        }
+    }
+    /** otherwise wake up for the next cascade of the lowest non empty level */
+    int level = 0;
+    while(manager->wheel_count[level] == 0)
+        level++;
+    uint64_t mask = (((uint64_t)1) << (PROMISE_WHEEL_BITS*level)) - 1;
+    uint64_t ms = (manager->now_ms | mask) + 1 - manager->now_ms;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+static int promise_settle_remote(
+    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, bool rejected,
+    promise_data_t data, void(*free_data)(void*,void*), void* ctx)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return -1;
+    if(manager->remote_fd < 0)
+        return -1;
+    promise_remote_node_t* node = malloc(sizeof(promise_remote_node_t));
+    if(!node)
+        return -1;
+    node->promise = promise_handle;
+    node->rejected = rejected;
+    node->data = data;
+    node->free_data = free_data;
+    node->free_ctx = ctx;
+    promise_remote_push(manager,node);
+    /** only the first push after a drain needs to wake the owner */
+    if(!atomic_exchange(&manager->remote_signaled,true))
+    {
+        uint64_t one = 1;
+        ssize_t rc;
+        do
+        {
+            rc = write(manager->remote_fd,&one,sizeof(one));
+        } while(rc < 0 && errno == EINTR);
+    }
+    return 0;
+}
+
+int promise_resolve_remote(
+    promise_manager_handle_t manager, promise_handle_t promise, 
+    promise_data_t data, void(*free_data)(void*,void*), void* ctx)
+{
+    return promise_settle_remote(manager,promise,false,data,free_data,ctx);
+}
+
+int promise_reject_remote(
+    promise_manager_handle_t manager, promise_handle_t promise, 
+    promise_data_t reason, void(*free_reason)(void*,void*), void* ctx)
+{
+    return promise_settle_remote(manager,promise,true,reason,free_reason,ctx);
+}
+
+int promise_manager_get_fd(promise_manager_handle_t manager_handle)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return -1;
+    return manager->remote_fd;
+}
+
+int promise_manager_process_remote(promise_manager_handle_t manager_handle)
+{
+    promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    if(!manager)
+        return -1;
+    if(manager->remote_fd < 0)
+        return -1;
+    /** skip the syscall if nothing was pushed since the last drain */
+    if(!atomic_load(&manager->remote_signaled))
+        return 0;
+    uint64_t count;
+    ssize_t rc;
+    do
+    {
+        rc = read(manager->remote_fd,&count,sizeof(count));
+    } while(rc < 0 && errno == EINTR);
+    /** 
+     * Clear before draining, a push racing with the drain signals again.
+     * If the read failed the signaling write is still on its way, keep the flag until it is consumed.
+     */
+    if(rc == sizeof(count))
+        atomic_store(&manager->remote_signaled,false);
+    int processed = 0;
+    promise_remote_node_t* node = NULL;
+    while((node = promise_remote_pop(manager)))
+    {
+        int rc = node->rejected ?
+            promise_reject(manager,node->promise,node->data,node->free_data,node->free_ctx):
+            promise_resolve(manager,node->promise,node->data,node->free_data,node->free_ctx);
+        /** the data is owned by the library once queued */
+        if(rc != 0 && node->free_data)
+            node->free_data(node->data.ptr,node->free_ctx);
+        free(node);
+        processed++;
+    }
+    return processed;
+}
+
+/** static functions */
+
+#if !defined(PROMISE_NO_STATS) || defined(PROMISE_TRACE)
+static uint64_t promise_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+#endif
+
+#ifndef PROMISE_NO_STATS
+static void promise_stats_record_delay(promise_manager_t* manager, uint64_t delay_ns)
+{
+    /** bucket i holds [2^i,2^(i+1)) ns, 0 goes to bucket 0 */
+    int bucket = delay_ns ? 63 - __builtin_clzll(delay_ns) : 0;
+    if(bucket >= PROMISE_STATS_HISTOGRAM_BUCKETS)
+        bucket = PROMISE_STATS_HISTOGRAM_BUCKETS - 1;
+    manager->stats.dispatch_delay_ns[bucket]++;
+}
+
+static size_t promise_pool_bytes(promise_pool_t* pool)
+{
+    return (pool->slab_end - pool->slab) + pool->overflow_bytes;
+}
+#endif
+
+#ifdef PROMISE_TRACE
+static void promise_trace_record(
+    promise_manager_t* manager, promise_trace_type_t type,
+    promise_handle_t promise, promise_handle_t other,
+    const char* file, int line, uint64_t start_ns)
+{
+    if(!manager->trace_events || !promise)
+        return;
+    promise_trace_event_t* event = &manager->trace_events[manager->trace_next&(manager->trace_capacity - 1)];
+    manager->trace_next++;
+    event->ns = promise_now_ns();
+    event->duration_ns = 0;
+    if(start_ns)
+    {
+        event->duration_ns = event->ns - start_ns;
+        event->ns = start_ns;
+    }
+    event->promise = promise;
+    event->other = other;
+    event->file = file;
+    event->line = line;
+    event->type = type;
+}
+
+/** 
+ * one Chrome trace event. A promise is an async slice from its creation to its settlement,
+ * named by its handle. Links and ASYNC steps are instants on that slice, dispatches are 
+ * complete events on the thread.
+ */
+static void promise_trace_write(FILE* file, const promise_trace_event_t* event)
+{
+    static const char* const states[] = {
+        [PROMISE_TRACE_RESOLVE] = "resolved",
+        [PROMISE_TRACE_REJECT] = "rejected",
+        [PROMISE_TRACE_CANCEL] = "cancelled"
+    };
+    double ts = event->ns/1000.0;
+    uintptr_t id = (uintptr_t)event->promise;
+    switch(event->type)
+    {
+    case PROMISE_TRACE_CREATE:
+        fprintf(file,"{\"name\":\"promise\",\"cat\":\"promise\",\"ph\":\"b\",\"id\":\"0x%" PRIxPTR "\","
+            "\"ts\":%.3f,\"pid\":1,\"tid\":1}",id,ts);
+        break;
+    case PROMISE_TRACE_RESOLVE:
+    case PROMISE_TRACE_REJECT:
+    case PROMISE_TRACE_CANCEL:
+        fprintf(file,"{\"name\":\"promise\",\"cat\":\"promise\",\"ph\":\"e\",\"id\":\"0x%" PRIxPTR "\","
+            "\"ts\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"state\":\"%s\"}}",id,ts,states[event->type]);
+        break;
+    case PROMISE_TRACE_DISPATCH:
+        fprintf(file,"{\"name\":\"dispatch\",\"cat\":\"promise\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":1,\"tid\":1,\"args\":{\"promise\":\"0x%" PRIxPTR "\"}}",ts,event->duration_ns/1000.0,id);
+        break;
+    case PROMISE_TRACE_LINK:
+    case PROMISE_TRACE_STEP:
+        fprintf(file,"{\"name\":\"");
+        if(event->type == PROMISE_TRACE_LINK)
+        {
+            fprintf(file,"await");
+        }
+        else
+        {
+            /** __FILE__ may hold backslashes */
+            for(const char* c = event->file;c && *c;c++)
+                fprintf(file,(*c == '\\' || *c == '"') ? "\\%c" : "%c",*c);
+            fprintf(file,":%d",event->line);
+        }
+        fprintf(file,"\",\"cat\":\"promise\",\"ph\":\"n\",\"id\":\"0x%" PRIxPTR "\",\"ts\":%.3f,"
+            "\"pid\":1,\"tid\":1,\"args\":{\"awaits\":\"0x%" PRIxPTR "\"}}",id,ts,(uintptr_t)event->other);
+        break;
+    }
+}
+#endif
+
+/** remote queue, see Dmitry Vyukov's intrusive MPSC node based queue */
+
+static void promise_remote_push(promise_manager_t* manager, promise_remote_node_t* node)
+{
+    atomic_store_explicit(&node->next,NULL,memory_order_relaxed);
+    promise_remote_node_t* prev = atomic_exchange_explicit(&manager->remote_head,node,memory_order_acq_rel);
+    atomic_store_explicit(&prev->next,node,memory_order_release);
+}
+
+static promise_remote_node_t* promise_remote_pop(promise_manager_t* manager)
+{
+    promise_remote_node_t* tail = manager->remote_tail;
+    promise_remote_node_t* next = atomic_load_explicit(&tail->next,memory_order_acquire);
+    if(tail == &manager->remote_stub)
+    {
+        if(!next)
+            return NULL;
+        manager->remote_tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next,memory_order_acquire);
+    }
+    if(next)
+    {
+        manager->remote_tail = next;
+        return tail;
+    }
+    promise_remote_node_t* head = atomic_load_explicit(&manager->remote_head,memory_order_acquire);
+    if(tail != head)
+        return NULL;    /** a producer is mid push, it will signal again */
+    promise_remote_push(manager,&manager->remote_stub);
+    next = atomic_load_explicit(&tail->next,memory_order_acquire);
+    if(next)
+    {
+        manager->remote_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int promise_settle_n(
+    promise_manager_t* manager, int count, const promise_handle_t promises[],
+    const promise_data_t values[], void(*const free_values[])(void*,void*), void* const ctx[], bool reject)
+{
+    if(!manager || count < 0 || (count > 0 && (!promises || !values)))
+        return -1;
+    /** apply all the state changes first, a duplicate shows up as already settled */
+    int i;
+    for(i=0;i<count;i++)
+    {
+        promise_t* promise = promise_slot_get(manager,promises[i]);
+        if(!promise || (promise->state & PROMISE_SETTLED))
+            break;
+        promise->state |= reject ? PROMISE_REJECTED : PROMISE_RESOLVED;
+        promise->value = values[i];
+        promise->free_value = free_values ? free_values[i] : NULL;
+        promise->free_value_ctx = ctx ? ctx[i] : NULL;
+    }
+    if(i < count)
+    {
+        /** roll back, the caller keeps the ownership of the whole batch */
+        while(i-- > 0)
+        {
+            promise_t* promise = promise_slot_get(manager,promises[i]);
+            promise->state &= ~PROMISE_SETTLED;
+            promise->free_value = NULL;
+        }
+        return -1;
+    }
+    if(reject)
+        PROMISE_STATS(manager->stats.rejected += count);
+    else
+        PROMISE_STATS(manager->stats.resolved += count);
+#ifdef PROMISE_TRACE
+    for(i=0;i<count;i++)
+        PROMISE_TRACE_EVENT(manager,reject ? PROMISE_TRACE_REJECT : PROMISE_TRACE_RESOLVE,promises[i],NULL);
+#endif
+    /** then dispatch, a handler may have freed a later promise of the batch */
+    for(i=0;i<count;i++)
+    {
+        promise_t* promise = promise_slot_get(manager,promises[i]);
+        if(promise && promise_has_handler(promise))
+            promise_settled(manager,promises[i],promise);
+    }
+    return 0;
+}
+
+static void promise_settled(promise_manager_t* manager, promise_handle_t promise_handle, promise_t* promise)
+{
+    if(!manager->deferred_dispatch)
+    {
+        PROMISE_STATS(manager->stats.dispatch_delay_ns[0]++);
+        promise_dispatch(manager,promise_handle,promise);
+        return;
+    }
+    if(promise->state & PROMISE_QUEUED)
+        return;
+    if(manager->microtask_count == manager->microtask_capacity)
+    {
+        /** grow the ring, keep the capacity a power of 2 */
+        size_t new_capacity = manager->microtask_capacity ? manager->microtask_capacity*2 : PROMISE_MICROTASK_MIN_CAPACITY;
+        promise_microtask_t* new_tasks = malloc(sizeof(promise_microtask_t)*new_capacity);
+        if(!new_tasks)
+        {
+            /** cannot defer, dispatch synchronously rather than lose the handlers */
+            PROMISE_STATS(manager->stats.dispatch_delay_ns[0]++);
+            promise_dispatch(manager,promise_handle,promise);
+            return;
+        }
+        for(size_t i=0;i<manager->microtask_count;i++)
+            new_tasks[i] = manager->microtasks[(manager->microtask_head + i)&(manager->microtask_capacity - 1)];
+        free(manager->microtasks);
+        manager->microtasks = new_tasks;
+        manager->microtask_capacity = new_capacity;
+        manager->microtask_head = 0;
+    }
+    promise_microtask_t* task = &manager->microtasks[(manager->microtask_head + manager->microtask_count)&(manager->microtask_capacity - 1)];
+    task->promise = promise_handle;
+    PROMISE_STATS(task->settled_ns = promise_now_ns());
+    manager->microtask_count++;
+    promise->state |= PROMISE_QUEUED;
+}
+
+static int promise_dispatch(promise_manager_t* manager, promise_handle_t promise_handle, promise_t* promise)
+{
+    /** 
+     * Detach the promise first. Handlers may destroy or await it again, 
+     * both should see it as gone instead of touching it mid dispatch.
+     */
+    promise_slot_remove(manager,promise_handle);
+#ifdef PROMISE_TRACE
+    uint64_t start_ns = manager->trace_events ? promise_now_ns() : 0;
+#endif
+    int called = 0;
+    bool resolved = promise->state & PROMISE_RESOLVED;
+    /** there can be at most one takeover handler, it is called last */
+    promise_then_handler_t takeover_then = NULL;
+    promise_catch_handler_t takeover_catch = NULL;
+    void* takeover_ctx = NULL;
+    if(promise->state & PROMISE_INLINE_HANDLER)
+    {
+        if(promise->state & (resolved ? PROMISE_INLINE_TAKEOVER_DATA : PROMISE_INLINE_TAKEOVER_REASON))
+        {
+            takeover_then = promise->then;
+            takeover_catch = promise->catch;
+            takeover_ctx = promise->handler_ctx;
+        }
+        else if(resolved)
+            promise->then(promise->value,promise->handler_ctx,NULL,NULL);
+        else
+            promise->catch(promise->value,promise->handler_ctx,NULL,NULL);
+        called++;
+    }
+    promise_handler_t* handler = promise->ext ? promise->ext->first_handler : NULL;
+    while(handler)
+    {
+        promise_handler_t* next_handler = handler->next;
+        if(resolved ? handler->takeover_data : handler->takeover_reason)
+        {
+            takeover_then = handler->then;
+            takeover_catch = handler->catch;
+            takeover_ctx = resolved ? handler->then_ctx : handler->catch_ctx;
+        }
+        else if(resolved)
+            handler->then(promise->value,handler->then_ctx,NULL,NULL);
+        else
+            handler->catch(promise->value,handler->catch_ctx,NULL,NULL);
+        called++;
+        handler = next_handler;
+    }
+    if(takeover_then)
+    {
+        promise->state |= PROMISE_TAKEN_OVER;
+        if(resolved)
+            takeover_then(promise->value,takeover_ctx,promise->free_value,promise->free_value_ctx);
+        else
+            takeover_catch(promise->value,takeover_ctx,promise->free_value,promise->free_value_ctx);
+    }
+    promise_free(manager,promise);
+#ifdef PROMISE_TRACE
+    promise_trace_record(manager,PROMISE_TRACE_DISPATCH,promise_handle,NULL,NULL,0,start_ns);
+#endif
+    return called;
+}
+
+static void promise_free(promise_manager_t* manager, promise_t* promise)
+{
+    if(promise)
+    {
+        if(promise->free_value && !(promise->state & PROMISE_TAKEN_OVER))
+            promise->free_value(promise->value.ptr,promise->free_value_ctx);
+        PROMISE_STATS(if(promise->state & PROMISE_INLINE_HANDLER) manager->stats.live_handlers--);
+        promise_ext_t* ext = promise->ext;
+        if(ext)
+        {
+            promise_handler_t* handler = ext->first_handler;
+            while(handler)
+            {
+                promise_handler_t* next = handler->next;
+                promise_pool_release(&manager->handler_pool,handler);
+                PROMISE_STATS(manager->stats.live_handlers--);
+                handler = next;
+            }
+            if(ext->on_discard)     /** a lazy promise never started */
+                ext->on_discard(ext->start_ctx);
+            /** an embedded ext goes away with its owner */
+            void(*internal_free)(void*, void*) = ext->internal_free;
+            void* internal_data = ext->internal_data;
+            void* internal_free_ctx = ext->internal_free_ctx;
+            if(!ext->embedded)
+                promise_pool_release(&manager->ext_pool,ext);
+            if(internal_free)
+                internal_free(internal_data,internal_free_ctx);
+        }
+        promise_pool_release(&manager->promise_pool,promise);
+        PROMISE_STATS(manager->stats.live_promises--);
+    }
+}
+
+/** slot table ****************************************/
+
+static promise_handle_t promise_slot_add(promise_manager_t* manager, promise_t* promise)
+{
+    uintptr_t index = manager->free_slot;
+    if(index != PROMISE_SLOT_NONE)
+    {
+        manager->free_slot = manager->slots[index].next_free;
+    }
+    else
+    {
+        if(manager->slot_count == PROMISE_SLOT_NONE)
+            return NULL;
+        if(manager->slot_count == manager->slot_capacity)
+        {
+            uintptr_t new_capacity = manager->slot_capacity*2;
+            if(new_capacity > PROMISE_SLOT_NONE)
+                new_capacity = PROMISE_SLOT_NONE;
+#ifdef PROMISE_CENSUS
+            /** grown first, a census larger than the slots is harmless */
+            promise_census_t* new_census = realloc(manager->census,sizeof(promise_census_t)*new_capacity);
+            if(!new_census)
+                return NULL;
+            manager->census = new_census;
+#endif
+            promise_slot_t* new_slots = realloc(manager->slots,sizeof(promise_slot_t)*new_capacity);
+            if(!new_slots)
+                return NULL;
+            manager->slots = new_slots;
+            manager->slot_capacity = new_capacity;
+        }
+        index = manager->slot_count++;
+        manager->slots[index].generation = 1;
+    }
+    manager->slots[index].promise = promise;
+    manager->slots[index].next_free = PROMISE_SLOT_NONE;
+    return PROMISE_SLOT_HANDLE(manager->slots[index].generation,index);
+}
+
+static promise_t* promise_slot_get(promise_manager_t* manager, promise_handle_t handle)
+{
+    uintptr_t index = ((uintptr_t)handle)&PROMISE_SLOT_INDEX_MASK;
+    uintptr_t generation = ((uintptr_t)handle)>>PROMISE_SLOT_INDEX_BITS;
+    if(index >= manager->slot_count)
+        return NULL;
+    if(manager->slots[index].generation != generation)
+        return NULL;
+    /** NULL if the slot is free */
+    return manager->slots[index].promise;
+}
+
+static promise_t* promise_slot_remove(promise_manager_t* manager, promise_handle_t handle)
+{
+    promise_t* promise = promise_slot_get(manager,handle);
+    if(!promise)
+        return NULL;
+    uintptr_t index = ((uintptr_t)handle)&PROMISE_SLOT_INDEX_MASK;
+    promise_slot_t* slot = &manager->slots[index];
+    slot->promise = NULL;
+    /** stale handles of this slot no longer match */
+    slot->generation = (slot->generation + 1)&PROMISE_SLOT_INDEX_MASK;
+    if(slot->generation == 0)
+        slot->generation = 1;
+    slot->next_free = manager->free_slot;
+    manager->free_slot = index;
+    return promise;
+}
+
+/** pool ****************************************/
+
+static int promise_pool_init(promise_pool_t* pool, size_t object_size, int capacity, size_t max_retained)
+{
+    memset(pool,0,sizeof(promise_pool_t));
+    /** keep objects pointer aligned inside the slab */
+    object_size = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    pool->object_size = object_size;
+    pool->max_retained = max_retained;
+    if(capacity > 0)
+    {
+        pool->slab = malloc(object_size*capacity);
+        if(!pool->slab)
+            return -1;
+        pool->slab_end = pool->slab + object_size*capacity;
+        /** thread the slab into the free list */
+        for(int i=capacity-1;i>=0;i--)
+        {
+            promise_pool_node_t* node = (promise_pool_node_t*)(pool->slab + object_size*i);
+            node->next = pool->free_list;
+            pool->free_list = node;
+        }
+    }
+    return 0;
+}
+
+static void promise_pool_destroy(promise_pool_t* pool)
+{
+    promise_pool_node_t* node = pool->free_list;
+    while(node)
+    {
+        promise_pool_node_t* next = node->next;
+        if(((char*)node < pool->slab) || ((char*)node >= pool->slab_end))
+            free(node);
+        node = next;
+    }
+    pool->free_list = NULL;
+    pool->retained = 0;
+    pool->overflow_bytes = 0;
+    free(pool->slab);
+    pool->slab = NULL;
+    pool->slab_end = NULL;
+}
+
+static void* promise_pool_alloc(promise_pool_t* pool)
+{
+    promise_pool_node_t* node = pool->free_list;
+    if(!node)
+    {
+        node = malloc(pool->object_size);
+        if(node)
+            pool->overflow_bytes += pool->object_size;
+        return node;
+    }
+    pool->free_list = node->next;
+    if(((char*)node < pool->slab) || ((char*)node >= pool->slab_end))
+        pool->retained -= pool->object_size;
+    return node;
+}
+
+static void promise_pool_release(promise_pool_t* pool, void* object)
+{
+    if(!object)
+        return;
+    if(((char*)object < pool->slab) || ((char*)object >= pool->slab_end))
+    {
+        if(pool->retained + pool->object_size > pool->max_retained)
+        {
+            pool->overflow_bytes -= pool->object_size;
+            free(object);
+            return;
+        }
+        pool->retained += pool->object_size;
+    }
+    promise_pool_node_t* node = (promise_pool_node_t*)object;
+    node->next = pool->free_list;
+    pool->free_list = node;
+}
+
+
+/** timers ****************************************/
+
+const char promise_timeout_reason[] = "timeout";
+
+static void promise_timer_link(promise_manager_t* manager, promise_timer_t* timer)
+{
+    promise_timer_link_t* head = NULL;
+    uint64_t delta = timer->expire_ms > manager->now_ms ? timer->expire_ms - manager->now_ms : 0;
+    if(delta == 0)
+    {
+        timer->level = -1;
+        head = &manager->timers_due;
+    }
+    else
+    {
+        int level = 0;
+        while(level < PROMISE_WHEEL_LEVELS - 1 && (delta >> (PROMISE_WHEEL_BITS*(level + 1))) != 0)
+            level++;
+        int shift = PROMISE_WHEEL_BITS*level;
+        uint64_t slot = (timer->expire_ms >> shift) & PROMISE_WHEEL_MASK;
+        if((delta >> (shift + PROMISE_WHEEL_BITS)) != 0)
+        {
+            /** beyond the wheel, park it in the top level slot cascaded last */
+            slot = ((manager->now_ms >> shift) - 1) & PROMISE_WHEEL_MASK;
+        }
+        timer->level = level;
+        head = &manager->wheel[level][slot];
+        manager->wheel_count[level]++;
+        manager->timer_count++;
+    }
+    timer->link.prev = head->prev;
+    timer->link.next = head;
+    head->prev->next = &timer->link;
+    head->prev = &timer->link;
+}
+
+static void promise_timer_unlink(promise_manager_t* manager, promise_timer_t* timer)
+{
+    if(!timer->link.next)
+        return;
+    timer->link.prev->next = timer->link.next;
+    timer->link.next->prev = timer->link.prev;
+    timer->link.prev = NULL;
+    timer->link.next = NULL;
+    if(timer->level >= 0)
+    {
+        manager->wheel_count[timer->level]--;
+        manager->timer_count--;
+    }
+}
+
+/** relink every timer of a slot, they land in lower levels or on the due list */
+static void promise_timer_cascade(promise_manager_t* manager, promise_timer_link_t* head)
+{
+    while(head->next != head)
+    {
+        promise_timer_t* timer = (promise_timer_t*)head->next;
+        promise_timer_unlink(manager,timer);
+        promise_timer_link(manager,timer);
+    }
+}
+
+/** advance the wheel by 1ms */
+static void promise_timer_tick(promise_manager_t* manager)
+{
+    manager->now_ms++;
+    /** level l cascades when all the levels below it wrapped around */
+    int top = 0;
+    while(top < PROMISE_WHEEL_LEVELS - 1 && 
+        (manager->now_ms & ((((uint64_t)1) << (PROMISE_WHEEL_BITS*(top + 1))) - 1)) == 0)
+        top++;
+    for(int level=top;level>0;level--)
+    {
+        uint64_t slot = (manager->now_ms >> (PROMISE_WHEEL_BITS*level)) & PROMISE_WHEEL_MASK;
+        promise_timer_cascade(manager,&manager->wheel[level][slot]);
+    }
+    promise_timer_cascade(manager,&manager->wheel[0][manager->now_ms & PROMISE_WHEEL_MASK]);
+}
+
+/** handlers may add or cancel timers, so the due list is popped one by one */
+static int promise_timer_fire_due(promise_manager_t* manager)
+{
+    int fired = 0;
+    while(manager->timers_due.next != &manager->timers_due)
     {
-        /** If there are handlers set */
-        promise_handler_t* handler = promise->first_handler;
-        promise_handler_t* takeover_handler = NULL;
-        while(handler)
+        promise_timer_t* timer = (promise_timer_t*)manager->timers_due.next;
+        promise_timer_unlink(manager,timer);
+        promise_handle_t inner = timer->inner;
+        timer->inner = NULL;
+        /** settling the promise may free the timer */
+        if(inner)
         {
-            promise_handler_t* next_handler = handler->next;
-            if(handler->takeover_data)
-                takeover_handler = handler; /** there can be at most one takeover handler */
-            else
-                handler->then(promise->resolve_data,handler->then_ctx,NULL,NULL);
-            handler = next_handler;
+            promise_cancel(manager,inner);
+            promise_reject(manager,timer->promise,(promise_data_t){.ptr=PROMISE_TIMEOUT},NULL,NULL);
         }
-        if(takeover_handler)    /** call the takeover handler last */
+        else
         {
-            promise->data_taken_over = true;
-            takeover_handler->then(promise->resolve_data,takeover_handler->then_ctx,free_data,ctx);
+            promise_resolve(manager,timer->promise,(promise_data_t){.ptr=NULL},NULL,NULL);
         }
-        /** free promise and remove from promises if it is still in promises */
-        promise_t* old_promise = map_remove(manager->promises,&promise_handle,sizeof(promise_handle));
-        promise_free(old_promise);
-    } 
-    return 0;
-error:
-    return -1;
+        fired++;
+    }
+    return fired;
 }
 
-int promise_reject(
-    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, 
-    promise_data_t reason, void(*free_reason)(void*,void*), void* ctx)
+/** called when the promise owning the timer is freed */
+static void promise_timer_free_with_ctx(void* data, void* ctx)
+{
+    promise_timer_t* timer = (promise_timer_t*)data;
+    promise_manager_t* manager = (promise_manager_t*)ctx;
+    promise_timer_unlink(manager,timer);
+    if(timer->inner)    /** nobody waits for the inner promise anymore */
+        promise_cancel(manager,timer->inner);
+    promise_pool_release(&manager->timer_pool,timer);
+    PROMISE_STATS(manager->stats.live_timers--);
+}
+
+static void promise_timeout_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_timer_t* timer = (promise_timer_t*)ctx;
+    promise_manager_t* manager = (promise_manager_t*)timer->manager;
+    timer->inner = NULL;
+    promise_timer_unlink(manager,timer);
+    if(promise_resolve(manager,timer->promise,data,free_ptr,free_ctx)!=0 && free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+static void promise_timeout_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_timer_t* timer = (promise_timer_t*)ctx;
+    promise_manager_t* manager = (promise_manager_t*)timer->manager;
+    timer->inner = NULL;
+    promise_timer_unlink(manager,timer);
+    if(promise_reject(manager,timer->promise,reason,free_ptr,free_ctx)!=0 && free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+}
+
+/** the returned promise owns the timer, inner is cancelled on error */
+static promise_handle_t promise_timer_new(promise_manager_t* manager, promise_handle_t inner, uint64_t ms)
 {
-        promise_manager_t* manager = (promise_manager_t*)manager_handle;
+    promise_timer_t* timer = NULL;
     if(!manager)
         goto error;
-    promise_t* promise = map_get(manager->promises,&promise_handle,sizeof(promise_handle));
-    if(!promise)
+    timer = promise_pool_alloc(&manager->timer_pool);
+    if(!timer)
         goto error;
-    if(promise->resolved || promise->rejected)
+    memset(timer,0,sizeof(promise_timer_t));
+    timer->manager = manager;
+    timer->level = -1;
+    if(ms == 0)
+        ms = 1;
+    timer->expire_ms = ms > UINT64_MAX - manager->now_ms ? UINT64_MAX : manager->now_ms + ms;
+    timer->promise = promise_new_internal(manager,timer,promise_timer_free_with_ctx,manager,&timer->ext);
+    if(!timer->promise)
         goto error;
-    promise->rejected = true;
-    promise->reject_reason = reason;
-    promise->free_reason = free_reason;
-    promise->free_reason_ctx = ctx;
-    if(promise->first_handler != NULL)
+    PROMISE_STATS(manager->stats.live_timers++);
+    promise_timer_link(manager,timer);
+    if(inner)
     {
-        /** If there are handlers set */
-        promise_handler_t* handler = promise->first_handler;
-        promise_handler_t* takeover_handler = NULL;
-        while(handler)
-        {
-            promise_handler_t* next_handler = handler->next;
-            if(handler->takeover_reason)
-                takeover_handler = handler;
-            else
-                handler->catch(promise->reject_reason,handler->catch_ctx,NULL,NULL);
-            handler = next_handler;
-        }
-        if(takeover_handler)    /** call the take over handler last */
+        timer->inner = inner;
+        PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_LINK,timer->promise,inner);
+        if(promise_await(
+            manager,inner,
+            promise_timeout_then,timer,true,
+            promise_timeout_catch,timer,true)!=0)
         {
-            promise->reason_taken_over = true;
-            takeover_handler->catch(promise->reject_reason,takeover_handler->catch_ctx,free_reason,ctx);
+            /** frees the timer and cancels inner */
+            promise_destroy(manager,timer->promise);
+            return NULL;
         }
-        /** free promise and remove from promises if it is still in promises */
-        promise_t* old_promise = map_remove(manager->promises,&promise_handle,sizeof(promise_handle));
-        promise_free(old_promise);
     }
-    return 0;
+    return timer->promise;
 error:
-    return -1;
+    if(timer)
+        promise_pool_release(&manager->timer_pool,timer);
+    if(inner && manager)
+        promise_cancel(manager,inner);
+    return NULL;
 }
 
-int promise_await(
-    promise_manager_handle_t manager_handle, promise_handle_t promise_handle, 
-    promise_then_handler_t then, void* then_ctx, bool takeover_data,
-    promise_catch_handler_t catch, void* catch_ctx, bool takeover_reason)
+promise_handle_t promise_delay(promise_manager_handle_t manager, uint64_t ms)
+{
+    return promise_timer_new((promise_manager_t*)manager,NULL,ms);
+}
+
+promise_handle_t promise_timeout(promise_manager_handle_t manager, promise_handle_t promise, uint64_t ms)
 {
-    promise_manager_t* manager = (promise_manager_t*)manager_handle;
-    if(!manager)
-        goto error;
-    promise_t* promise = map_get(manager->promises,&promise_handle,sizeof(promise_handle));
     if(!promise)
-        goto error;
-    if((!then) || (!catch))
-        goto error;
-    if(promise->data_booked && takeover_data)
-        goto error;
-    if(promise->reason_booked && takeover_reason)
-        goto error;
-    promise_handler_t* new_handler = malloc(sizeof(promise_handler_t));
-    if(!new_handler)
-        goto error;
-    memset(new_handler,0,sizeof(promise_handler_t));
-    new_handler->then = then;
-    new_handler->then_ctx = then_ctx;
-    new_handler->catch = catch;
-    new_handler->catch_ctx = catch_ctx;
-    new_handler->takeover_data = takeover_data;
-    new_handler->takeover_reason = takeover_reason;
-    new_handler->next = NULL;
-    if(promise->last_handler == NULL)
-    {
-        promise->first_handler = new_handler;
-        promise->last_handler = new_handler;
-    }
-    else
-    {
-        promise->last_handler->next = new_handler;
-        promise->last_handler = new_handler;
-    }
-    promise->data_booked = promise->data_booked || takeover_data;
-    promise->reason_booked = promise->reason_booked || takeover_reason;
-    if(promise->resolved)
-    {
-        /** Promise is already resolved but not handled */
-        promise_handler_t* handler = promise->first_handler;
-        promise_handler_t* takeover_handler = NULL;
-        while(handler)
-        {
-            promise_handler_t* next_handler = handler->next;
-            if(handler->takeover_data)
-                takeover_handler = handler;
-            else
-                handler->then(promise->resolve_data,handler->then_ctx,NULL,NULL);
-            handler = next_handler;
-        }
-        if(takeover_handler)
-        {
-            promise->data_taken_over = true;
-            takeover_handler->then(promise->resolve_data,takeover_handler->then_ctx,promise->free_data,promise->free_data_ctx);
-        }
-        /** free promise and remove from promises if it is still in promises */
-        promise_t* old_promise = map_remove(manager->promises,&promise_handle,sizeof(promise_handle));
-        promise_free(old_promise);
-    }
-    else if(promise->rejected)
+        return NULL;
+    return promise_timer_new((promise_manager_t*)manager,promise,ms);
+}
+
+
+/** transform chains ****************************************/
+
+#define PROMISE_CHAIN_INLINE_STAGES 4
+
+typedef struct
+{
+    bool catch;                     /** runs on rejection instead of resolution */
+    promise_transform_t transform;
+    void* ctx;
+} promise_stage_t;
+
+/** owned by the derived promise, stages are fused while nobody awaits it */
+typedef struct
+{
+    promise_manager_t* manager;
+    promise_handle_t promise;       /** the derived promise */
+    promise_handle_t source;        /** NULL once settled */
+    promise_stage_t* stages;
+    int stage_count;
+    int stage_capacity;
+    promise_stage_t inline_stages[PROMISE_CHAIN_INLINE_STAGES];
+    promise_ext_t ext;              /** of promise */
+} promise_chain_t;
+
+static int promise_chain_push(promise_chain_t* chain, bool catch, promise_transform_t transform, void* ctx)
+{
+    if(chain->stage_count == chain->stage_capacity)
     {
-        /** Promise is already rejected but not catched */
-        promise_handler_t* handler = promise->first_handler;
-        promise_handler_t* takeover_handler = NULL;
-        while(handler)
-        {
-            promise_handler_t* next_handler = handler->next;
-            if(handler->takeover_reason)
-                takeover_handler = handler;
-            else
-                handler->catch(promise->reject_reason,handler->catch_ctx,NULL,NULL);
-            handler = next_handler;
-        }
-        if(takeover_handler)
-        {
-            promise->reason_taken_over = true;
-            takeover_handler->catch(promise->reject_reason,takeover_handler->catch_ctx,promise->free_reason,promise->free_reason_ctx);
-        }
-        /** free promise and remove from promises if it is still in promises */
-        promise_t* old_promise = map_remove(manager->promises,&promise_handle,sizeof(promise_handle));
-        promise_free(old_promise);
+        int new_capacity = chain->stage_capacity*2;
+        promise_stage_t* new_stages = promise_manager_alloc(chain->manager,sizeof(promise_stage_t)*new_capacity);
+        if(!new_stages)
+            return -1;
+        memcpy(new_stages,chain->stages,sizeof(promise_stage_t)*chain->stage_count);
+        if(chain->stages != chain->inline_stages)
+            promise_manager_release(chain->manager,chain->stages,sizeof(promise_stage_t)*chain->stage_capacity);
+        chain->stages = new_stages;
+        chain->stage_capacity = new_capacity;
     }
+    chain->stages[chain->stage_count].catch = catch;
+    chain->stages[chain->stage_count].transform = transform;
+    chain->stages[chain->stage_count].ctx = ctx;
+    chain->stage_count++;
     return 0;
-error:
-    return -1;
 }
 
-/** static functions */
+/** called when the derived promise is freed */
+static void promise_chain_free_with_ctx(void* data, void* ctx)
+{
+    promise_chain_t* chain = (promise_chain_t*)data;
+    promise_manager_t* manager = (promise_manager_t*)ctx;
+    if(chain->source)   /** nobody waits for the source anymore */
+        promise_cancel(manager,chain->source);
+    if(chain->stages != chain->inline_stages)
+        promise_manager_release(manager,chain->stages,sizeof(promise_stage_t)*chain->stage_capacity);
+    promise_manager_release(manager,chain,sizeof(promise_chain_t));
+}
 
-static void promise_free(promise_t* promise)
+static void promise_chain_run(promise_chain_t* chain, promise_value_t* value)
 {
-    if(promise)
+    promise_manager_t* manager = chain->manager;
+    chain->source = NULL;
+    for(int i=0;i<chain->stage_count;i++)
     {
-        if(promise->free_data && (!promise->data_taken_over))
-            promise->free_data(promise->resolve_data.ptr,promise->free_data_ctx);
-        if(promise->free_reason && (!promise->reason_taken_over))
-            promise->free_reason(promise->reject_reason.ptr,promise->free_reason_ctx);
-        promise_handler_t* handler = promise->first_handler;
-        while(handler)
-        {
-            promise_handler_t* next = handler->next;
-            free(handler);
-            handler = next;
-        }
-        if(promise->internal.free_data)
-            promise->internal.free_data(promise->internal.data,promise->internal.free_ctx);
-        free(promise);
+        if(chain->stages[i].catch == value->rejected)
+            chain->stages[i].transform(value,chain->stages[i].ctx);
     }
+    int rc = value->rejected ?
+        promise_reject(manager,chain->promise,value->data,value->free_data,value->free_ctx):
+        promise_resolve(manager,chain->promise,value->data,value->free_data,value->free_ctx);
+    if(rc != 0 && value->free_data)
+        value->free_data(value->data.ptr,value->free_ctx);
 }
 
-static void promise_free_with_ctx(void* data, void* ctx)
+static void promise_chain_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
 {
-    promise_t* promise = (promise_t*)data;
-    promise_free(promise);
+    promise_value_t value = {.data = data,.free_data = free_ptr,.free_ctx = free_ctx,.rejected = false};
+    promise_chain_run((promise_chain_t*)ctx,&value);
 }
 
+static void promise_chain_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_value_t value = {.data = reason,.free_data = free_ptr,.free_ctx = free_ctx,.rejected = true};
+    promise_chain_run((promise_chain_t*)ctx,&value);
+}
 
-/** promise group ****************************************/
-
-typedef struct promise_group_sub_promise_ctx_s promise_group_sub_promise_ctx_t;
-typedef struct promise_group_s promise_group_t;
+/** source is cancelled on error */
+static promise_handle_t promise_chain_add(
+    promise_manager_t* manager, promise_handle_t source,
+    bool catch, promise_transform_t transform, void* ctx)
+{
+    promise_chain_t* chain = NULL;
+    if(!manager || !source)
+        return NULL;
+    promise_t* promise = promise_slot_get(manager,source);
+    if(!promise || !transform)
+        goto error;
+    if(promise->ext && promise->ext->internal_free == promise_chain_free_with_ctx
+        && !promise_has_handler(promise) && !(promise->state & PROMISE_SETTLED))
+    {
+        /** a derived promise nobody awaits yet, append the stage to it */
+        if(promise_chain_push((promise_chain_t*)promise->ext->internal_data,catch,transform,ctx) != 0)
+            goto error;
+        PROMISE_STATS(manager->stats.fused_stages++);
+        return source;
+    }
+    chain = promise_manager_alloc(manager,sizeof(promise_chain_t));
+    if(!chain)
+        goto error;
+    memset(chain,0,sizeof(promise_chain_t));
+    chain->manager = manager;
+    chain->stages = chain->inline_stages;
+    chain->stage_capacity = PROMISE_CHAIN_INLINE_STAGES;
+    promise_chain_push(chain,catch,transform,ctx);
+    chain->promise = promise_new_internal(manager,chain,promise_chain_free_with_ctx,manager,&chain->ext);
+    if(!chain->promise)
+        goto error;
+    chain->source = source;
+    PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_LINK,chain->promise,source);
+    if(promise_await(
+        manager,source,
+        promise_chain_then,chain,true,
+        promise_chain_catch,chain,true)!=0)
+    {
+        /** frees the chain and cancels source */
+        promise_destroy(manager,chain->promise);
+        return NULL;
+    }
+    return chain->promise;
+error:
+    if(chain)
+        promise_manager_release(manager,chain,sizeof(promise_chain_t));
+    promise_cancel(manager,source);
+    return NULL;
+}
 
-struct promise_group_sub_promise_ctx_s
+promise_handle_t promise_then(
+    promise_manager_handle_t manager, promise_handle_t promise,
+    promise_transform_t transform, void* ctx)
 {
-    int index;
-    promise_handle_t promise;
-    promise_group_t* group;
-};
+    return promise_chain_add((promise_manager_t*)manager,promise,false,transform,ctx);
+}
 
-struct promise_group_s
+promise_handle_t promise_catch(
+    promise_manager_handle_t manager, promise_handle_t promise,
+    promise_transform_t transform, void* ctx)
 {
-    promise_manager_handle_t manager;
-    promise_handle_t promise;
-    int length;
-    promise_group_sub_promise_ctx_t* sub_promises;
-    promise_data_list_t* data_list;
-    int data_count;
-};
+    return promise_chain_add((promise_manager_t*)manager,promise,true,transform,ctx);
+}
 
-static void promise_group_free(promise_group_t* group);
+
+/** promise group ****************************************/
+
+static void promise_group_free_block(promise_group_t* group);
 static void promise_group_free_with_ctx(void* data, void* ctx);
 
-static promise_group_t* promise_group_new(promise_manager_t* manager, int n, promise_handle_t* promises)
+/** promises are read from args if it is NULL, left NULL if both are */
+static promise_group_t* promise_group_new(promise_manager_t* manager, int n, promise_handle_t* promises, va_list* args)
 {
-    promise_group_t* group = malloc(sizeof(promise_group_t));
+    promise_group_t* group = NULL;
+    if(!manager || n < 0)
+        goto error;
+    size_t size = PROMISE_GROUP_BLOCK_SIZE(n);
+    if(n <= PROMISE_GROUP_POOL_LENGTH)
+    {
+        group = promise_pool_alloc(&manager->group_pool);
+    }
+    else
+    {
+        group = malloc(size);
+        PROMISE_STATS(if(group) manager->group_bytes += size);
+    }
     if(!group)
         goto error;
-    memset(group,0,sizeof(promise_group_t));
+    memset(group,0,size);
+    PROMISE_STATS(manager->stats.active_groups++);
     group->manager = manager;
     group->length = n;
     group->data_count = 0;  /** resolve/reject data count */
-    group->data_list = malloc(sizeof(promise_data_list_t));
-    if(!group)
-        goto error;
-    memset(group->data_list,0,sizeof(promise_data_list_t));
-    group->data_list->length = n;
-    group->data_list->items = malloc(sizeof(promise_data_list_item_t)*n);
-    if(!group->data_list->items)
-        goto error;
-    memset(group->data_list->items,0,sizeof(promise_data_list_item_t)*n);
-    for(int i=0;i<n;i++)
-    {
-        group->data_list->items[i].internal.free_ptr = NULL;
-        group->data_list->items[i].internal.free_ctx = NULL;
-    }
-    group->sub_promises = malloc(sizeof(promise_group_sub_promise_ctx_t)*n);
-    if(!group->sub_promises)
-        goto error;
-    memset(group->sub_promises,0,sizeof(promise_group_sub_promise_ctx_t)*n);
-
+    group->sub_promises = (promise_group_sub_promise_ctx_t*)(group + 1);
+    group->data_list.length = n;
+    group->data_list.items = (promise_data_list_item_t*)(group->sub_promises + n);
     for(int i=0;i<n;i++)
     {
-        group->sub_promises[i].promise = promises[i];
+        group->sub_promises[i].promise = promises ? promises[i] : (args ? va_arg(*args,promise_handle_t) : NULL);
         group->sub_promises[i].index = i;
         group->sub_promises[i].group = group;
     }
 
-    group->promise = promise_new_internal(manager,group,promise_group_free_with_ctx,NULL);
+    group->promise = promise_new_internal(manager,group,promise_group_free_with_ctx,NULL,&group->ext);
     if(!group->promise)
         goto error;
 
     return group;
 error:
-    promise_group_free(group);
+    if(group)
+    {
+        group->group_released = true;
+        promise_group_free_block(group);
+    }
     return NULL;
 }
 
+/** the block is freed once both the group promise and a handed out data list are done with it */
+static void promise_group_free_block(promise_group_t* group)
+{
+    if(group->busy)
+        return;
+    if(group->list_handed_out && !group->list_released)
+        return;
+    if(!group->group_released)
+        return;
+    promise_manager_t* manager = (promise_manager_t*)group->manager;
+    PROMISE_STATS(manager->stats.active_groups--);
+    if(group->length <= PROMISE_GROUP_POOL_LENGTH)
+    {
+        promise_pool_release(&manager->group_pool,group);
+    }
+    else
+    {
+        PROMISE_STATS(manager->group_bytes -= PROMISE_GROUP_BLOCK_SIZE(group->length));
+        free(group);
+    }
+}
+
 /** promsie_group_t data list free */
-static void promise_group_free_data_list(promise_data_list_t* list)
+static void promise_group_free_data_list_items(promise_data_list_t* list)
 {
-    if(list)
-    {   
-        if(list->items)
-        {
-            for(int i=0;i<list->length;i++)
-            {
-                if(list->items[i].internal.free_ptr)
-                    list->items[i].internal.free_ptr(list->items[i].data.ptr,list->items[i].internal.free_ctx);
-            }
-            free(list->items);
-        }
-        free(list);
+    for(int i=0;i<list->length;i++)
+    {
+        if(list->items[i].internal.free_ptr)
+            list->items[i].internal.free_ptr(list->items[i].data.ptr,list->items[i].internal.free_ctx);
+        list->items[i].internal.free_ptr = NULL;
     }
 }
 
 static void promise_group_free_data_list_with_ctx(void* data, void* ctx)
 {
-    promise_group_free_data_list((promise_data_list_t*)data);
+    promise_group_t* group = (promise_group_t*)ctx;
+    promise_group_free_data_list_items(&group->data_list);
+    group->list_released = true;
+    promise_group_free_block(group);
 }
 
-/** promise_group_t free */
-static void promise_group_free(promise_group_t* group)
+/** settle the group promise with the data list, the list then lives until its free function is called */
+static void promise_group_settle_with_list(promise_group_t* group, bool rejected)
 {
-    if(group)
+    promise_data_t data_list = {.ptr = &group->data_list};
+    group->list_handed_out = true;
+    int rc = rejected ?
+        promise_reject(group->manager,group->promise,data_list,promise_group_free_data_list_with_ctx,group):
+        promise_resolve(group->manager,group->promise,data_list,promise_group_free_data_list_with_ctx,group);
+    if(rc != 0)
+        group->list_handed_out = false;
+}
+
+/** called when the group promise is freed */
+static void promise_group_free_with_ctx(void* data, void* ctx)
+{
+    promise_group_t* group = (promise_group_t*)data;
+    if(!group->list_handed_out)  /** not all resolved/rejected, free data */
+        promise_group_free_data_list_items(&group->data_list);
+    for(int i=0;i<group->length;i++)    /** cancel remaining sub promises */
+        promise_cancel(group->manager,group->sub_promises[i].promise);
+    group->group_released = true;
+    promise_group_free_block(group);
+}
+
+/** 
+ * cancel the sub promises that can no longer change the result.
+ * MUST be called before settling the group promise, which may free the group.
+ */
+static void promise_group_cancel_others(promise_group_t* group, int index)
+{
+    for(int i=0;i<group->length;i++)
     {
-        if((group->length != group->data_count) && group->data_list)   /** not all resolved/rejected, free data */
-            promise_group_free_data_list(group->data_list);
-        if(group->sub_promises)
-        {
-            for(int i=0;i<group->length;i++)    /** destroy remeaning sub promises */
-                promise_destroy(group->manager,group->sub_promises[i].promise);
-            free(group->sub_promises);
-        }
-        free(group);
+        if(i != index)
+            promise_cancel(group->manager,group->sub_promises[i].promise);
     }
 }
 
-static void promise_group_free_with_ctx(void* data, void* ctx)
+/** await all sub promises */
+static promise_handle_t promise_group_await(
+    promise_manager_t* manager, promise_group_t* group,
+    promise_then_handler_t then, promise_catch_handler_t catch)
 {
-    promise_group_free((promise_group_t*)data);
+    if(!group)
+        return NULL;
+    for(int i=0;i<group->length;i++)
+    {
+        /** settled by a sub promise already, the remaining ones are cancelled */
+        promise_t* promise = promise_slot_get(manager,group->promise);
+        if(!promise || (promise->state & PROMISE_SETTLED))
+            break;
+        PROMISE_TRACE_EVENT(manager,PROMISE_TRACE_LINK,group->promise,group->sub_promises[i].promise);
+        if(promise_await(
+            manager,group->sub_promises[i].promise,
+            then,&(group->sub_promises[i]),true,
+            catch,&(group->sub_promises[i]),true)!=0)
+        {
+            promise_destroy(manager,group->promise);
+            return NULL;
+        }  
+    }
+    return group->promise;
 }
 
 /** promise.all ****************************************/
@@ -463,41 +2233,17 @@ promise_handle_t promise_all_n(promise_manager_handle_t manager, int n, promise_
 {
     if(!promises)
         return NULL;
-    promise_group_t* all = promise_group_new(manager,n,promises);
-    if(!all)
-        goto error;
-
-    /** await all sub promises */
-    for(int i=0;i<n;i++)
-    {
-        if(promise_await(
-            manager,all->sub_promises[i].promise,
-            promise_all_sub_promise_then,&(all->sub_promises[i]),true,
-            promise_all_sub_promise_catch,&(all->sub_promises[i]),true)!=0)
-        {
-            goto error; 
-        }  
-    }
-
-    return all->promise;
-error:
-    if(all)
-        promise_destroy(manager,all->promise);
-    return NULL;
+    promise_group_t* all = promise_group_new(manager,n,promises,NULL);
+    return promise_group_await(manager,all,promise_all_sub_promise_then,promise_all_sub_promise_catch);
 }
 
 promise_handle_t promise_all_v(promise_manager_handle_t manager, int n, va_list args)
 {
-    promise_handle_t* promises = malloc(sizeof(promise_handle_t)*n);
-    if(!promises)
-        return NULL;
-    for(int i=0; i<n; i++)
-    {
-        promises[i] = va_arg(args, promise_handle_t);
-    }
-    promise_handle_t promise = promise_all_n(manager, n, promises);
-    free(promises);
-    return promise;
+    va_list args_copy;
+    va_copy(args_copy,args);
+    promise_group_t* all = promise_group_new(manager,n,NULL,&args_copy);
+    va_end(args_copy);
+    return promise_group_await(manager,all,promise_all_sub_promise_then,promise_all_sub_promise_catch);
 }
 
 promise_handle_t promise_all(promise_manager_handle_t manager, int n,...)
@@ -514,14 +2260,13 @@ static void promise_all_sub_promise_then(promise_data_t data, void* user, void(*
 {
     promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
     ctx->group->data_count++;
-    ctx->group->data_list->items[ctx->index].data = data;
-    ctx->group->data_list->items[ctx->index].internal.free_ptr = free_ptr;
-    ctx->group->data_list->items[ctx->index].internal.free_ctx = free_ctx;
+    ctx->group->data_list.items[ctx->index].data = data;
+    ctx->group->data_list.items[ctx->index].internal.free_ptr = free_ptr;
+    ctx->group->data_list.items[ctx->index].internal.free_ctx = free_ctx;
     if(ctx->group->data_count == ctx->group->length)
     {
         /** all resolved */
-        promise_data_t data_list = {.ptr = ctx->group->data_list};
-        promise_resolve(ctx->group->manager,ctx->group->promise,data_list,promise_group_free_data_list_with_ctx,NULL);
+        promise_group_settle_with_list(ctx->group,false);
     }
 }
 
@@ -529,7 +2274,9 @@ static void promise_all_sub_promise_catch(promise_data_t data, void* user, void(
 {
     promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
     /** rejct the all promise */
-    promise_reject(ctx->group->manager,ctx->group->promise,data,free_ptr,free_ctx);
+    promise_group_cancel_others(ctx->group,ctx->index);
+    if(promise_reject(ctx->group->manager,ctx->group->promise,data,free_ptr,free_ctx)!=0 && free_ptr)
+        free_ptr(data.ptr,free_ctx);
 }
 
 
@@ -543,41 +2290,17 @@ promise_handle_t promise_any_n(promise_manager_handle_t manager, int n, promise_
 {
     if(!promises)
         return NULL;
-    promise_group_t* any = promise_group_new(manager,n,promises);
-    if(!any)
-        goto error;
-
-    /** await all sub promises */
-    for(int i=0;i<n;i++)
-    {
-        if(promise_await(
-            manager,any->sub_promises[i].promise,
-            promise_any_sub_promise_then,&(any->sub_promises[i]),true,
-            promise_any_sub_promise_catch,&(any->sub_promises[i]),true)!=0)
-        {
-            goto error; 
-        }  
-    }
-
-    return any->promise;
-error:
-    if(any)
-        promise_destroy(manager,any->promise);
-    return NULL;
+    promise_group_t* any = promise_group_new(manager,n,promises,NULL);
+    return promise_group_await(manager,any,promise_any_sub_promise_then,promise_any_sub_promise_catch);
 }
 
 promise_handle_t promise_any_v(promise_manager_handle_t manager, int n, va_list args)
 {
-    promise_handle_t* promises = malloc(sizeof(promise_handle_t)*n);
-    if(!promises)
-        return NULL;
-    for(int i=0; i<n; i++)
-    {
-        promises[i] = va_arg(args, promise_handle_t);
-    }
-    promise_handle_t promise = promise_any_n(manager, n, promises);
-    free(promises);
-    return promise;
+    va_list args_copy;
+    va_copy(args_copy,args);
+    promise_group_t* any = promise_group_new(manager,n,NULL,&args_copy);
+    va_end(args_copy);
+    return promise_group_await(manager,any,promise_any_sub_promise_then,promise_any_sub_promise_catch);
 }
 
 
@@ -595,20 +2318,198 @@ static void promise_any_sub_promise_then(promise_data_t data, void* user, void(*
 {
     promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
     /** resolve the any promise */
-    promise_resolve(ctx->group->manager,ctx->group->promise,data,free_ptr,free_ctx);
+    promise_group_cancel_others(ctx->group,ctx->index);
+    if(promise_resolve(ctx->group->manager,ctx->group->promise,data,free_ptr,free_ctx)!=0 && free_ptr)
+        free_ptr(data.ptr,free_ctx);
 }
 
 static void promise_any_sub_promise_catch(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx)
 {
     promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
     ctx->group->data_count++;
-    ctx->group->data_list->items[ctx->index].data = data;
-    ctx->group->data_list->items[ctx->index].internal.free_ptr = free_ptr;
-    ctx->group->data_list->items[ctx->index].internal.free_ctx = free_ctx;
+    ctx->group->data_list.items[ctx->index].data = data;
+    ctx->group->data_list.items[ctx->index].internal.free_ptr = free_ptr;
+    ctx->group->data_list.items[ctx->index].internal.free_ctx = free_ctx;
     if(ctx->group->data_count == ctx->group->length)
     {
         /** all rejected */
-        promise_data_t data_list = {.ptr = ctx->group->data_list};
-        promise_reject(ctx->group->manager,ctx->group->promise,data_list,promise_group_free_data_list_with_ctx,NULL);
+        promise_group_settle_with_list(ctx->group,true);
+    }
+}
+
+
+/** promise.all stream ****************************************/
+
+static void promise_stream_sub_promise_then(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx);
+
+promise_handle_t promise_all_stream_n(
+    promise_manager_handle_t manager, int n, promise_handle_t* promises,
+    promise_stream_item_t on_item, void* ctx)
+{
+    if(!promises || !on_item)
+        return NULL;
+    promise_group_t* stream = promise_group_new(manager,n,promises,NULL);
+    if(!stream)
+        return NULL;
+    stream->stream.on_item = on_item;
+    stream->stream.ctx = ctx;
+    if(n == 0)
+        promise_resolve(manager,stream->promise,(promise_data_t){.number = 0},NULL,NULL);
+    /** a rejection is handled as in promise.all */
+    return promise_group_await(manager,stream,promise_stream_sub_promise_then,promise_all_sub_promise_catch);
+}
+
+static void promise_stream_sub_promise_then(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
+    promise_group_t* group = ctx->group;
+    group->data_count++;
+    group->busy++;
+    group->stream.on_item(ctx->index,data,free_ptr,free_ctx,group->stream.ctx);
+    group->busy--;
+    if(group->group_released)
+    {
+        /** on_item freed the group promise */
+        promise_group_free_block(group);
+        return;
+    }
+    if(group->data_count == group->length)
+        promise_resolve(group->manager,group->promise,(promise_data_t){.number = group->length},NULL,NULL);
+}
+
+
+/** promise map ****************************************/
+
+static void promise_map_fill(promise_group_t* group);
+static void promise_map_sub_promise_then(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx);
+static void promise_map_sub_promise_catch(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx);
+
+promise_handle_t promise_map_limited(
+    promise_manager_handle_t manager, int n,
+    promise_map_func_t func, void* ctx, int max_in_flight)
+{
+    if(!func || max_in_flight <= 0)
+        return NULL;
+    promise_group_t* map = promise_group_new(manager,n,NULL,NULL);
+    if(!map)
+        return NULL;
+    map->map.func = func;
+    map->map.ctx = ctx;
+    map->map.max_in_flight = max_in_flight;
+    /** the group may only be freed through its promise, which nobody awaits yet */
+    promise_handle_t promise = map->promise;
+    promise_map_fill(map);
+    return promise;
+}
+
+/** 
+ * start sub promises up to max_in_flight, then settle the group if it is done.
+ * Sub promises settled while filling only record their value, 
+ * so a synchronous func neither recurses nor frees the group under the loop.
+ */
+static void promise_map_fill(promise_group_t* group)
+{
+    if(group->map.filling)
+        return;
+    group->map.filling = true;
+    while(!group->map.failed 
+        && group->map.started < group->length
+        && group->map.in_flight < group->map.max_in_flight)
+    {
+        promise_group_sub_promise_ctx_t* sub = &group->sub_promises[group->map.started++];
+        group->map.in_flight++;
+        sub->promise = group->map.func(sub->index,group->map.ctx);
+        PROMISE_TRACE_EVENT(group->manager,PROMISE_TRACE_LINK,group->promise,sub->promise);
+        if(!sub->promise || promise_await(
+            group->manager,sub->promise,
+            promise_map_sub_promise_then,sub,true,
+            promise_map_sub_promise_catch,sub,true) != 0)
+        {
+            promise_cancel(group->manager,sub->promise);
+            group->map.in_flight--;
+            group->map.failed = true;
+            group->map.reason = (promise_data_t){.ptr = NULL};
+        }
+    }
+    group->map.filling = false;
+    if(group->map.failed)
+    {
+        promise_group_cancel_others(group,-1);
+        if(promise_reject(group->manager,group->promise,
+            group->map.reason,group->map.free_reason,group->map.free_reason_ctx) != 0 
+            && group->map.free_reason)
+            group->map.free_reason(group->map.reason.ptr,group->map.free_reason_ctx);
+    }
+    else if(group->data_count == group->length)
+    {
+        promise_group_settle_with_list(group,false);
+    }
+}
+
+static void promise_map_sub_promise_then(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
+    promise_group_t* group = ctx->group;
+    group->map.in_flight--;
+    group->data_count++;
+    group->data_list.items[ctx->index].data = data;
+    group->data_list.items[ctx->index].internal.free_ptr = free_ptr;
+    group->data_list.items[ctx->index].internal.free_ctx = free_ctx;
+    promise_map_fill(group);
+}
+
+static void promise_map_sub_promise_catch(promise_data_t data, void* user, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_group_sub_promise_ctx_t* ctx = (promise_group_sub_promise_ctx_t*)user;
+    promise_group_t* group = ctx->group;
+    group->map.in_flight--;
+    if(group->map.failed)
+    {
+        /** a sub promise failed to start in the same fill, keep the first reason */
+        if(free_ptr)
+            free_ptr(data.ptr,free_ctx);
+        return;
+    }
+    group->map.failed = true;
+    group->map.reason = data;
+    group->map.free_reason = free_ptr;
+    group->map.free_reason_ctx = free_ctx;
+    promise_map_fill(group);
+}
+
+#ifdef PROMISE_CENSUS
+/** census ****************************************/
+
+/** a coarse clock, read on every promise creation */
+static uint64_t promise_census_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/** bytes a live promise keeps out of the pools, its value excluded */
+static size_t promise_census_bytes(promise_t* promise)
+{
+    size_t bytes = sizeof(promise_t);
+    promise_ext_t* ext = promise->ext;
+    if(!ext)
+        return bytes;
+    for(promise_handler_t* handler = ext->first_handler;handler;handler = handler->next)
+        bytes += sizeof(promise_handler_t);
+    if(!ext->embedded)
+        bytes += sizeof(promise_ext_t);
+    else if(ext->internal_free == promise_timer_free_with_ctx)
+        bytes += sizeof(promise_timer_t);
+    else if(ext->internal_free == promise_chain_free_with_ctx)
+    {
+        promise_chain_t* chain = (promise_chain_t*)ext->internal_data;
+        bytes += sizeof(promise_chain_t);
+        if(chain->stages != chain->inline_stages)
+            bytes += sizeof(promise_stage_t)*chain->stage_capacity;
     }
+    else if(ext->internal_free == promise_group_free_with_ctx)
+        bytes += PROMISE_GROUP_BLOCK_SIZE(((promise_group_t*)ext->internal_data)->length);
+    return bytes;
 }
+#endif
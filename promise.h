@@ -1,16 +1,72 @@
 #ifndef __PROMISE_H
 #define __PROMISE_H
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef void* promise_manager_handle_t;
 
 typedef void* promise_handle_t;
 
+typedef struct
+{
+    /** number of promises and handlers preallocated per manager, groups get a quarter of it */
+    int initial_capacity;
+    /** cap on the bytes of freed objects kept for reuse beyond the preallocated ones */
+    size_t max_retained_bytes;
+    /** queue handlers on settlement instead of calling them, see promise_manager_run */
+    bool deferred_dispatch;
+    /** accept promise_resolve_remote/promise_reject_remote, creates an eventfd */
+    bool remote_settle;
+} promise_manager_options_t;
+
 promise_manager_handle_t promise_manager_new();
+/**
+ * @brief Create a new promise manager with tuned memory pools.
+ * promise_manager_new() uses a capacity of 64 and retains up to 256KiB.
+ * Set both fields to 0 to allocate every object with malloc.
+ * 
+ * @param options not nullable
+ * @return promise_manager_handle_t or NULL on error
+ */
+promise_manager_handle_t promise_manager_new_with_options(const promise_manager_options_t* options);
 void promise_manager_free(promise_manager_handle_t manager);
 
+/**
+ * @brief Run queued handlers of a manager created with deferred_dispatch.
+ * Settled promises are dispatched in FIFO order. Handlers settling other promises
+ * queue them behind instead of recursing.
+ * All handlers of one promise are called together, so the budget may be exceeded
+ * by the handlers of the last promise.
+ * 
+ * @param manager 
+ * @param budget max number of handlers to call, <= 0 for no limit
+ * @return true if there is still work queued
+ */
+bool promise_manager_run(promise_manager_handle_t manager, int budget);
+
+/**
+ * @brief Allocate a block from the size classed pools of the manager. ASYNC frames live here.
+ * Released blocks are kept for reuse up to max_retained_bytes per size class 
+ * and freed with the manager. Call on the thread owning the manager.
+ * 
+ * @param manager 
+ * @param size 
+ * @return void* or NULL on error
+ */
+void* promise_manager_alloc(promise_manager_handle_t manager, size_t size);
+/**
+ * @brief Give back a block of promise_manager_alloc.
+ * 
+ * @param manager 
+ * @param block 
+ * @param size the size passed to promise_manager_alloc
+ */
+void promise_manager_release(promise_manager_handle_t manager, void* block, size_t size);
+
 /**
  * @brief Create a new promise
  * 
@@ -30,6 +86,68 @@ promise_handle_t promise_new(promise_manager_handle_t manager);
  */
 void promise_destroy(promise_manager_handle_t manager, promise_handle_t promise);
 
+typedef void(*promise_cancel_handler_t)(void* ctx);
+/**
+ * @brief Set the cancel handler of a pending promise, called by promise_cancel.
+ * Producers use it to abort the work behind the promise and release its buffers.
+ * Setting it again replaces the previous one, NULL clears it.
+ *
+ * @param manager
+ * @param promise
+ * @param on_cancel nullable
+ * @param ctx ctx for on_cancel
+ * @return int 0 on success, -1 on error or if the promise is already settled
+ */
+int promise_set_cancel_handler(
+    promise_manager_handle_t manager, promise_handle_t promise,
+    promise_cancel_handler_t on_cancel, void* ctx);
+
+typedef void(*promise_free_handler_t)(promise_handle_t promise, void* ctx);
+/**
+ * @brief Set the free handler of a promise, called once the promise is freed, whatever frees it:
+ * the dispatch of its handlers, promise_destroy, promise_cancel or promise_manager_free.
+ * Producers keeping the handle use it to forget it. The promise is already gone when it runs.
+ * Setting it again replaces the previous one, NULL clears it.
+ *
+ * @param manager
+ * @param promise a promise of promise_new or promise_new_lazy
+ * @param on_free nullable
+ * @param ctx ctx for on_free
+ * @return int 0 on success, -1 on error
+ */
+int promise_set_free_handler(
+    promise_manager_handle_t manager, promise_handle_t promise,
+    promise_free_handler_t on_free, void* ctx);
+
+typedef void(*promise_start_handler_t)(void* ctx);
+/**
+ * @brief Create a lazy promise. on_start runs once, when the first handler is attached:
+ * by promise_await, or by promise_all/promise_any/promise_then/promise_timeout taking it.
+ * If the promise is freed before that, on_discard runs instead.
+ * 
+ * @param manager 
+ * @param on_start not nullable, starts the work behind the promise
+ * @param on_discard nullable, releases what on_start would have used
+ * @param ctx ctx for on_start and on_discard
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_new_lazy(
+    promise_manager_handle_t manager, 
+    promise_start_handler_t on_start, promise_cancel_handler_t on_discard, void* ctx);
+
+/**
+ * @brief Cancel a promise. The promise can be at any state.
+ * If it is still pending, its cancel handler is called. Then it is destroyed like promise_destroy.
+ * The promise is already gone when the cancel handler runs, settling it there fails.
+ * Cancelling a promise_all/promise_any promise cancels its pending sub promises.
+ * Cancelling an ASYNC promise cancels the promise it is awaiting and frees its frame.
+ *
+ * @param manager
+ * @param promise
+ * @return int 0 on success, -1 if the promise does not exist
+ */
+int promise_cancel(promise_manager_handle_t manager, promise_handle_t promise);
+
 typedef union
 {
     void* ptr;
@@ -64,6 +182,38 @@ int promise_reject(
     promise_manager_handle_t manager, promise_handle_t promise, 
     promise_data_t reason, void(*free_reason)(void*,void*), void* ctx);
 
+/**
+ * @brief Resolve a batch of promises in one pass.
+ * The batch is all or nothing: if a promise does not exist, is already settled
+ * or appears twice, none is resolved. Handlers are dispatched in the batch order,
+ * once every promise of the batch is resolved.
+ *
+ * @param manager
+ * @param count
+ * @param promises
+ * @param data
+ * @param free_data nullable, or one free function per promise, see promise_resolve
+ * @param ctx nullable, or one ctx per promise for free_data
+ * @return int 0 on success, -1 on error
+ */
+int promise_resolve_n(
+    promise_manager_handle_t manager, int count, const promise_handle_t promises[],
+    const promise_data_t data[], void(*const free_data[])(void*,void*), void* const ctx[]);
+/**
+ * @brief Reject a batch of promises in one pass. See promise_resolve_n.
+ *
+ * @param manager
+ * @param count
+ * @param promises
+ * @param reasons
+ * @param free_reasons nullable, or one free function per promise, see promise_reject
+ * @param ctx nullable, or one ctx per promise for free_reasons
+ * @return int 0 on success, -1 on error
+ */
+int promise_reject_n(
+    promise_manager_handle_t manager, int count, const promise_handle_t promises[],
+    const promise_data_t reasons[], void(*const free_reasons[])(void*,void*), void* const ctx[]);
+
 typedef void(*promise_then_handler_t)(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx);
 typedef void(*promise_catch_handler_t)(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx);
 /**
@@ -91,6 +241,52 @@ int promise_await(
     promise_then_handler_t then, void* then_ctx, bool takeover_data,
     promise_catch_handler_t catch, void* catch_ctx, bool takeover_reason);
 
+/** value passed through the transforms of promise_then/promise_catch */
+typedef struct
+{
+    promise_data_t data;
+    void(*free_data)(void*,void*);  /** NULL if data is not owned */
+    void* free_ctx;
+    bool rejected;                  /** data is a reject reason */
+} promise_value_t;
+
+/**
+ * @brief Transform a value in place. It owns value->data: free it with value->free_data
+ * before replacing it. Setting rejected turns the value into a rejection, clearing it recovers.
+ * It MUST NOT destroy or cancel the derived promise.
+ */
+typedef void(*promise_transform_t)(promise_value_t* value, void* ctx);
+
+/**
+ * @brief Derive a promise settled with the value of promise once transformed.
+ * transform runs if promise is resolved, a rejection passes through untouched.
+ * If promise is itself a derived promise nobody awaits yet, transform is fused into it
+ * and promise is returned: a pipeline of stages costs a single promise.
+ * @attention promise is strongly linked to the derived promise. DO NOT use it for other purposes.
+ * @attention promise is cancelled on error and when the derived promise is freed before it settles.
+ *
+ * @param manager
+ * @param promise
+ * @param transform not nullable
+ * @param ctx ctx for transform
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_then(
+    promise_manager_handle_t manager, promise_handle_t promise,
+    promise_transform_t transform, void* ctx);
+/**
+ * @brief Like promise_then, but transform runs if promise is rejected and a resolution passes through.
+ *
+ * @param manager
+ * @param promise
+ * @param transform not nullable
+ * @param ctx ctx for transform
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_catch(
+    promise_manager_handle_t manager, promise_handle_t promise,
+    promise_transform_t transform, void* ctx);
+
 typedef struct
 {
     promise_data_t data;
@@ -113,9 +309,11 @@ typedef struct
  * The resolved value is a list of all the sub promises' resolve values.
  * The rejected reason is the first rejected sub promise's reject reason.
  * @attention Sub promises are strongly linked to this promise. DO NOT use them for other purposes.
+ * @attention Pending sub promises are cancelled on the first rejection or when this promise is freed.
  * @attention Sub promises' data are taken over by default.
  * @attention User MUST handle the data list content
  * @attention User MUST NOT use the data list outside and free_data of then
+ * @attention A data list taken over MUST be freed before the manager is freed
  * 
  * @param manager 
  * @param n number of promises
@@ -126,6 +324,31 @@ promise_handle_t promise_all(promise_manager_handle_t manager, int n,...);
 promise_handle_t promise_all_v(promise_manager_handle_t manager, int n, va_list args);
 promise_handle_t promise_all_n(promise_manager_handle_t manager, int n, promise_handle_t* promises);
 
+/**
+ * @brief Receive one sub result of promise_all_stream_n. data is owned: free it with free_data once done.
+ */
+typedef void(*promise_stream_item_t)(
+    int index, promise_data_t data, void(*free_data)(void*,void*), void* free_ctx, void* ctx);
+/**
+ * @brief Like promise_all, but each sub result goes to on_item as soon as its promise resolves,
+ * in settle order, instead of waiting in a data list for the slowest one.
+ * The promise is resolved with n as data.number once all of them are delivered,
+ * or rejected with the first rejection reason.
+ * on_item may free the promise to stop early, the pending sub promises are cancelled then.
+ * @attention Sub promises are strongly linked to this promise. DO NOT use them for other purposes.
+ * @attention Pending sub promises are cancelled on the first rejection or when this promise is freed.
+ * 
+ * @param manager 
+ * @param n number of promises
+ * @param promises 
+ * @param on_item not nullable
+ * @param ctx ctx for on_item
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_all_stream_n(
+    promise_manager_handle_t manager, int n, promise_handle_t* promises,
+    promise_stream_item_t on_item, void* ctx);
+
 /**
  * @brief Create a new promise. Which:
  * will be resolved if any of the promises is resolved.
@@ -133,8 +356,10 @@ promise_handle_t promise_all_n(promise_manager_handle_t manager, int n, promise_
  * The resolved value is the first resovled sub promise's resolve value
  * The rejected reason is a list of all the sub promises' reject reasons
  * @attention Sub promises are strongly linked to this promise. DO NOT use them for other purposes.
+ * @attention Pending sub promises are cancelled on the first resolution or when this promise is freed.
  * @attention Sub promises' reject reason are taken over by default
  * @attention Sub promises MUST have their free_data set if it is allocated.
+ * @attention A reason list taken over MUST be freed before the manager is freed
  * 
  * @param manager 
  * @param n number of promises
@@ -145,5 +370,262 @@ promise_handle_t promise_any(promise_manager_handle_t manager, int n,...);
 promise_handle_t promise_any_v(promise_manager_handle_t manager, int n, va_list args);
 promise_handle_t promise_any_n(promise_manager_handle_t manager, int n, promise_handle_t* promises);
 
+/**
+ * @brief Start the work for one item, index goes from 0 to n-1.
+ */
+typedef promise_handle_t(*promise_map_func_t)(int index, void* ctx);
+/**
+ * @brief Like promise_all over func(0,ctx)...func(n-1,ctx), with at most max_in_flight of them pending.
+ * Items are started in order, a new one each time an earlier one settles.
+ * func returning NULL rejects the promise with a NULL reason.
+ * @attention Pending sub promises are cancelled and no more items are started 
+ * on the first rejection or when this promise is freed.
+ * @attention See promise_all for the data list.
+ * 
+ * @param manager 
+ * @param n number of items
+ * @param func not nullable
+ * @param ctx ctx for func
+ * @param max_in_flight > 0
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_map_limited(
+    promise_manager_handle_t manager, int n,
+    promise_map_func_t func, void* ctx, int max_in_flight);
+
+#define PROMISE_STATS_HISTOGRAM_BUCKETS 32
+
+typedef struct
+{
+    size_t live_promises;
+    size_t live_handlers;
+    size_t peak_live_promises;
+    size_t active_groups;           /** promise_all/promise_any groups not freed yet */
+    size_t live_timers;             /** promise_delay/promise_timeout timers not freed yet */
+    size_t bytes_held;              /** pools, slot table, dispatch ring and group arrays */
+    unsigned long long created;
+    unsigned long long resolved;
+    unsigned long long rejected;
+    unsigned long long destroyed;   /** promise_destroy on a live promise */
+    unsigned long long cancelled;   /** promise_cancel on a live promise */
+    unsigned long long fused_stages; /** promise_then/promise_catch stages fused into an existing promise */
+    /** 
+     * time from settle to handler dispatch, bucket i counts [2^i,2^(i+1)) ns. 
+     * Without deferred_dispatch everything lands in bucket 0.
+     */
+    unsigned long long dispatch_delay_ns[PROMISE_STATS_HISTOGRAM_BUCKETS];
+} promise_manager_stats_t;
+
+/**
+ * @brief Get the runtime counters of a manager. O(1), nothing is walked.
+ * The counters are compiled out when the library is built with PROMISE_NO_STATS.
+ * 
+ * @param manager 
+ * @param stats not nullable
+ * @return int 0 on success, -1 on error or if built with PROMISE_NO_STATS
+ */
+int promise_manager_get_stats(promise_manager_handle_t manager, promise_manager_stats_t* stats);
+
+/**
+ * @brief Start recording trace events, replacing the ones recorded so far.
+ * Creation, settlement, cancellation, handler dispatch, what each promise waits for
+ * (group members, promise_then sources, timeouts) and ASYNC steps go into a ring
+ * of capacity events owned by the manager, the oldest are overwritten.
+ * The events are compiled in only when the library and the ASYNC functions are 
+ * built with PROMISE_TRACE, otherwise tracing costs nothing.
+ * 
+ * @param manager 
+ * @param capacity events kept, rounded up to a power of 2
+ * @return int 0 on success, -1 on error or if built without PROMISE_TRACE
+ */
+int promise_manager_trace_start(promise_manager_handle_t manager, size_t capacity);
+
+/**
+ * @brief Stop recording and drop the recorded events.
+ * 
+ * @param manager 
+ */
+void promise_manager_trace_stop(promise_manager_handle_t manager);
+
+/**
+ * @brief Write the recorded events as Chrome trace event JSON, for chrome://tracing or Perfetto.
+ * Each promise is an async slice from its creation to its settlement, id being its handle.
+ * 
+ * @param manager 
+ * @param file not nullable
+ * @return int number of events written, -1 on error or if not recording
+ */
+int promise_manager_trace_dump(promise_manager_handle_t manager, FILE* file);
+
+/**
+ * @brief Record that promise awaits awaiting at file:line. Called by the AWAIT macros.
+ * 
+ * @param manager 
+ * @param promise 
+ * @param awaiting 
+ * @param file 
+ * @param line 
+ */
+void promise_trace_step(
+    promise_manager_handle_t manager, promise_handle_t promise, promise_handle_t awaiting,
+    const char* file, int line);
+
+/**
+ * @brief Write the live promises grouped by creation site, most promises first:
+ * how many, how many already settled but never consumed, the bytes they hold
+ * (promise, handlers and the owning timer, chain or group, not their values)
+ * and a histogram of their ages. Sites are recorded only when the library and
+ * the callers are built with PROMISE_CENSUS, which costs a coarse clock read and
+ * 24 bytes per slot of the slot table.
+ * 
+ * @param manager 
+ * @param file not nullable
+ * @return int number of live promises, -1 on error or if built without PROMISE_CENSUS
+ */
+int promise_manager_dump_pending(promise_manager_handle_t manager, FILE* file);
+
+/**
+ * @brief Record file:line as the creation site of promise if it has none yet. Called by the creation macros.
+ * 
+ * @param manager 
+ * @param promise 
+ * @param file 
+ * @param line 
+ * @return promise_handle_t promise
+ */
+promise_handle_t promise_census_site(
+    promise_manager_handle_t manager, promise_handle_t promise, const char* file, int line);
+
+/**
+ * @brief Resolve a promise from any thread. 
+ * The request is queued on the manager and applied by promise_manager_process_remote 
+ * on the thread owning the manager. The manager MUST be created with remote_settle.
+ * @attention Once queued, the data belongs to the manager. It is freed with free_data 
+ * if the promise is gone or already settled when the request is processed.
+ * 
+ * @param manager 
+ * @param promise 
+ * @param data 
+ * @param free_data 
+ * @param ctx ctx for free_data
+ * @return int 0 on success, -1 on error. The caller keeps the data on error.
+ */
+int promise_resolve_remote(
+    promise_manager_handle_t manager, promise_handle_t promise, 
+    promise_data_t data, void(*free_data)(void*,void*), void* ctx);
+/**
+ * @brief Reject a promise from any thread. See promise_resolve_remote.
+ * 
+ * @param manager 
+ * @param promise 
+ * @param reason 
+ * @param free_reason 
+ * @param ctx ctx for free_reason
+ * @return int 0 on success, -1 on error. The caller keeps the reason on error.
+ */
+int promise_reject_remote(
+    promise_manager_handle_t manager, promise_handle_t promise, 
+    promise_data_t reason, void(*free_reason)(void*,void*), void* ctx);
+
+/**
+ * @brief Get the eventfd signaled when remote settle requests are queued.
+ * Poll it for readability and call promise_manager_process_remote.
+ * 
+ * @param manager 
+ * @return int the fd or -1 if remote_settle is not enabled
+ */
+int promise_manager_get_fd(promise_manager_handle_t manager);
+
+/**
+ * @brief Apply all queued remote settle requests. Call on the thread owning the manager.
+ * 
+ * @param manager 
+ * @return int number of requests processed, -1 on error
+ */
+int promise_manager_process_remote(promise_manager_handle_t manager);
+
+/**
+ * @brief Get the time of the manager's timers in ms.
+ * It starts at CLOCK_MONOTONIC when the manager is created and only moves with promise_manager_advance_time.
+ * 
+ * @param manager 
+ * @return uint64_t 
+ */
+uint64_t promise_manager_now(promise_manager_handle_t manager);
+
+/**
+ * @brief Move the time of the manager forward and fire the expired timers.
+ * Call it from the event loop with CLOCK_MONOTONIC in ms.
+ * Timers live in a hierarchical timing wheel, adding or removing one is O(1).
+ * 
+ * @param manager 
+ * @param now_ms ignored if it is not after promise_manager_now
+ * @return int number of timers fired, -1 on error
+ */
+int promise_manager_advance_time(promise_manager_handle_t manager, uint64_t now_ms);
+
+/**
+ * @brief Get how long an event loop may sleep before calling promise_manager_advance_time.
+ * It may be shorter than the next deadline, when timers have to move down the wheel.
+ * 
+ * @param manager 
+ * @return int ms from promise_manager_now, -1 if there is no timer
+ */
+int promise_manager_next_timeout(promise_manager_handle_t manager);
+
+/**
+ * @brief Create a promise resolved with a NULL ptr once the manager's time reaches now + ms.
+ * Destroying or cancelling the promise removes its timer.
+ * 
+ * @param manager 
+ * @param ms 0 counts as 1
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_delay(promise_manager_handle_t manager, uint64_t ms);
+
+/** reject reason of promise_timeout, compare reason.ptr with it */
+extern const char promise_timeout_reason[];
+#define PROMISE_TIMEOUT ((void*)promise_timeout_reason)
+
+/**
+ * @brief Race a promise against a timer. The new promise:
+ * settles like promise if it settles within ms.
+ * is rejected with PROMISE_TIMEOUT otherwise, promise is cancelled then.
+ * @attention promise is strongly linked to the new promise. DO NOT use it for other purposes.
+ * @attention promise is cancelled on error and when the new promise is freed before it settles.
+ * 
+ * @param manager 
+ * @param promise 
+ * @param ms 0 counts as 1
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_timeout(promise_manager_handle_t manager, promise_handle_t promise, uint64_t ms);
+
+/** 
+ * With PROMISE_CENSUS the creation functions record their caller's file:line,
+ * see promise_manager_dump_pending. manager is evaluated twice.
+ * Define PROMISE_CENSUS_NO_SITES before including this file to call the plain functions.
+ */
+#if defined(PROMISE_CENSUS) && !defined(PROMISE_CENSUS_NO_SITES)
+#define _PROMISE_CENSUS_SITE(manager,promise) promise_census_site(manager,promise,__FILE__,__LINE__)
+#define promise_new(manager) _PROMISE_CENSUS_SITE(manager,promise_new(manager))
+#define promise_new_lazy(manager,on_start,on_discard,ctx) \
+    _PROMISE_CENSUS_SITE(manager,promise_new_lazy(manager,on_start,on_discard,ctx))
+#define promise_then(manager,promise,func,ctx) _PROMISE_CENSUS_SITE(manager,promise_then(manager,promise,func,ctx))
+#define promise_catch(manager,promise,func,ctx) _PROMISE_CENSUS_SITE(manager,promise_catch(manager,promise,func,ctx))
+#define promise_all(manager,...) _PROMISE_CENSUS_SITE(manager,promise_all(manager,__VA_ARGS__))
+#define promise_all_v(manager,n,args) _PROMISE_CENSUS_SITE(manager,promise_all_v(manager,n,args))
+#define promise_all_n(manager,n,promises) _PROMISE_CENSUS_SITE(manager,promise_all_n(manager,n,promises))
+#define promise_all_stream_n(manager,n,promises,on_item,ctx) \
+    _PROMISE_CENSUS_SITE(manager,promise_all_stream_n(manager,n,promises,on_item,ctx))
+#define promise_any(manager,...) _PROMISE_CENSUS_SITE(manager,promise_any(manager,__VA_ARGS__))
+#define promise_any_v(manager,n,args) _PROMISE_CENSUS_SITE(manager,promise_any_v(manager,n,args))
+#define promise_any_n(manager,n,promises) _PROMISE_CENSUS_SITE(manager,promise_any_n(manager,n,promises))
+#define promise_map_limited(manager,n,func,ctx,max_in_flight) \
+    _PROMISE_CENSUS_SITE(manager,promise_map_limited(manager,n,func,ctx,max_in_flight))
+#define promise_delay(manager,ms) _PROMISE_CENSUS_SITE(manager,promise_delay(manager,ms))
+#define promise_timeout(manager,promise,ms) _PROMISE_CENSUS_SITE(manager,promise_timeout(manager,promise,ms))
+#endif
+
 #endif
 
@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "promise_executor.h"
+
+/** must be a power of 2, jobs overflowing a deque go to the shared queue */
+#define PROMISE_EXECUTOR_DEQUE_CAPACITY 4096
+#define PROMISE_EXECUTOR_CACHE_LINE 64
+
+typedef struct promise_executor_s promise_executor_t;
+
+typedef struct promise_executor_task_s
+{
+    /** link in the shared queue, then in the in flight list of the worker */
+    struct promise_executor_task_s* next;
+    struct promise_executor_task_s* prev;
+    promise_executor_job_t job;
+    void* ctx;
+    promise_manager_handle_t origin;
+    promise_handle_t promise;
+} promise_executor_task_t;
+
+/** Chase-Lev work stealing deque. The owner pushes and takes at bottom, thieves steal at top. */
+typedef struct
+{
+    _Alignas(PROMISE_EXECUTOR_CACHE_LINE) atomic_long top;
+    _Alignas(PROMISE_EXECUTOR_CACHE_LINE) atomic_long bottom;
+    _Atomic(promise_executor_task_t*) tasks[PROMISE_EXECUTOR_DEQUE_CAPACITY];
+} promise_executor_deque_t;
+
+typedef struct
+{
+    promise_executor_deque_t deque;
+    promise_executor_t* executor;
+    pthread_t thread;
+    bool started;
+    promise_manager_handle_t manager;
+    int wake_fd;
+    atomic_bool sleeping;
+    uint32_t seed;                          /** victim selection */
+    promise_executor_task_t* in_flight;     /** tasks waiting for their shard promise */
+} promise_executor_worker_t;
+
+struct promise_executor_s
+{
+    int length;
+    promise_executor_worker_t* workers;
+    atomic_bool stop;
+    atomic_int sleepers;
+    /** shared queue for jobs submitted outside of the workers */
+    pthread_mutex_t lock;
+    promise_executor_task_t* queue_head;
+    promise_executor_task_t* queue_tail;
+    atomic_int queue_length;
+};
+
+static _Thread_local promise_executor_worker_t* current_worker = NULL;
+
+static void* promise_executor_worker_main(void* arg);
+static void promise_executor_wake(promise_executor_t* executor);
+static void promise_executor_task_free(promise_executor_task_t* task);
+static bool promise_executor_deque_push(promise_executor_deque_t* deque, promise_executor_task_t* task);
+static promise_executor_task_t* promise_executor_deque_take(promise_executor_deque_t* deque);
+static promise_executor_task_t* promise_executor_deque_steal(promise_executor_deque_t* deque);
+
+promise_executor_handle_t promise_executor_new(int threads)
+{
+    promise_executor_t* executor = NULL;
+    if(threads <= 0)
+        goto error;
+    executor = malloc(sizeof(promise_executor_t));
+    if(!executor)
+        goto error;
+    memset(executor,0,sizeof(promise_executor_t));
+    atomic_init(&executor->stop,false);
+    atomic_init(&executor->sleepers,0);
+    atomic_init(&executor->queue_length,0);
+    pthread_mutex_init(&executor->lock,NULL);
+    executor->workers = aligned_alloc(PROMISE_EXECUTOR_CACHE_LINE,sizeof(promise_executor_worker_t)*threads);
+    if(!executor->workers)
+        goto error;
+    memset(executor->workers,0,sizeof(promise_executor_worker_t)*threads);
+    executor->length = threads;
+    for(int i=0;i<threads;i++)
+        executor->workers[i].wake_fd = -1;
+
+    promise_manager_options_t options = {
+        .initial_capacity = 64,
+        .max_retained_bytes = 256*1024,
+        .remote_settle = true
+    };
+    for(int i=0;i<threads;i++)
+    {
+        promise_executor_worker_t* worker = &executor->workers[i];
+        worker->executor = executor;
+        worker->seed = i + 1;
+        atomic_init(&worker->deque.top,0);
+        atomic_init(&worker->deque.bottom,0);
+        atomic_init(&worker->sleeping,false);
+        worker->manager = promise_manager_new_with_options(&options);
+        if(!worker->manager)
+            goto error;
+        worker->wake_fd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+        if(worker->wake_fd < 0)
+            goto error;
+    }
+    for(int i=0;i<threads;i++)
+    {
+        promise_executor_worker_t* worker = &executor->workers[i];
+        if(pthread_create(&worker->thread,NULL,promise_executor_worker_main,worker)!=0)
+            goto error;
+        worker->started = true;
+    }
+    return (promise_executor_handle_t)executor;
+error:
+    promise_executor_free((promise_executor_handle_t)executor);
+    return NULL;
+}
+
+void promise_executor_free(promise_executor_handle_t executor_handle)
+{
+    promise_executor_t* executor = (promise_executor_t*)executor_handle;
+    if(!executor)
+        return;
+    atomic_store(&executor->stop,true);
+    if(executor->workers)
+    {
+        uint64_t one = 1;
+        for(int i=0;i<executor->length;i++)
+        {
+            if(executor->workers[i].wake_fd >= 0)
+                while(write(executor->workers[i].wake_fd,&one,sizeof(one)) < 0 && errno == EINTR);
+        }
+        for(int i=0;i<executor->length;i++)
+        {
+            if(executor->workers[i].started)
+                pthread_join(executor->workers[i].thread,NULL);
+        }
+        for(int i=0;i<executor->length;i++)
+        {
+            promise_executor_worker_t* worker = &executor->workers[i];
+            promise_executor_task_t* task = NULL;
+            while((task = promise_executor_deque_take(&worker->deque)))
+                promise_executor_task_free(task);
+            /** shard promises go first, they reference the in flight tasks */
+            promise_manager_free(worker->manager);
+            while(worker->in_flight)
+            {
+                task = worker->in_flight;
+                worker->in_flight = task->next;
+                promise_executor_task_free(task);
+            }
+            if(worker->wake_fd >= 0)
+                close(worker->wake_fd);
+        }
+        free(executor->workers);
+    }
+    while(executor->queue_head)
+    {
+        promise_executor_task_t* task = executor->queue_head;
+        executor->queue_head = task->next;
+        promise_executor_task_free(task);
+    }
+    pthread_mutex_destroy(&executor->lock);
+    free(executor);
+}
+
+promise_handle_t promise_executor_submit(
+    promise_executor_handle_t executor_handle, promise_manager_handle_t manager,
+    promise_executor_job_t job, void* ctx)
+{
+    promise_executor_t* executor = (promise_executor_t*)executor_handle;
+    promise_executor_task_t* task = NULL;
+    if(!executor || !manager || !job)
+        goto error;
+    if(promise_manager_get_fd(manager) < 0)
+        goto error;
+    task = malloc(sizeof(promise_executor_task_t));
+    if(!task)
+        goto error;
+    memset(task,0,sizeof(promise_executor_task_t));
+    task->job = job;
+    task->ctx = ctx;
+    task->origin = manager;
+    task->promise = promise_new(manager);
+    if(!task->promise)
+        goto error;
+    promise_handle_t promise = task->promise;
+    if(!(current_worker && current_worker->executor == executor
+        && promise_executor_deque_push(&current_worker->deque,task)))
+    {
+        pthread_mutex_lock(&executor->lock);
+        if(executor->queue_tail)
+            executor->queue_tail->next = task;
+        else
+            executor->queue_head = task;
+        executor->queue_tail = task;
+        atomic_fetch_add(&executor->queue_length,1);
+        pthread_mutex_unlock(&executor->lock);
+    }
+    /** task may already be running and freed from here */
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load(&executor->sleepers) > 0)
+        promise_executor_wake(executor);
+    return promise;
+error:
+    if(task)
+    {
+        promise_destroy(manager,task->promise);
+        free(task);
+    }
+    return NULL;
+}
+
+promise_manager_handle_t promise_executor_current_manager()
+{
+    return current_worker ? current_worker->manager : NULL;
+}
+
+/** static functions */
+
+static void promise_executor_task_free(promise_executor_task_t* task)
+{
+    free(task);
+}
+
+static void promise_executor_in_flight_remove(promise_executor_worker_t* worker, promise_executor_task_t* task)
+{
+    if(task->prev)
+        task->prev->next = task->next;
+    else
+        worker->in_flight = task->next;
+    if(task->next)
+        task->next->prev = task->prev;
+}
+
+static void promise_executor_job_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_executor_task_t* task = (promise_executor_task_t*)ctx;
+    if(promise_resolve_remote(task->origin,task->promise,data,free_ptr,free_ctx)!=0 && free_ptr)
+        free_ptr(data.ptr,free_ctx);
+    promise_executor_in_flight_remove(current_worker,task);
+    promise_executor_task_free(task);
+}
+
+static void promise_executor_job_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    promise_executor_task_t* task = (promise_executor_task_t*)ctx;
+    if(promise_reject_remote(task->origin,task->promise,reason,free_ptr,free_ctx)!=0 && free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+    promise_executor_in_flight_remove(current_worker,task);
+    promise_executor_task_free(task);
+}
+
+static void promise_executor_run(promise_executor_worker_t* worker, promise_executor_task_t* task)
+{
+    task->prev = NULL;
+    task->next = worker->in_flight;
+    if(worker->in_flight)
+        worker->in_flight->prev = task;
+    worker->in_flight = task;
+    promise_handle_t promise = task->job(worker->manager,task->ctx);
+    /** the handlers forward the result to the origin manager, maybe right away */
+    if(promise_await(
+        worker->manager,promise,
+        promise_executor_job_then,task,true,
+        promise_executor_job_catch,task,true)!=0)
+    {
+        promise_destroy(worker->manager,promise);
+        promise_reject_remote(task->origin,task->promise,(promise_data_t){.ptr=NULL},NULL,NULL);
+        promise_executor_in_flight_remove(worker,task);
+        promise_executor_task_free(task);
+    }
+}
+
+static promise_executor_task_t* promise_executor_queue_pop(promise_executor_t* executor)
+{
+    if(atomic_load(&executor->queue_length) == 0)
+        return NULL;
+    pthread_mutex_lock(&executor->lock);
+    promise_executor_task_t* task = executor->queue_head;
+    if(task)
+    {
+        executor->queue_head = task->next;
+        if(!executor->queue_head)
+            executor->queue_tail = NULL;
+        atomic_fetch_sub(&executor->queue_length,1);
+    }
+    pthread_mutex_unlock(&executor->lock);
+    return task;
+}
+
+static promise_executor_task_t* promise_executor_steal(promise_executor_worker_t* worker)
+{
+    promise_executor_t* executor = worker->executor;
+    if(executor->length < 2)
+        return NULL;
+    /** xorshift for a random first victim, then go around */
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+    int start = worker->seed % executor->length;
+    for(int i=0;i<executor->length;i++)
+    {
+        promise_executor_worker_t* victim = &executor->workers[(start + i) % executor->length];
+        if(victim == worker)
+            continue;
+        promise_executor_task_t* task = promise_executor_deque_steal(&victim->deque);
+        if(task)
+            return task;
+    }
+    return NULL;
+}
+
+static bool promise_executor_has_work(promise_executor_t* executor)
+{
+    if(atomic_load(&executor->queue_length) > 0)
+        return true;
+    for(int i=0;i<executor->length;i++)
+    {
+        promise_executor_deque_t* deque = &executor->workers[i].deque;
+        if(atomic_load(&deque->bottom) > atomic_load(&deque->top))
+            return true;
+    }
+    return false;
+}
+
+static void promise_executor_wake(promise_executor_t* executor)
+{
+    uint64_t one = 1;
+    for(int i=0;i<executor->length;i++)
+    {
+        promise_executor_worker_t* worker = &executor->workers[i];
+        if(atomic_exchange(&worker->sleeping,false))
+        {
+            while(write(worker->wake_fd,&one,sizeof(one)) < 0 && errno == EINTR);
+            return;
+        }
+    }
+}
+
+static void* promise_executor_worker_main(void* arg)
+{
+    promise_executor_worker_t* worker = (promise_executor_worker_t*)arg;
+    promise_executor_t* executor = worker->executor;
+    current_worker = worker;
+    struct pollfd fds[2] = {
+        {.fd = promise_manager_get_fd(worker->manager), .events = POLLIN},
+        {.fd = worker->wake_fd, .events = POLLIN}
+    };
+    while(!atomic_load(&executor->stop))
+    {
+        /** results routed to this shard */
+        promise_manager_process_remote(worker->manager);
+        promise_executor_task_t* task = promise_executor_deque_take(&worker->deque);
+        if(!task)
+            task = promise_executor_queue_pop(executor);
+        if(!task)
+            task = promise_executor_steal(worker);
+        if(task)
+        {
+            promise_executor_run(worker,task);
+            /** keep the others busy while this worker holds a backlog */
+            if(atomic_load(&executor->sleepers) > 0 &&
+                atomic_load(&worker->deque.bottom) > atomic_load(&worker->deque.top))
+                promise_executor_wake(executor);
+            continue;
+        }
+        /** announce sleeping first, then check again, so a submit can not be missed */
+        atomic_store(&worker->sleeping,true);
+        atomic_fetch_add(&executor->sleepers,1);
+        if(!promise_executor_has_work(executor) && !atomic_load(&executor->stop))
+            poll(fds,2,-1);
+        atomic_fetch_sub(&executor->sleepers,1);
+        atomic_store(&worker->sleeping,false);
+        uint64_t count;
+        while(read(worker->wake_fd,&count,sizeof(count)) < 0 && errno == EINTR);
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+/** deque, see "Correct and Efficient Work-Stealing for Weak Memory Models" */
+
+static bool promise_executor_deque_push(promise_executor_deque_t* deque, promise_executor_task_t* task)
+{
+    long b = atomic_load_explicit(&deque->bottom,memory_order_relaxed);
+    long t = atomic_load_explicit(&deque->top,memory_order_acquire);
+    if(b - t >= PROMISE_EXECUTOR_DEQUE_CAPACITY)
+        return false;
+    atomic_store_explicit(&deque->tasks[b & (PROMISE_EXECUTOR_DEQUE_CAPACITY - 1)],task,memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom,b + 1,memory_order_relaxed);
+    return true;
+}
+
+static promise_executor_task_t* promise_executor_deque_take(promise_executor_deque_t* deque)
+{
+    long b = atomic_load_explicit(&deque->bottom,memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom,b,memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque->top,memory_order_relaxed);
+    promise_executor_task_t* task = NULL;
+    if(t <= b)
+    {
+        task = atomic_load_explicit(&deque->tasks[b & (PROMISE_EXECUTOR_DEQUE_CAPACITY - 1)],memory_order_relaxed);
+        if(t == b)
+        {
+            /** last one, race against thieves */
+            if(!atomic_compare_exchange_strong_explicit(&deque->top,&t,t + 1,memory_order_seq_cst,memory_order_relaxed))
+                task = NULL;
+            atomic_store_explicit(&deque->bottom,b + 1,memory_order_relaxed);
+        }
+    }
+    else
+    {
+        atomic_store_explicit(&deque->bottom,b + 1,memory_order_relaxed);
+    }
+    return task;
+}
+
+static promise_executor_task_t* promise_executor_deque_steal(promise_executor_deque_t* deque)
+{
+    long t = atomic_load_explicit(&deque->top,memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&deque->bottom,memory_order_acquire);
+    if(t >= b)
+        return NULL;
+    promise_executor_task_t* task = atomic_load_explicit(&deque->tasks[t & (PROMISE_EXECUTOR_DEQUE_CAPACITY - 1)],memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&deque->top,&t,t + 1,memory_order_seq_cst,memory_order_relaxed))
+        return NULL;
+    return task;
+}
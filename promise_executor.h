@@ -0,0 +1,62 @@
+#ifndef __PROMISE_EXECUTOR_H
+#define __PROMISE_EXECUTOR_H
+
+#include "promise.h"
+
+typedef void* promise_executor_handle_t;
+
+/**
+ * @brief A job run on a worker thread.
+ *
+ * @param shard the promise manager owned by the worker running the job
+ * @param ctx
+ * @return promise_handle_t a promise of shard, or NULL on error
+ */
+typedef promise_handle_t(*promise_executor_job_t)(promise_manager_handle_t shard, void* ctx);
+
+/**
+ * @brief Create an executor with n worker threads.
+ * Each worker owns a promise manager shard and a work stealing deque of jobs.
+ * Idle workers steal jobs from the others.
+ *
+ * @param threads number of worker threads
+ * @return promise_executor_handle_t or NULL on error
+ */
+promise_executor_handle_t promise_executor_new(int threads);
+
+/**
+ * @brief Stop and join the workers, then free the executor.
+ * Jobs not started yet are dropped and their promises are never settled.
+ *
+ * @param executor
+ */
+void promise_executor_free(promise_executor_handle_t executor);
+
+/**
+ * @brief Run a job on a worker.
+ * The promise returned by the job is settled on its shard and routed back to a
+ * promise of manager through promise_resolve_remote/promise_reject_remote.
+ * Called on a worker thread, the job is pushed to the local deque.
+ * Called on any other thread, the job is queued to the executor.
+ * @attention manager MUST be created with remote_settle and owned by the calling thread.
+ *
+ * @param executor
+ * @param manager manager of the calling thread, see promise_executor_current_manager
+ * @param job not nullable
+ * @param ctx ctx for job
+ * @return promise_handle_t a promise of manager, or NULL on error
+ */
+promise_handle_t promise_executor_submit(
+    promise_executor_handle_t executor, promise_manager_handle_t manager,
+    promise_executor_job_t job, void* ctx);
+
+/**
+ * @brief Get the shard of the calling worker thread.
+ * Use this as GLOBAL_PROMISE_MANAGER to run ASYNC functions on the executor.
+ *
+ * @return promise_manager_handle_t or NULL if not called on a worker thread
+ */
+promise_manager_handle_t promise_executor_current_manager();
+
+#endif
+
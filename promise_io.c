@@ -0,0 +1,736 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#ifdef PROMISE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "promise_io.h"
+
+#define PROMISE_IO_DEFAULT_QUEUE_DEPTH 256
+#define PROMISE_IO_DEFAULT_THREADS 4
+
+typedef enum
+{
+    PROMISE_IO_READ,
+    PROMISE_IO_WRITE,
+    PROMISE_IO_FSYNC
+} promise_io_op_t;
+
+typedef struct promise_io_s promise_io_t;
+
+#ifdef PROMISE_IO_URING
+/** 
+ * io_uring driven through its syscalls, see promise_io_ring_init. 
+ * Entries are prepared at sq_local_tail and published to the kernel by promise_io_ring_submit.
+ */
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned sq_local_tail;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;                       /** NULL if it shares sq_map */
+    size_t cq_map_size;
+    size_t sqes_size;
+} promise_io_ring_t;
+#endif
+
+/** Allocated from the manager, only touched by the workers between submission and completion. */
+typedef struct promise_io_request_s
+{
+    struct promise_io_request_s* next;
+    promise_io_op_t op;
+    int fd;
+    void* buf;
+    size_t len;
+    off_t offset;
+    ssize_t result;             /** bytes or -errno */
+    promise_handle_t promise;   /** NULL once cancelled */
+} promise_io_request_t;
+
+struct promise_io_s
+{
+    promise_manager_handle_t manager;
+    promise_reactor_handle_t reactor;
+    int event_fd;                       /** signaled on completions */
+    promise_handle_t wait;              /** readable promise of event_fd while requests are in flight */
+    int queued;                         /** not submitted yet */
+    int in_flight;                      /** submitted, not reaped yet */
+    struct iovec* buffers;
+    int buffer_count;
+#ifdef PROMISE_IO_URING
+    bool uring;
+    promise_io_ring_t ring;
+#endif
+    /** thread pool backend */
+    promise_io_request_t* queue_head;   /** queued during this loop iteration */
+    promise_io_request_t* queue_tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    promise_io_request_t* work_head;    /** under lock, submitted to the workers */
+    promise_io_request_t* work_tail;
+    promise_io_request_t* done;         /** under lock, completed by the workers, newest first */
+    bool stop;
+    pthread_t* threads;
+    int thread_count;
+};
+
+static bool promise_io_uses_uring(promise_io_t* io);
+static promise_handle_t promise_io_queue(
+    promise_io_t* io, promise_io_op_t op, int fd, void* buf, size_t len, off_t offset);
+static void promise_io_settle(promise_io_t* io, promise_io_request_t* request);
+static void promise_io_drop(promise_io_t* io, promise_io_request_t* request);
+static void promise_io_cancelled(void* ctx);
+static void promise_io_prepare(void* ctx);
+static void promise_io_watch(promise_io_t* io);
+static void promise_io_ready(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx);
+static void promise_io_ready_error(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx);
+static void* promise_io_worker_main(void* arg);
+#ifdef PROMISE_IO_URING
+static int promise_io_find_buffer(promise_io_t* io, const void* buf, size_t len);
+static int promise_io_ring_init(promise_io_ring_t* ring, unsigned entries);
+static void promise_io_ring_exit(promise_io_ring_t* ring);
+static struct io_uring_sqe* promise_io_ring_get_sqe(promise_io_ring_t* ring);
+static int promise_io_ring_submit(promise_io_ring_t* ring);
+static int promise_io_ring_wait(promise_io_ring_t* ring);
+static int promise_io_ring_register(promise_io_ring_t* ring, unsigned opcode, const void* arg, unsigned count);
+#endif
+
+promise_io_handle_t promise_io_new(
+    promise_manager_handle_t manager, promise_reactor_handle_t reactor,
+    const promise_io_options_t* options)
+{
+    promise_io_t* io = NULL;
+    if(!manager)
+        goto error;
+    io = malloc(sizeof(promise_io_t));
+    if(!io)
+        goto error;
+    memset(io,0,sizeof(promise_io_t));
+    io->manager = manager;
+    pthread_mutex_init(&io->lock,NULL);
+    pthread_cond_init(&io->cond,NULL);
+    io->event_fd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if(io->event_fd < 0)
+        goto error;
+#ifdef PROMISE_IO_URING
+    unsigned queue_depth = options && options->queue_depth ? options->queue_depth : PROMISE_IO_DEFAULT_QUEUE_DEPTH;
+    if(promise_io_ring_init(&io->ring,queue_depth) == 0)
+    {
+        /** without completion signals the ring is of no use, fall back to the threads */
+        if(promise_io_ring_register(&io->ring,IORING_REGISTER_EVENTFD,&io->event_fd,1) == 0)
+            io->uring = true;
+        else
+            promise_io_ring_exit(&io->ring);
+    }
+#endif
+    if(!promise_io_uses_uring(io))
+    {
+        int threads = options && options->threads > 0 ? options->threads : PROMISE_IO_DEFAULT_THREADS;
+        io->threads = malloc(sizeof(pthread_t)*threads);
+        if(!io->threads)
+            goto error;
+        for(int i=0;i<threads;i++)
+        {
+            if(pthread_create(&io->threads[i],NULL,promise_io_worker_main,io)!=0)
+                goto error;
+            io->thread_count++;
+        }
+    }
+    if(reactor)
+    {
+        if(promise_reactor_add_prepare(reactor,promise_io_prepare,io) != 0)
+            goto error;
+        io->reactor = reactor;
+    }
+    return (promise_io_handle_t)io;
+error:
+    promise_io_free((promise_io_handle_t)io);
+    return NULL;
+}
+
+void promise_io_free(promise_io_handle_t io_handle)
+{
+    promise_io_t* io = (promise_io_t*)io_handle;
+    if(!io)
+        return;
+    if(io->reactor)
+    {
+        promise_reactor_remove_prepare(io->reactor,promise_io_prepare,io);
+        if(io->wait)
+            promise_cancel(io->manager,io->wait);
+        promise_reactor_remove(io->reactor,io->event_fd);
+        /** submitting below MUST NOT watch the eventfd again */
+        io->reactor = NULL;
+        io->wait = NULL;
+    }
+#ifdef PROMISE_IO_URING
+    if(io->uring)
+    {
+        /** prepared entries cannot be taken back, submit them and wait for everything */
+        promise_io_submit(io_handle);
+        promise_io_ring_t* ring = &io->ring;
+        while(io->in_flight > 0)
+        {
+            unsigned head = *ring->cq_head;
+            unsigned tail = __atomic_load_n(ring->cq_tail,__ATOMIC_ACQUIRE);
+            if(head == tail)
+            {
+                if(promise_io_ring_wait(ring) < 0)
+                    break;
+                continue;
+            }
+            for(;head != tail;head++)
+            {
+                io->in_flight--;
+                promise_io_drop(io,(promise_io_request_t*)(uintptr_t)ring->cqes[head & *ring->cq_mask].user_data);
+            }
+            __atomic_store_n(ring->cq_head,head,__ATOMIC_RELEASE);
+        }
+        promise_io_ring_exit(ring);
+    }
+#endif
+    if(io->threads)
+    {
+        /** the workers drain the submitted requests before exiting */
+        pthread_mutex_lock(&io->lock);
+        io->stop = true;
+        pthread_cond_broadcast(&io->cond);
+        pthread_mutex_unlock(&io->lock);
+        for(int i=0;i<io->thread_count;i++)
+            pthread_join(io->threads[i],NULL);
+        free(io->threads);
+    }
+    promise_io_request_t* lists[3] = {io->queue_head,io->work_head,io->done};
+    for(int i=0;i<3;i++)
+    {
+        while(lists[i])
+        {
+            promise_io_request_t* request = lists[i];
+            lists[i] = request->next;
+            promise_io_drop(io,request);
+        }
+    }
+    if(io->event_fd >= 0)
+        close(io->event_fd);
+    pthread_cond_destroy(&io->cond);
+    pthread_mutex_destroy(&io->lock);
+    free(io->buffers);
+    free(io);
+}
+
+const char* promise_io_backend(promise_io_handle_t io_handle)
+{
+    promise_io_t* io = (promise_io_t*)io_handle;
+    if(!io)
+        return NULL;
+    return promise_io_uses_uring(io) ? "io_uring" : "threads";
+}
+
+int promise_io_register_buffers(promise_io_handle_t io_handle, const struct iovec* iovecs, int count)
+{
+    promise_io_t* io = (promise_io_t*)io_handle;
+    if(!io || !iovecs || count <= 0 || io->buffers)
+        return -1;
+    io->buffers = malloc(sizeof(struct iovec)*count);
+    if(!io->buffers)
+        return -1;
+    memcpy(io->buffers,iovecs,sizeof(struct iovec)*count);
+#ifdef PROMISE_IO_URING
+    if(io->uring && promise_io_ring_register(&io->ring,IORING_REGISTER_BUFFERS,io->buffers,count) != 0)
+    {
+        free(io->buffers);
+        io->buffers = NULL;
+        return -1;
+    }
+#endif
+    io->buffer_count = count;
+    return 0;
+}
+
+promise_handle_t promise_read(promise_io_handle_t io, int fd, void* buf, size_t len, off_t offset)
+{
+    return promise_io_queue((promise_io_t*)io,PROMISE_IO_READ,fd,buf,len,offset);
+}
+
+promise_handle_t promise_write(promise_io_handle_t io, int fd, const void* buf, size_t len, off_t offset)
+{
+    return promise_io_queue((promise_io_t*)io,PROMISE_IO_WRITE,fd,(void*)buf,len,offset);
+}
+
+promise_handle_t promise_fsync(promise_io_handle_t io, int fd)
+{
+    return promise_io_queue((promise_io_t*)io,PROMISE_IO_FSYNC,fd,NULL,0,0);
+}
+
+int promise_io_submit(promise_io_handle_t io_handle)
+{
+    promise_io_t* io = (promise_io_t*)io_handle;
+    if(!io)
+        return -1;
+    if(io->queued == 0)
+        return 0;
+    int submitted = 0;
+#ifdef PROMISE_IO_URING
+    if(io->uring)
+    {
+        /** requests cancelled before submission turn into no-ops */
+        promise_io_ring_t* ring = &io->ring;
+        for(unsigned i=*ring->sq_tail;i != ring->sq_local_tail;i++)
+        {
+            struct io_uring_sqe* sqe = &ring->sqes[i & *ring->sq_mask];
+            if(!((promise_io_request_t*)(uintptr_t)sqe->user_data)->promise)
+                sqe->opcode = IORING_OP_NOP;
+        }
+        int rc = promise_io_ring_submit(ring);
+        if(rc < 0)
+            return -1;
+        submitted = rc;
+        io->queued -= submitted;
+    }
+    else
+#endif
+    {
+        /** requests cancelled before submission are dropped here */
+        promise_io_request_t* head = NULL;
+        promise_io_request_t* tail = NULL;
+        while(io->queue_head)
+        {
+            promise_io_request_t* request = io->queue_head;
+            io->queue_head = request->next;
+            request->next = NULL;
+            if(!request->promise)
+            {
+                promise_io_drop(io,request);
+                continue;
+            }
+            if(tail)
+                tail->next = request;
+            else
+                head = request;
+            tail = request;
+            submitted++;
+        }
+        io->queue_tail = NULL;
+        io->queued = 0;
+        if(head)
+        {
+            pthread_mutex_lock(&io->lock);
+            if(io->work_tail)
+                io->work_tail->next = head;
+            else
+                io->work_head = head;
+            io->work_tail = tail;
+            pthread_cond_broadcast(&io->cond);
+            pthread_mutex_unlock(&io->lock);
+        }
+    }
+    io->in_flight += submitted;
+    if(io->reactor && io->in_flight > 0 && !io->wait)
+        promise_io_watch(io);
+    return submitted;
+}
+
+int promise_io_get_fd(promise_io_handle_t io_handle)
+{
+    promise_io_t* io = (promise_io_t*)io_handle;
+    if(!io)
+        return -1;
+    return io->event_fd;
+}
+
+int promise_io_process(promise_io_handle_t io_handle)
+{
+    promise_io_t* io = (promise_io_t*)io_handle;
+    if(!io)
+        return -1;
+    /** reset the eventfd before taking the completions, a later completion signals it again */
+    uint64_t count = 0;
+    while(read(io->event_fd,&count,sizeof(count)) < 0 && errno == EINTR);
+    promise_io_request_t* completed = NULL;
+#ifdef PROMISE_IO_URING
+    if(io->uring)
+    {
+        /** copy the results out first, settling may queue new requests */
+        promise_io_ring_t* ring = &io->ring;
+        promise_io_request_t* tail = NULL;
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail,__ATOMIC_ACQUIRE);
+        for(;head != cq_tail;head++)
+        {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            promise_io_request_t* request = (promise_io_request_t*)(uintptr_t)cqe->user_data;
+            request->result = cqe->res;
+            request->next = NULL;
+            if(tail)
+                tail->next = request;
+            else
+                completed = request;
+            tail = request;
+        }
+        /** the kernel may reuse the entries from here */
+        __atomic_store_n(ring->cq_head,head,__ATOMIC_RELEASE);
+    }
+    else
+#endif
+    {
+        pthread_mutex_lock(&io->lock);
+        promise_io_request_t* done = io->done;
+        io->done = NULL;
+        pthread_mutex_unlock(&io->lock);
+        /** back to completion order */
+        while(done)
+        {
+            promise_io_request_t* request = done;
+            done = request->next;
+            request->next = completed;
+            completed = request;
+        }
+    }
+    int reaped = 0;
+    while(completed)
+    {
+        promise_io_request_t* request = completed;
+        completed = request->next;
+        io->in_flight--;
+        reaped++;
+        promise_io_settle(io,request);
+    }
+    if(io->wait && io->in_flight == 0)
+    {
+        /** nothing left to wait for, let the loop exit */
+        promise_handle_t wait = io->wait;
+        io->wait = NULL;
+        promise_cancel(io->manager,wait);
+    }
+    return reaped;
+}
+
+static bool promise_io_uses_uring(promise_io_t* io)
+{
+#ifdef PROMISE_IO_URING
+    return io->uring;
+#else
+    return false;
+#endif
+}
+
+static promise_handle_t promise_io_queue(
+    promise_io_t* io, promise_io_op_t op, int fd, void* buf, size_t len, off_t offset)
+{
+    promise_io_request_t* request = NULL;
+    if(!io || fd < 0 || (op != PROMISE_IO_FSYNC && !buf))
+        goto error;
+    request = promise_manager_alloc(io->manager,sizeof(promise_io_request_t));
+    if(!request)
+        goto error;
+    memset(request,0,sizeof(promise_io_request_t));
+    request->op = op;
+    request->fd = fd;
+    request->buf = buf;
+    request->len = len;
+    request->offset = offset;
+    request->promise = promise_new(io->manager);
+    if(!request->promise)
+        goto error;
+#ifdef PROMISE_IO_URING
+    if(io->uring)
+    {
+        struct io_uring_sqe* sqe = promise_io_ring_get_sqe(&io->ring);
+        if(!sqe)
+        {
+            /** the submission queue is full, submit it early */
+            if(promise_io_submit((promise_io_handle_t)io) < 0)
+                goto error;
+            sqe = promise_io_ring_get_sqe(&io->ring);
+            if(!sqe)
+                goto error;
+        }
+        int buf_index = op == PROMISE_IO_FSYNC ? -1 : promise_io_find_buffer(io,buf,len);
+        sqe->fd = fd;
+        sqe->user_data = (uint64_t)(uintptr_t)request;
+        switch(op)
+        {
+        case PROMISE_IO_READ:
+        case PROMISE_IO_WRITE:
+            if(buf_index >= 0)
+            {
+                sqe->opcode = op == PROMISE_IO_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                sqe->buf_index = (uint16_t)buf_index;
+            }
+            else
+                sqe->opcode = op == PROMISE_IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(uintptr_t)buf;
+            sqe->len = (uint32_t)len;
+            sqe->off = (uint64_t)offset;
+            break;
+        case PROMISE_IO_FSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            break;
+        }
+    }
+    else
+#endif
+    {
+        if(io->queue_tail)
+            io->queue_tail->next = request;
+        else
+            io->queue_head = request;
+        io->queue_tail = request;
+    }
+    io->queued++;
+    promise_set_cancel_handler(io->manager,request->promise,promise_io_cancelled,request);
+    return request->promise;
+error:
+    if(request)
+    {
+        if(request->promise)
+            promise_destroy(io->manager,request->promise);
+        promise_manager_release(io->manager,request,sizeof(promise_io_request_t));
+    }
+    return NULL;
+}
+
+static void promise_io_settle(promise_io_t* io, promise_io_request_t* request)
+{
+    promise_handle_t promise = request->promise;
+    ssize_t result = request->result;
+    promise_manager_release(io->manager,request,sizeof(promise_io_request_t));
+    if(!promise)
+        return;
+    if(result >= 0)
+        promise_resolve(io->manager,promise,(promise_data_t){.number=result},NULL,NULL);
+    else
+        promise_reject(io->manager,promise,(promise_data_t){.number=-result},NULL,NULL);
+}
+
+/** release a request without settling it */
+static void promise_io_drop(promise_io_t* io, promise_io_request_t* request)
+{
+    if(request->promise)
+        promise_set_cancel_handler(io->manager,request->promise,NULL,NULL);
+    promise_manager_release(io->manager,request,sizeof(promise_io_request_t));
+}
+
+static void promise_io_cancelled(void* ctx)
+{
+    /** the request may be in the kernel or on a worker, it is released once it completes */
+    promise_io_request_t* request = (promise_io_request_t*)ctx;
+    request->promise = NULL;
+}
+
+static void promise_io_prepare(void* ctx)
+{
+    promise_io_submit((promise_io_handle_t)ctx);
+}
+
+static void promise_io_watch(promise_io_t* io)
+{
+    io->wait = promise_fd_readable(io->reactor,io->event_fd);
+    if(io->wait)
+        promise_await(io->manager,io->wait,promise_io_ready,io,false,promise_io_ready_error,io,false);
+}
+
+static void promise_io_ready(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    promise_io_t* io = (promise_io_t*)ctx;
+    io->wait = NULL;
+    promise_io_process((promise_io_handle_t)io);
+    if(io->in_flight > 0 && !io->wait)
+        promise_io_watch(io);
+}
+
+static void promise_io_ready_error(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    /** the eventfd was removed from the reactor */
+    promise_io_t* io = (promise_io_t*)ctx;
+    io->wait = NULL;
+}
+
+static void* promise_io_worker_main(void* arg)
+{
+    promise_io_t* io = (promise_io_t*)arg;
+    pthread_mutex_lock(&io->lock);
+    while(true)
+    {
+        while(!io->work_head && !io->stop)
+            pthread_cond_wait(&io->cond,&io->lock);
+        promise_io_request_t* request = io->work_head;
+        if(!request)
+            break;
+        io->work_head = request->next;
+        if(!io->work_head)
+            io->work_tail = NULL;
+        pthread_mutex_unlock(&io->lock);
+
+        ssize_t rc = 0;
+        switch(request->op)
+        {
+        case PROMISE_IO_READ:
+            rc = pread(request->fd,request->buf,request->len,request->offset);
+            break;
+        case PROMISE_IO_WRITE:
+            rc = pwrite(request->fd,request->buf,request->len,request->offset);
+            break;
+        case PROMISE_IO_FSYNC:
+            rc = fsync(request->fd);
+            break;
+        }
+        request->result = rc < 0 ? -errno : rc;
+
+        pthread_mutex_lock(&io->lock);
+        /** one signal per batch, the owner takes the whole list at once */
+        bool signal = io->done == NULL;
+        request->next = io->done;
+        io->done = request;
+        if(signal)
+        {
+            uint64_t one = 1;
+            while(write(io->event_fd,&one,sizeof(one)) < 0 && errno == EINTR);
+        }
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+#ifdef PROMISE_IO_URING
+static int promise_io_find_buffer(promise_io_t* io, const void* buf, size_t len)
+{
+    for(int i=0;i<io->buffer_count;i++)
+    {
+        const char* base = (const char*)io->buffers[i].iov_base;
+        if((const char*)buf >= base && (const char*)buf + len <= base + io->buffers[i].iov_len)
+            return i;
+    }
+    return -1;
+}
+
+/** io_uring ****************************************/
+
+static int promise_io_ring_init(promise_io_ring_t* ring, unsigned entries)
+{
+    memset(ring,0,sizeof(promise_io_ring_t));
+    struct io_uring_params params;
+    memset(&params,0,sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup,entries,&params);
+    if(ring->fd < 0)
+        return -1;
+    ring->entries = params.sq_entries;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_map_size > ring->sq_map_size)
+            ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->sq_map = mmap(NULL,ring->sq_map_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+        ring->fd,IORING_OFF_SQ_RING);
+    if(ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = NULL;
+        goto error;
+    }
+    char* cq_base = ring->sq_map;
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_map = mmap(NULL,ring->cq_map_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+            ring->fd,IORING_OFF_CQ_RING);
+        if(ring->cq_map == MAP_FAILED)
+        {
+            ring->cq_map = NULL;
+            goto error;
+        }
+        cq_base = ring->cq_map;
+    }
+    ring->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL,ring->sqes_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+        ring->fd,IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        goto error;
+    }
+    char* sq_base = ring->sq_map;
+    ring->sq_head = (unsigned*)(sq_base + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq_base + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq_base + params.sq_off.ring_mask);
+    ring->sq_local_tail = *ring->sq_tail;
+    /** entry i of the ring always points at sqe i */
+    unsigned* array = (unsigned*)(sq_base + params.sq_off.array);
+    for(unsigned i=0;i<params.sq_entries;i++)
+        array[i] = i;
+    ring->cq_head = (unsigned*)(cq_base + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq_base + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq_base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq_base + params.cq_off.cqes);
+    return 0;
+error:
+    promise_io_ring_exit(ring);
+    return -1;
+}
+
+static void promise_io_ring_exit(promise_io_ring_t* ring)
+{
+    if(ring->sqes)
+        munmap(ring->sqes,ring->sqes_size);
+    if(ring->cq_map)
+        munmap(ring->cq_map,ring->cq_map_size);
+    if(ring->sq_map)
+        munmap(ring->sq_map,ring->sq_map_size);
+    if(ring->fd >= 0)
+        close(ring->fd);
+    memset(ring,0,sizeof(promise_io_ring_t));
+    ring->fd = -1;
+}
+
+static struct io_uring_sqe* promise_io_ring_get_sqe(promise_io_ring_t* ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head,__ATOMIC_ACQUIRE);
+    if(ring->sq_local_tail - head >= ring->entries)
+        return NULL;
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+    memset(sqe,0,sizeof(struct io_uring_sqe));
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/** publish the prepared entries and hand them to the kernel */
+static int promise_io_ring_submit(promise_io_ring_t* ring)
+{
+    __atomic_store_n(ring->sq_tail,ring->sq_local_tail,__ATOMIC_RELEASE);
+    unsigned pending = ring->sq_local_tail - __atomic_load_n(ring->sq_head,__ATOMIC_ACQUIRE);
+    if(pending == 0)
+        return 0;
+    int rc;
+    while((rc = (int)syscall(__NR_io_uring_enter,ring->fd,pending,0,0,NULL,0)) < 0 && errno == EINTR);
+    return rc;
+}
+
+static int promise_io_ring_wait(promise_io_ring_t* ring)
+{
+    int rc;
+    while((rc = (int)syscall(__NR_io_uring_enter,ring->fd,0,1,IORING_ENTER_GETEVENTS,NULL,0)) < 0 && errno == EINTR);
+    return rc;
+}
+
+static int promise_io_ring_register(promise_io_ring_t* ring, unsigned opcode, const void* arg, unsigned count)
+{
+    return syscall(__NR_io_uring_register,ring->fd,opcode,arg,count) < 0 ? -1 : 0;
+}
+#endif
@@ -0,0 +1,127 @@
+#ifndef __PROMISE_IO_H
+#define __PROMISE_IO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "promise.h"
+#include "promise_reactor.h"
+
+typedef void* promise_io_handle_t;
+
+typedef struct
+{
+    /** io_uring submission queue entries, 0 for 256 */
+    unsigned queue_depth;
+    /** worker threads used when io_uring is unavailable, 0 for 4 */
+    int threads;
+} promise_io_options_t;
+
+/**
+ * @brief Create an asynchronous file io queue for a manager.
+ * Built with -DPROMISE_IO_URING, requests go through io_uring, driven by its syscalls directly.
+ * Otherwise, or if the kernel refuses io_uring, they run on a pool of worker threads.
+ * Requests are batched and submitted together once per loop iteration,
+ * completions are reaped in bulk and settle their promises on the owner thread.
+ *
+ * @param manager not nullable, owned by the calling thread
+ * @param reactor nullable. If set, submission and reaping are driven by its loop.
+ * Otherwise call promise_io_submit and promise_io_process yourself.
+ * @param options nullable for the defaults
+ * @return promise_io_handle_t or NULL on error
+ */
+promise_io_handle_t promise_io_new(
+    promise_manager_handle_t manager, promise_reactor_handle_t reactor,
+    const promise_io_options_t* options);
+
+/**
+ * @brief Wait for the requests in flight, then free the io queue. Free it before the manager.
+ * Promises of unfinished requests are left pending.
+ *
+ * @param io
+ */
+void promise_io_free(promise_io_handle_t io);
+
+/**
+ * @brief Get the name of the backend in use.
+ *
+ * @param io
+ * @return const char* "io_uring" or "threads"
+ */
+const char* promise_io_backend(promise_io_handle_t io);
+
+/**
+ * @brief Register buffers once for zero copy io. Can only be called once.
+ * Reads and writes fully inside a registered buffer use it automatically.
+ * The buffers MUST stay valid until promise_io_free.
+ *
+ * @param io
+ * @param iovecs
+ * @param count
+ * @return int 0 on success, -1 on error
+ */
+int promise_io_register_buffers(promise_io_handle_t io, const struct iovec* iovecs, int count);
+
+/**
+ * @brief Read from fd at offset.
+ * The promise is resolved with the number of bytes read as data.number, which can be short,
+ * or rejected with the errno as reason.number.
+ * Cancelling it drops the result, but a request already submitted still reads into buf:
+ * buf MUST stay valid until the request completes or promise_io_free returns.
+ *
+ * @param io
+ * @param fd
+ * @param buf
+ * @param len
+ * @param offset
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_read(promise_io_handle_t io, int fd, void* buf, size_t len, off_t offset);
+
+/**
+ * @brief Write to fd at offset. See promise_read.
+ *
+ * @param io
+ * @param fd
+ * @param buf
+ * @param len
+ * @param offset
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_write(promise_io_handle_t io, int fd, const void* buf, size_t len, off_t offset);
+
+/**
+ * @brief Flush fd to storage.
+ * The promise is resolved with 0 as data.number, or rejected with the errno as reason.number.
+ *
+ * @param io
+ * @param fd
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_fsync(promise_io_handle_t io, int fd);
+
+/**
+ * @brief Submit all the queued requests at once. The reactor calls it before polling.
+ *
+ * @param io
+ * @return int number of requests submitted, -1 on error
+ */
+int promise_io_submit(promise_io_handle_t io);
+
+/**
+ * @brief Get the eventfd signaled when requests complete.
+ * Poll it for readability and call promise_io_process.
+ *
+ * @param io
+ * @return int the fd or -1 on error
+ */
+int promise_io_get_fd(promise_io_handle_t io);
+
+/**
+ * @brief Reap all the completed requests and settle their promises.
+ *
+ * @param io
+ * @return int number of requests reaped, -1 on error
+ */
+int promise_io_process(promise_io_handle_t io);
+
+#endif
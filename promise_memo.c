@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "promise_memo.h"
+
+#define PROMISE_MEMO_DEFAULT_CAPACITY 1024
+#define PROMISE_MEMO_INITIAL_BUCKETS 64
+/** waiters of a call in flight kept in the entry before spilling to a heap buffer */
+#define PROMISE_MEMO_INLINE_WAITERS 4
+
+typedef struct promise_memo_s promise_memo_t;
+
+/** Allocated from the manager with the key right after it. */
+typedef struct promise_memo_entry_s
+{
+    struct promise_memo_entry_s* bucket_next;
+    /** in the cached list once resolved, in the in flight list before */
+    struct promise_memo_entry_s* prev;
+    struct promise_memo_entry_s* next;
+    promise_memo_t* memo;
+    uint64_t hash;
+    bool in_table;                  /** false once invalidated */
+    bool resolved;                  /** value is cached */
+    promise_handle_t source;        /** the call of func in flight */
+    promise_value_t value;
+    uint64_t expires_ms;
+    promise_handle_t* waiters;      /** inline_waiters or a heap buffer once it is full */
+    int waiter_count;
+    int waiter_capacity;
+    promise_handle_t inline_waiters[PROMISE_MEMO_INLINE_WAITERS];
+    size_t size;
+    size_t key_len;
+    uint8_t key[];
+} promise_memo_entry_t;
+
+typedef struct
+{
+    promise_memo_entry_t* head;
+    promise_memo_entry_t* tail;
+} promise_memo_list_t;
+
+struct promise_memo_s
+{
+    promise_manager_handle_t manager;
+    promise_memo_func_t func;
+    void* func_ctx;
+    promise_memo_options_t options;
+    promise_memo_entry_t** buckets;
+    size_t bucket_count;
+    size_t entry_count;             /** in the table */
+    promise_memo_list_t cached;     /** most recently used first */
+    size_t cached_count;
+    promise_memo_list_t in_flight;
+};
+
+static uint64_t promise_memo_hash(const void* key, size_t key_len);
+static promise_memo_entry_t* promise_memo_find(promise_memo_t* memo, uint64_t hash, const void* key, size_t key_len);
+static int promise_memo_table_add(promise_memo_t* memo, promise_memo_entry_t* entry);
+static void promise_memo_table_remove(promise_memo_t* memo, promise_memo_entry_t* entry);
+static void promise_memo_list_push(promise_memo_list_t* list, promise_memo_entry_t* entry);
+static void promise_memo_list_remove(promise_memo_list_t* list, promise_memo_entry_t* entry);
+static promise_memo_entry_t* promise_memo_entry_new(promise_memo_t* memo, uint64_t hash, const void* key, size_t key_len);
+static void promise_memo_entry_free(promise_memo_t* memo, promise_memo_entry_t* entry);
+static void promise_memo_evict(promise_memo_t* memo, promise_memo_entry_t* entry);
+static void promise_memo_abandon(promise_memo_t* memo, promise_memo_entry_t* entry);
+static int promise_memo_add_waiter(promise_memo_entry_t* entry, promise_handle_t promise);
+static void promise_memo_waiter_freed(promise_handle_t promise, void* ctx);
+static int promise_memo_copy(promise_memo_t* memo, const promise_value_t* value, promise_value_t* copy);
+static void promise_memo_settled(promise_memo_entry_t* entry, promise_value_t value);
+static void promise_memo_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx);
+static void promise_memo_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx);
+
+promise_memo_handle_t promise_memo_new(
+    promise_manager_handle_t manager, promise_memo_func_t func, void* ctx,
+    const promise_memo_options_t* options)
+{
+    promise_memo_t* memo = NULL;
+    if(!manager || !func)
+        goto error;
+    memo = malloc(sizeof(promise_memo_t));
+    if(!memo)
+        goto error;
+    memset(memo,0,sizeof(promise_memo_t));
+    memo->manager = manager;
+    memo->func = func;
+    memo->func_ctx = ctx;
+    if(options)
+        memo->options = *options;
+    if(memo->options.capacity == 0)
+        memo->options.capacity = PROMISE_MEMO_DEFAULT_CAPACITY;
+    memo->buckets = calloc(PROMISE_MEMO_INITIAL_BUCKETS,sizeof(promise_memo_entry_t*));
+    if(!memo->buckets)
+        goto error;
+    memo->bucket_count = PROMISE_MEMO_INITIAL_BUCKETS;
+    return (promise_memo_handle_t)memo;
+error:
+    promise_memo_free((promise_memo_handle_t)memo);
+    return NULL;
+}
+
+void promise_memo_free(promise_memo_handle_t memo_handle)
+{
+    promise_memo_t* memo = (promise_memo_t*)memo_handle;
+    if(!memo)
+        return;
+    while(memo->cached.head)
+        promise_memo_evict(memo,memo->cached.head);
+    while(memo->in_flight.head)
+    {
+        promise_memo_entry_t* entry = memo->in_flight.head;
+        promise_memo_list_remove(&memo->in_flight,entry);
+        if(entry->in_table)
+            promise_memo_table_remove(memo,entry);
+        promise_cancel(memo->manager,entry->source);
+        for(int i=0;i<entry->waiter_count;i++)
+        {
+            promise_set_free_handler(memo->manager,entry->waiters[i],NULL,NULL);
+            promise_cancel(memo->manager,entry->waiters[i]);
+        }
+        promise_memo_entry_free(memo,entry);
+    }
+    free(memo->buckets);
+    free(memo);
+}
+
+promise_handle_t promise_memo_get(promise_memo_handle_t memo_handle, const void* key, size_t key_len)
+{
+    promise_memo_t* memo = (promise_memo_t*)memo_handle;
+    if(!memo || (!key && key_len))
+        return NULL;
+    uint64_t hash = promise_memo_hash(key,key_len);
+    promise_memo_entry_t* entry = promise_memo_find(memo,hash,key,key_len);
+    if(entry && entry->resolved && promise_manager_now(memo->manager) >= entry->expires_ms)
+    {
+        promise_memo_evict(memo,entry);
+        entry = NULL;
+    }
+    promise_handle_t promise = promise_new(memo->manager);
+    if(!promise)
+        return NULL;
+    if(entry && entry->resolved)
+    {
+        /** cache hit, no handler is attached yet so nothing runs here */
+        promise_memo_list_remove(&memo->cached,entry);
+        promise_memo_list_push(&memo->cached,entry);
+        promise_value_t copy;
+        if(promise_memo_copy(memo,&entry->value,&copy) != 0)
+            goto error;
+        promise_resolve(memo->manager,promise,copy.data,copy.free_data,copy.free_ctx);
+        return promise;
+    }
+    if(entry)
+    {
+        /** single flight, wait for the call already running */
+        if(promise_memo_add_waiter(entry,promise) != 0)
+            goto error;
+        if(promise_set_free_handler(memo->manager,promise,promise_memo_waiter_freed,entry) != 0)
+        {
+            entry->waiter_count--;
+            goto error;
+        }
+        return promise;
+    }
+    entry = promise_memo_entry_new(memo,hash,key,key_len);
+    if(!entry)
+        goto error;
+    if(promise_memo_table_add(memo,entry) != 0)
+    {
+        promise_memo_entry_free(memo,entry);
+        goto error;
+    }
+    promise_memo_list_push(&memo->in_flight,entry);
+    promise_memo_add_waiter(entry,promise);
+    if(promise_set_free_handler(memo->manager,promise,promise_memo_waiter_freed,entry) != 0)
+    {
+        promise_memo_abandon(memo,entry);
+        return NULL;
+    }
+    entry->source = memo->func(entry->key,entry->key_len,memo->func_ctx);
+    if(!entry->source)
+    {
+        promise_memo_abandon(memo,entry);
+        return NULL;
+    }
+    /** the entry may be gone when this returns, if source is settled already */
+    if(promise_await(
+        memo->manager,entry->source,
+        promise_memo_then,entry,true,
+        promise_memo_catch,entry,true) != 0)
+    {
+        promise_cancel(memo->manager,entry->source);
+        promise_memo_abandon(memo,entry);
+        return NULL;
+    }
+    return promise;
+error:
+    promise_destroy(memo->manager,promise);
+    return NULL;
+}
+
+int promise_memo_invalidate(promise_memo_handle_t memo_handle, const void* key, size_t key_len)
+{
+    promise_memo_t* memo = (promise_memo_t*)memo_handle;
+    if(!memo || (!key && key_len))
+        return -1;
+    promise_memo_entry_t* entry = promise_memo_find(memo,promise_memo_hash(key,key_len),key,key_len);
+    if(!entry)
+        return -1;
+    if(entry->resolved)
+        promise_memo_evict(memo,entry);
+    else
+        promise_memo_table_remove(memo,entry);
+    return 0;
+}
+
+/** FNV-1a */
+static uint64_t promise_memo_hash(const void* key, size_t key_len)
+{
+    const uint8_t* bytes = key;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i=0;i<key_len;i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static promise_memo_entry_t* promise_memo_find(promise_memo_t* memo, uint64_t hash, const void* key, size_t key_len)
+{
+    promise_memo_entry_t* entry = memo->buckets[hash & (memo->bucket_count - 1)];
+    for(;entry;entry = entry->bucket_next)
+    {
+        if(entry->hash == hash && entry->key_len == key_len && memcmp(entry->key,key,key_len) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static int promise_memo_table_add(promise_memo_t* memo, promise_memo_entry_t* entry)
+{
+    if(memo->entry_count >= memo->bucket_count)
+    {
+        size_t bucket_count = memo->bucket_count*2;
+        promise_memo_entry_t** buckets = calloc(bucket_count,sizeof(promise_memo_entry_t*));
+        if(!buckets)
+            return -1;
+        for(size_t i=0;i<memo->bucket_count;i++)
+        {
+            promise_memo_entry_t* old = memo->buckets[i];
+            while(old)
+            {
+                promise_memo_entry_t* next = old->bucket_next;
+                promise_memo_entry_t** bucket = &buckets[old->hash & (bucket_count - 1)];
+                old->bucket_next = *bucket;
+                *bucket = old;
+                old = next;
+            }
+        }
+        free(memo->buckets);
+        memo->buckets = buckets;
+        memo->bucket_count = bucket_count;
+    }
+    promise_memo_entry_t** bucket = &memo->buckets[entry->hash & (memo->bucket_count - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    entry->in_table = true;
+    memo->entry_count++;
+    return 0;
+}
+
+static void promise_memo_table_remove(promise_memo_t* memo, promise_memo_entry_t* entry)
+{
+    promise_memo_entry_t** link = &memo->buckets[entry->hash & (memo->bucket_count - 1)];
+    while(*link != entry)
+        link = &(*link)->bucket_next;
+    *link = entry->bucket_next;
+    entry->bucket_next = NULL;
+    entry->in_table = false;
+    memo->entry_count--;
+}
+
+static void promise_memo_list_push(promise_memo_list_t* list, promise_memo_entry_t* entry)
+{
+    entry->prev = NULL;
+    entry->next = list->head;
+    if(list->head)
+        list->head->prev = entry;
+    else
+        list->tail = entry;
+    list->head = entry;
+}
+
+static void promise_memo_list_remove(promise_memo_list_t* list, promise_memo_entry_t* entry)
+{
+    if(entry->prev)
+        entry->prev->next = entry->next;
+    else
+        list->head = entry->next;
+    if(entry->next)
+        entry->next->prev = entry->prev;
+    else
+        list->tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static promise_memo_entry_t* promise_memo_entry_new(promise_memo_t* memo, uint64_t hash, const void* key, size_t key_len)
+{
+    size_t size = sizeof(promise_memo_entry_t) + key_len;
+    promise_memo_entry_t* entry = promise_manager_alloc(memo->manager,size);
+    if(!entry)
+        return NULL;
+    memset(entry,0,sizeof(promise_memo_entry_t));
+    entry->memo = memo;
+    entry->hash = hash;
+    entry->waiters = entry->inline_waiters;
+    entry->waiter_capacity = PROMISE_MEMO_INLINE_WAITERS;
+    entry->size = size;
+    entry->key_len = key_len;
+    if(key_len)
+        memcpy(entry->key,key,key_len);
+    return entry;
+}
+
+/** the entry MUST be out of the table and the lists */
+static void promise_memo_entry_free(promise_memo_t* memo, promise_memo_entry_t* entry)
+{
+    if(entry->resolved && entry->value.free_data)
+        entry->value.free_data(entry->value.data.ptr,entry->value.free_ctx);
+    if(entry->waiters != entry->inline_waiters)
+        free(entry->waiters);
+    promise_manager_release(memo->manager,entry,entry->size);
+}
+
+static void promise_memo_evict(promise_memo_t* memo, promise_memo_entry_t* entry)
+{
+    if(entry->in_table)
+        promise_memo_table_remove(memo,entry);
+    promise_memo_list_remove(&memo->cached,entry);
+    memo->cached_count--;
+    promise_memo_entry_free(memo,entry);
+}
+
+/** func failed, drop the entry with everyone waiting for it */
+static void promise_memo_abandon(promise_memo_t* memo, promise_memo_entry_t* entry)
+{
+    if(entry->in_table)
+        promise_memo_table_remove(memo,entry);
+    promise_memo_list_remove(&memo->in_flight,entry);
+    for(int i=0;i<entry->waiter_count;i++)
+    {
+        promise_set_free_handler(memo->manager,entry->waiters[i],NULL,NULL);
+        promise_destroy(memo->manager,entry->waiters[i]);
+    }
+    promise_memo_entry_free(memo,entry);
+}
+
+static int promise_memo_add_waiter(promise_memo_entry_t* entry, promise_handle_t promise)
+{
+    if(entry->waiter_count == entry->waiter_capacity)
+    {
+        int capacity = entry->waiter_capacity*2;
+        promise_handle_t* waiters = malloc(sizeof(promise_handle_t)*capacity);
+        if(!waiters)
+            return -1;
+        memcpy(waiters,entry->waiters,sizeof(promise_handle_t)*entry->waiter_count);
+        if(entry->waiters != entry->inline_waiters)
+            free(entry->waiters);
+        entry->waiters = waiters;
+        entry->waiter_capacity = capacity;
+    }
+    entry->waiters[entry->waiter_count++] = promise;
+    return 0;
+}
+
+/**
+ * A waiter was cancelled or destroyed before the value arrived, forget it.
+ * Once the last one is gone nobody wants the value, the call is cancelled and the entry dropped.
+ */
+static void promise_memo_waiter_freed(promise_handle_t promise, void* ctx)
+{
+    promise_memo_entry_t* entry = (promise_memo_entry_t*)ctx;
+    promise_memo_t* memo = entry->memo;
+    for(int i=0;i<entry->waiter_count;i++)
+    {
+        if(entry->waiters[i] != promise)
+            continue;
+        memmove(&entry->waiters[i],&entry->waiters[i+1],sizeof(promise_handle_t)*(entry->waiter_count - i - 1));
+        entry->waiter_count--;
+        break;
+    }
+    /** no source yet while func runs, the entry is settled or abandoned after it */
+    if(entry->waiter_count > 0 || !entry->source)
+        return;
+    promise_handle_t source = entry->source;
+    if(entry->in_table)
+        promise_memo_table_remove(memo,entry);
+    promise_memo_list_remove(&memo->in_flight,entry);
+    promise_memo_entry_free(memo,entry);
+    /** the entry is gone first, the cancel handler may look the key up again */
+    promise_cancel(memo->manager,source);
+}
+
+static int promise_memo_copy(promise_memo_t* memo, const promise_value_t* value, promise_value_t* copy)
+{
+    if(!memo->options.copy)
+    {
+        *copy = (promise_value_t){.data = value->data,.rejected = value->rejected};
+        return 0;
+    }
+    *copy = (promise_value_t){.data.ptr = NULL};
+    if(memo->options.copy(value,copy,memo->options.copy_ctx) != 0)
+        return -1;
+    copy->rejected = value->rejected;
+    return 0;
+}
+
+/**
+ * Every waiter gets its own copy and owns it, so each may take its value over.
+ * The copies are made before settling anyone: a waiter handler may invalidate,
+ * evict or look the key up again, after that only locals are used.
+ */
+static void promise_memo_settled(promise_memo_entry_t* entry, promise_value_t value)
+{
+    promise_memo_t* memo = entry->memo;
+    promise_manager_handle_t manager = memo->manager;
+    promise_memo_list_remove(&memo->in_flight,entry);
+    entry->source = NULL;
+    int count = entry->waiter_count;
+    /** settling frees the waiters, they are handed over below */
+    for(int i=0;i<count;i++)
+        promise_set_free_handler(manager,entry->waiters[i],NULL,NULL);
+    promise_handle_t inline_waiters[PROMISE_MEMO_INLINE_WAITERS];
+    promise_handle_t* waiters = entry->waiters;
+    if(waiters == entry->inline_waiters)
+    {
+        memcpy(inline_waiters,waiters,sizeof(promise_handle_t)*count);
+        waiters = inline_waiters;
+    }
+    entry->waiters = entry->inline_waiters;
+    entry->waiter_count = 0;
+    entry->waiter_capacity = PROMISE_MEMO_INLINE_WAITERS;
+    promise_value_t inline_copies[PROMISE_MEMO_INLINE_WAITERS];
+    promise_value_t* copies = inline_copies;
+    if(count > PROMISE_MEMO_INLINE_WAITERS)
+        copies = malloc(sizeof(promise_value_t)*count);
+    for(int i=0;copies && i<count;i++)
+    {
+        if(promise_memo_copy(memo,&value,&copies[i]) != 0)
+            copies[i] = (promise_value_t){.data.ptr = NULL,.rejected = true};
+    }
+    bool cached = !value.rejected && entry->in_table;
+    if(cached)
+    {
+        entry->resolved = true;
+        entry->value = value;
+        entry->expires_ms = memo->options.ttl_ms ?
+            promise_manager_now(manager) + memo->options.ttl_ms : UINT64_MAX;
+        promise_memo_list_push(&memo->cached,entry);
+        memo->cached_count++;
+        while(memo->cached_count > memo->options.capacity)
+            promise_memo_evict(memo,memo->cached.tail);
+    }
+    else
+    {
+        if(entry->in_table)
+            promise_memo_table_remove(memo,entry);
+        promise_memo_entry_free(memo,entry);
+    }
+    for(int i=0;i<count;i++)
+    {
+        if(!copies)
+        {
+            promise_reject(manager,waiters[i],(promise_data_t){.ptr = NULL},NULL,NULL);
+            continue;
+        }
+        int result = copies[i].rejected ?
+            promise_reject(manager,waiters[i],copies[i].data,copies[i].free_data,copies[i].free_ctx) :
+            promise_resolve(manager,waiters[i],copies[i].data,copies[i].free_data,copies[i].free_ctx);
+        /** the waiter is gone, destroyed or cancelled */
+        if(result != 0 && copies[i].free_data)
+            copies[i].free_data(copies[i].data.ptr,copies[i].free_ctx);
+    }
+    if(!cached && value.free_data)
+        value.free_data(value.data.ptr,value.free_ctx);
+    if(copies != inline_copies)
+        free(copies);
+    if(waiters != inline_waiters)
+        free(waiters);
+}
+
+static void promise_memo_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    promise_memo_settled((promise_memo_entry_t*)ctx,
+        (promise_value_t){.data = data,.free_data = free_ptr,.free_ctx = free_ctx,.rejected = false});
+}
+
+static void promise_memo_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    promise_memo_settled((promise_memo_entry_t*)ctx,
+        (promise_value_t){.data = reason,.free_data = free_ptr,.free_ctx = free_ctx,.rejected = true});
+}
@@ -0,0 +1,85 @@
+#ifndef __PROMISE_MEMO_H
+#define __PROMISE_MEMO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "promise.h"
+
+typedef void* promise_memo_handle_t;
+
+/**
+ * @brief Start the work for a key. The memo owns the returned promise,
+ * DO NOT await, destroy or cancel it.
+ */
+typedef promise_handle_t(*promise_memo_func_t)(const void* key, size_t key_len, void* ctx);
+
+/**
+ * @brief Copy a settled value for one waiter. copy is owned by the waiter, value stays with the memo.
+ * It MUST NOT call into the memo.
+ *
+ * @return int 0 on success, -1 rejects the waiter with a NULL reason
+ */
+typedef int(*promise_memo_copy_t)(const promise_value_t* value, promise_value_t* copy, void* ctx);
+
+typedef struct
+{
+    /** resolved values kept, the least recently used is evicted first. 0 for 1024 */
+    size_t capacity;
+    /** how long a resolved value is served, in promise_manager_now ms. 0 never expires */
+    uint64_t ttl_ms;
+    /**
+     * nullable. Without it every waiter gets the data itself and no free function,
+     * only use that for values that own nothing, like numbers.
+     */
+    promise_memo_copy_t copy;
+    void* copy_ctx;
+} promise_memo_options_t;
+
+/**
+ * @brief Create a single flight cache in front of func.
+ * Concurrent lookups of a key share one call of func, resolved values are cached.
+ * Rejections are handed to the waiters of that call but never cached.
+ *
+ * @param manager not nullable
+ * @param func not nullable
+ * @param ctx ctx for func
+ * @param options nullable for the defaults
+ * @return promise_memo_handle_t or NULL on error
+ */
+promise_memo_handle_t promise_memo_new(
+    promise_manager_handle_t manager, promise_memo_func_t func, void* ctx,
+    const promise_memo_options_t* options);
+
+/**
+ * @brief Free the memo before the manager.
+ * Work in flight is cancelled, so are the promises waiting for it.
+ *
+ * @param memo
+ */
+void promise_memo_free(promise_memo_handle_t memo);
+
+/**
+ * @brief Look a key up. Each call returns its own promise, the caller may take its value over.
+ * A cached value settles it right away. Otherwise it waits for the call of func in flight,
+ * or for a new one. Once every promise waiting for a call is cancelled or destroyed,
+ * the call is cancelled too.
+ *
+ * @param memo
+ * @param key bytes, copied
+ * @param key_len
+ * @return promise_handle_t or NULL on error
+ */
+promise_handle_t promise_memo_get(promise_memo_handle_t memo, const void* key, size_t key_len);
+
+/**
+ * @brief Forget a key. The next lookup calls func again.
+ * A call in flight still settles the promises already waiting for it.
+ *
+ * @param memo
+ * @param key
+ * @param key_len
+ * @return int 0 if the key was known, -1 otherwise
+ */
+int promise_memo_invalidate(promise_memo_handle_t memo, const void* key, size_t key_len);
+
+#endif
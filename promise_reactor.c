@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "promise_reactor.h"
+
+/** fd entries are allocated in chunks so they never move, see promise_reactor_fd_t */
+#define PROMISE_REACTOR_CHUNK_BITS 8
+#define PROMISE_REACTOR_CHUNK_LENGTH (1<<PROMISE_REACTOR_CHUNK_BITS)
+#define PROMISE_REACTOR_CHUNK_MASK (PROMISE_REACTOR_CHUNK_LENGTH - 1)
+#define PROMISE_REACTOR_MAX_EVENTS 256
+/** epoll data of the remote settle eventfd of the manager */
+#define PROMISE_REACTOR_REMOTE_TAG UINT64_MAX
+
+typedef struct promise_reactor_s promise_reactor_t;
+
+typedef struct
+{
+    promise_reactor_prepare_t prepare;
+    void* ctx;
+} promise_reactor_prepare_entry_t;
+
+/**
+ * State of one fd. The fd stays registered with epoll until promise_reactor_remove.
+ * Edges seen while nobody waits are kept until the next await.
+ */
+typedef struct
+{
+    promise_reactor_t* reactor;
+    int fd;
+    bool registered;
+    bool readable;                  /** a readable edge was not handed out yet */
+    bool writable;                  /** a writable edge was not handed out yet */
+    promise_handle_t read_waiter;
+    promise_handle_t write_waiter;
+} promise_reactor_fd_t;
+
+struct promise_reactor_s
+{
+    promise_manager_handle_t manager;
+    int epoll_fd;
+    int remote_fd;
+    promise_reactor_fd_t** chunks;
+    int chunk_count;
+    int waiters;                    /** pending fd promises */
+    bool stop;
+    promise_reactor_prepare_entry_t* prepares;
+    int prepare_count;
+    int prepare_capacity;
+    struct epoll_event events[PROMISE_REACTOR_MAX_EVENTS];
+};
+
+const char promise_fd_removed_reason[] = "fd removed";
+
+static uint64_t promise_reactor_now_ms();
+static promise_reactor_fd_t* promise_reactor_get_fd(promise_reactor_t* reactor, int fd, bool create);
+static promise_handle_t promise_reactor_wait(promise_reactor_t* reactor, int fd, bool write);
+static void promise_reactor_ready(promise_reactor_t* reactor, promise_reactor_fd_t* entry, bool write);
+static void promise_reactor_waiter_freed(promise_handle_t promise, void* ctx);
+static void promise_reactor_run_prepares(promise_reactor_t* reactor);
+
+promise_reactor_handle_t promise_reactor_new(promise_manager_handle_t manager)
+{
+    promise_reactor_t* reactor = NULL;
+    if(!manager)
+        goto error;
+    reactor = malloc(sizeof(promise_reactor_t));
+    if(!reactor)
+        goto error;
+    memset(reactor,0,sizeof(promise_reactor_t));
+    reactor->manager = manager;
+    reactor->remote_fd = -1;
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(reactor->epoll_fd < 0)
+        goto error;
+    int remote_fd = promise_manager_get_fd(manager);
+    if(remote_fd >= 0)
+    {
+        struct epoll_event event = {.events = EPOLLIN, .data.u64 = PROMISE_REACTOR_REMOTE_TAG};
+        if(epoll_ctl(reactor->epoll_fd,EPOLL_CTL_ADD,remote_fd,&event) != 0)
+            goto error;
+        reactor->remote_fd = remote_fd;
+    }
+    return (promise_reactor_handle_t)reactor;
+error:
+    promise_reactor_free((promise_reactor_handle_t)reactor);
+    return NULL;
+}
+
+void promise_reactor_free(promise_reactor_handle_t reactor_handle)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(reactor)
+    {
+        if(reactor->epoll_fd >= 0)
+            close(reactor->epoll_fd);
+        for(int i=0;i<reactor->chunk_count;i++)
+        {
+            if(!reactor->chunks[i])
+                continue;
+            /** pending promises outlive the reactor, their free handlers must not */
+            for(int j=0;j<PROMISE_REACTOR_CHUNK_LENGTH;j++)
+            {
+                if(reactor->chunks[i][j].read_waiter)
+                    promise_set_free_handler(reactor->manager,reactor->chunks[i][j].read_waiter,NULL,NULL);
+                if(reactor->chunks[i][j].write_waiter)
+                    promise_set_free_handler(reactor->manager,reactor->chunks[i][j].write_waiter,NULL,NULL);
+            }
+            free(reactor->chunks[i]);
+        }
+        free(reactor->chunks);
+        free(reactor->prepares);
+        free(reactor);
+    }
+}
+
+promise_handle_t promise_fd_readable(promise_reactor_handle_t reactor, int fd)
+{
+    return promise_reactor_wait((promise_reactor_t*)reactor,fd,false);
+}
+
+promise_handle_t promise_fd_writable(promise_reactor_handle_t reactor, int fd)
+{
+    return promise_reactor_wait((promise_reactor_t*)reactor,fd,true);
+}
+
+int promise_reactor_remove(promise_reactor_handle_t reactor_handle, int fd)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(!reactor)
+        return -1;
+    promise_reactor_fd_t* entry = promise_reactor_get_fd(reactor,fd,false);
+    if(!entry || !entry->registered)
+        return -1;
+    epoll_ctl(reactor->epoll_fd,EPOLL_CTL_DEL,fd,NULL);
+    entry->registered = false;
+    entry->readable = false;
+    entry->writable = false;
+    promise_handle_t waiters[2] = {entry->read_waiter,entry->write_waiter};
+    entry->read_waiter = NULL;
+    entry->write_waiter = NULL;
+    for(int i=0;i<2;i++)
+    {
+        if(!waiters[i])
+            continue;
+        reactor->waiters--;
+        promise_reject(reactor->manager,waiters[i],(promise_data_t){.ptr=PROMISE_FD_REMOVED},NULL,NULL);
+    }
+    return 0;
+}
+
+int promise_reactor_add_prepare(promise_reactor_handle_t reactor_handle, promise_reactor_prepare_t prepare, void* ctx)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(!reactor || !prepare)
+        return -1;
+    if(reactor->prepare_count == reactor->prepare_capacity)
+    {
+        int new_capacity = reactor->prepare_capacity ? reactor->prepare_capacity*2 : 4;
+        promise_reactor_prepare_entry_t* new_prepares = 
+            realloc(reactor->prepares,sizeof(promise_reactor_prepare_entry_t)*new_capacity);
+        if(!new_prepares)
+            return -1;
+        reactor->prepares = new_prepares;
+        reactor->prepare_capacity = new_capacity;
+    }
+    reactor->prepares[reactor->prepare_count].prepare = prepare;
+    reactor->prepares[reactor->prepare_count].ctx = ctx;
+    reactor->prepare_count++;
+    return 0;
+}
+
+int promise_reactor_remove_prepare(promise_reactor_handle_t reactor_handle, promise_reactor_prepare_t prepare, void* ctx)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(!reactor)
+        return -1;
+    for(int i=0;i<reactor->prepare_count;i++)
+    {
+        if(reactor->prepares[i].prepare == prepare && reactor->prepares[i].ctx == ctx)
+        {
+            memmove(&reactor->prepares[i],&reactor->prepares[i+1],
+                sizeof(promise_reactor_prepare_entry_t)*(reactor->prepare_count - i - 1));
+            reactor->prepare_count--;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int promise_loop_run_once(promise_reactor_handle_t reactor_handle, int timeout_ms)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(!reactor)
+        return -1;
+    promise_manager_advance_time(reactor->manager,promise_reactor_now_ms());
+    promise_manager_run(reactor->manager,0);
+    promise_reactor_run_prepares(reactor);
+    /** drains what the prepare callbacks settled, nothing is left queued while blocking */
+    promise_manager_run(reactor->manager,0);
+    int next_timer = promise_manager_next_timeout(reactor->manager);
+    if(next_timer >= 0 && (timeout_ms < 0 || next_timer < timeout_ms))
+        timeout_ms = next_timer;
+    int count = epoll_wait(reactor->epoll_fd,reactor->events,PROMISE_REACTOR_MAX_EVENTS,timeout_ms);
+    if(count < 0)
+    {
+        if(errno != EINTR)
+            return -1;
+        count = 0;
+    }
+    for(int i=0;i<count;i++)
+    {
+        struct epoll_event* event = &reactor->events[i];
+        if(event->data.u64 == PROMISE_REACTOR_REMOTE_TAG)
+        {
+            promise_manager_process_remote(reactor->manager);
+            continue;
+        }
+        /** handlers of earlier events may have removed the fd */
+        promise_reactor_fd_t* entry = promise_reactor_get_fd(reactor,(int)event->data.u64,false);
+        if(!entry || !entry->registered)
+            continue;
+        if(event->events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR))
+            promise_reactor_ready(reactor,entry,false);
+        if(entry->registered && (event->events & (EPOLLOUT|EPOLLHUP|EPOLLERR)))
+            promise_reactor_ready(reactor,entry,true);
+    }
+    promise_manager_advance_time(reactor->manager,promise_reactor_now_ms());
+    promise_manager_run(reactor->manager,0);
+    return count;
+}
+
+int promise_loop_run(promise_reactor_handle_t reactor_handle)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(!reactor)
+        return -1;
+    reactor->stop = false;
+    while(!reactor->stop)
+    {
+        promise_manager_run(reactor->manager,0);
+        /** prepare callbacks may start waits, e.g. by submitting batched requests */
+        promise_reactor_run_prepares(reactor);
+        if(reactor->waiters == 0 && reactor->remote_fd < 0 &&
+            promise_manager_next_timeout(reactor->manager) < 0)
+            break;
+        if(promise_loop_run_once(reactor_handle,-1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void promise_loop_stop(promise_reactor_handle_t reactor_handle)
+{
+    promise_reactor_t* reactor = (promise_reactor_t*)reactor_handle;
+    if(reactor)
+        reactor->stop = true;
+}
+
+static uint64_t promise_reactor_now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (uint64_t)now.tv_sec*1000 + now.tv_nsec/1000000;
+}
+
+static void promise_reactor_run_prepares(promise_reactor_t* reactor)
+{
+    /** by index, a prepare callback may remove itself */
+    for(int i=0;i<reactor->prepare_count;i++)
+        reactor->prepares[i].prepare(reactor->prepares[i].ctx);
+}
+
+static promise_reactor_fd_t* promise_reactor_get_fd(promise_reactor_t* reactor, int fd, bool create)
+{
+    if(fd < 0)
+        return NULL;
+    int chunk = fd >> PROMISE_REACTOR_CHUNK_BITS;
+    if(chunk >= reactor->chunk_count)
+    {
+        if(!create)
+            return NULL;
+        int new_count = reactor->chunk_count*2 > chunk + 1 ? reactor->chunk_count*2 : chunk + 1;
+        promise_reactor_fd_t** new_chunks = realloc(reactor->chunks,sizeof(promise_reactor_fd_t*)*new_count);
+        if(!new_chunks)
+            return NULL;
+        memset(new_chunks + reactor->chunk_count,0,sizeof(promise_reactor_fd_t*)*(new_count - reactor->chunk_count));
+        reactor->chunks = new_chunks;
+        reactor->chunk_count = new_count;
+    }
+    if(!reactor->chunks[chunk])
+    {
+        if(!create)
+            return NULL;
+        promise_reactor_fd_t* entries = malloc(sizeof(promise_reactor_fd_t)*PROMISE_REACTOR_CHUNK_LENGTH);
+        if(!entries)
+            return NULL;
+        memset(entries,0,sizeof(promise_reactor_fd_t)*PROMISE_REACTOR_CHUNK_LENGTH);
+        for(int i=0;i<PROMISE_REACTOR_CHUNK_LENGTH;i++)
+        {
+            entries[i].reactor = reactor;
+            entries[i].fd = (chunk << PROMISE_REACTOR_CHUNK_BITS) + i;
+        }
+        reactor->chunks[chunk] = entries;
+    }
+    return &reactor->chunks[chunk][fd & PROMISE_REACTOR_CHUNK_MASK];
+}
+
+static promise_handle_t promise_reactor_wait(promise_reactor_t* reactor, int fd, bool write)
+{
+    if(!reactor)
+        return NULL;
+    promise_reactor_fd_t* entry = promise_reactor_get_fd(reactor,fd,true);
+    if(!entry)
+        return NULL;
+    promise_handle_t* waiter = write ? &entry->write_waiter : &entry->read_waiter;
+    bool* ready = write ? &entry->writable : &entry->readable;
+    if(*waiter)
+        return NULL;
+    if(!entry->registered)
+    {
+        /** registered once for both directions, later awaits only touch the entry */
+        struct epoll_event event = {.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET, .data.u64 = (uint64_t)fd};
+        if(epoll_ctl(reactor->epoll_fd,EPOLL_CTL_ADD,fd,&event) != 0)
+            return NULL;
+        entry->registered = true;
+    }
+    promise_handle_t promise = promise_new(reactor->manager);
+    if(!promise)
+        return NULL;
+    if(*ready)
+    {
+        *ready = false;
+        promise_resolve(reactor->manager,promise,(promise_data_t){.ptr=NULL},NULL,NULL);
+        return promise;
+    }
+    /** however the promise goes, cancelled or destroyed, the entry forgets it */
+    if(promise_set_free_handler(reactor->manager,promise,promise_reactor_waiter_freed,entry) != 0)
+    {
+        promise_destroy(reactor->manager,promise);
+        return NULL;
+    }
+    *waiter = promise;
+    reactor->waiters++;
+    return promise;
+}
+
+static void promise_reactor_ready(promise_reactor_t* reactor, promise_reactor_fd_t* entry, bool write)
+{
+    promise_handle_t* waiter = write ? &entry->write_waiter : &entry->read_waiter;
+    if(!*waiter)
+    {
+        if(write)
+            entry->writable = true;
+        else
+            entry->readable = true;
+        return;
+    }
+    /** clear first, the handlers may await the fd again */
+    promise_handle_t promise = *waiter;
+    *waiter = NULL;
+    reactor->waiters--;
+    promise_resolve(reactor->manager,promise,(promise_data_t){.ptr=NULL},NULL,NULL);
+}
+
+/** a waiter settled by the reactor is already cleared, the entry may wait for a newer one */
+static void promise_reactor_waiter_freed(promise_handle_t promise, void* ctx)
+{
+    promise_reactor_fd_t* entry = (promise_reactor_fd_t*)ctx;
+    if(entry->read_waiter == promise)
+    {
+        entry->read_waiter = NULL;
+        entry->reactor->waiters--;
+    }
+    else if(entry->write_waiter == promise)
+    {
+        entry->write_waiter = NULL;
+        entry->reactor->waiters--;
+    }
+}
+
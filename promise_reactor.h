@@ -0,0 +1,112 @@
+#ifndef __PROMISE_REACTOR_H
+#define __PROMISE_REACTOR_H
+
+#include "promise.h"
+
+typedef void* promise_reactor_handle_t;
+
+/** reject reason of fd promises pending when their fd is removed, compare reason.ptr with it */
+extern const char promise_fd_removed_reason[];
+#define PROMISE_FD_REMOVED ((void*)promise_fd_removed_reason)
+
+/**
+ * @brief Create an epoll reactor driving a manager.
+ * Fds are registered edge triggered on their first await and stay registered,
+ * so awaiting the same fd again costs no syscall.
+ * The remote settle eventfd of the manager is polled too if it has one.
+ *
+ * @param manager not nullable, owned by the calling thread
+ * @return promise_reactor_handle_t or NULL on error
+ */
+promise_reactor_handle_t promise_reactor_new(promise_manager_handle_t manager);
+
+/**
+ * @brief Free the reactor. Pending fd promises are left pending.
+ *
+ * @param reactor
+ */
+void promise_reactor_free(promise_reactor_handle_t reactor);
+
+/**
+ * @brief Create a promise resolved once fd is readable, or hung up or in error.
+ * The readiness is edge triggered: read until EAGAIN before awaiting the fd again.
+ * Cancel or destroy the promise to stop waiting.
+ *
+ * @param reactor
+ * @param fd non blocking fd
+ * @return promise_handle_t or NULL on error or if fd already has a pending readable promise
+ */
+promise_handle_t promise_fd_readable(promise_reactor_handle_t reactor, int fd);
+
+/**
+ * @brief Create a promise resolved once fd is writable, or hung up or in error.
+ * The readiness is edge triggered: write until EAGAIN before awaiting the fd again.
+ * Cancel or destroy the promise to stop waiting.
+ *
+ * @param reactor
+ * @param fd non blocking fd
+ * @return promise_handle_t or NULL on error or if fd already has a pending writable promise
+ */
+promise_handle_t promise_fd_writable(promise_reactor_handle_t reactor, int fd);
+
+/**
+ * @brief Unregister fd. MUST be called before closing an awaited fd.
+ * Its pending promises are rejected with PROMISE_FD_REMOVED.
+ *
+ * @param reactor
+ * @param fd
+ * @return int 0 on success, -1 if fd is not registered
+ */
+int promise_reactor_remove(promise_reactor_handle_t reactor, int fd);
+
+typedef void(*promise_reactor_prepare_t)(void* ctx);
+/**
+ * @brief Add a callback run on each loop iteration right before the reactor blocks.
+ * Use it to flush requests batched during the iteration.
+ *
+ * @param reactor
+ * @param prepare not nullable
+ * @param ctx ctx for prepare
+ * @return int 0 on success, -1 on error
+ */
+int promise_reactor_add_prepare(promise_reactor_handle_t reactor, promise_reactor_prepare_t prepare, void* ctx);
+/**
+ * @brief Remove a callback added by promise_reactor_add_prepare.
+ *
+ * @param reactor
+ * @param prepare
+ * @param ctx
+ * @return int 0 on success, -1 if it is not found
+ */
+int promise_reactor_remove_prepare(promise_reactor_handle_t reactor, promise_reactor_prepare_t prepare, void* ctx);
+
+/**
+ * @brief Poll the fds once, then advance the timers and run the queued handlers.
+ * Prepare callbacks run after the queued handlers and before polling.
+ *
+ * @param reactor
+ * @param timeout_ms max time to block, -1 to block until an fd or a timer is due.
+ * It does not block if the manager has handlers queued.
+ * @return int number of fd events handled, -1 on error
+ */
+int promise_loop_run_once(promise_reactor_handle_t reactor, int timeout_ms);
+
+/**
+ * @brief Run the loop until promise_loop_stop is called or nothing is left to wait for:
+ * no pending fd promise, no timer and no queued handler.
+ * A manager created with remote_settle keeps the loop running until promise_loop_stop.
+ *
+ * @param reactor
+ * @return int 0 on success, -1 on error
+ */
+int promise_loop_run(promise_reactor_handle_t reactor);
+
+/**
+ * @brief Make promise_loop_run return after the current iteration.
+ *
+ * @param reactor
+ */
+void promise_loop_stop(promise_reactor_handle_t reactor);
+
+#endif
+
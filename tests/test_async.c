@@ -69,6 +69,20 @@ ASYNC(test,(int a, int b),
     ASYNC_END();
 }
 
+/** takes over more results than the frame holds inline */
+ASYNC(sum_many,(int n),
+    int n;int i;int* value;int sum;,
+    ARG_INIT(n);)
+{
+    for(VAR(i)=0;VAR(i)<VAR(n);VAR(i)++)
+    {
+        AWAIT_RESULT(ptr,VAR(value),async_process1(VAR(i),0));
+        VAR(sum) += *VAR(value);
+    }
+    RETURN(number,VAR(sum),NULL,NULL);
+    ASYNC_END();
+}
+
 static void test_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
 {
     printf("Result:%d\n",(int)data.number);
@@ -85,6 +99,7 @@ int main(int argc, char const *argv[])
     manager = promise_manager_new();
     assert(manager);
     promise_await(manager,test(1,2),test_then,NULL,false,test_catch,NULL,false);
+    promise_await(manager,sum_many(10),test_then,NULL,false,test_catch,NULL,false);
     promise_manager_free(manager);
     return 0;
 }
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+
+static promise_manager_handle_t manager = NULL;
+
+typedef struct
+{
+    int id;
+    char* buffer;   /** stands for the resources of an in flight operation */
+} operation_t;
+
+static int cancelled = 0;
+
+void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+void operation_cancel(void* ctx)
+{
+    operation_t* op = (operation_t*)ctx;
+    printf("operation %d cancelled\n",op->id);
+    cancelled++;
+    free(op->buffer);
+    free(op);
+}
+
+promise_handle_t operation_start(int id, operation_t** out)
+{
+    promise_handle_t promise = promise_new(manager);
+    operation_t* op = malloc(sizeof(operation_t));
+    op->id = id;
+    op->buffer = malloc(4096);
+    promise_set_cancel_handler(manager,promise,operation_cancel,op);
+    if(out)
+        *out = op;
+    return promise;
+}
+
+void operation_finish(promise_handle_t promise, operation_t* op)
+{
+    int* result = malloc(sizeof(int));
+    *result = op->id;
+    free(op->buffer);
+    free(op);
+    promise_resolve(manager,promise,(promise_data_t){.ptr=result},free_with_ctx,NULL);
+}
+
+void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved\n",(char*)ctx);
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected\n",(char*)ctx);
+    if(free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+}
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+ASYNC(read_twice,(int id),
+    int id;int* first;int* second;,
+    ARG_INIT(id);)
+{
+    AWAIT_RESULT(ptr,VAR(first),operation_start(VAR(id),NULL));
+    AWAIT_RESULT(ptr,VAR(second),operation_start(VAR(id)+1,NULL));
+    printf("read_twice should not get here\n");
+    RETURN(ptr,NULL,NULL,NULL);
+    ASYNC_END();
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+
+    /** cancel a pending promise */
+    promise_handle_t p = operation_start(1,NULL);
+    promise_await(manager,p,then,"p",true,catch,"p",true);
+    assert(promise_cancel(manager,p) == 0);
+    assert(promise_cancel(manager,p) == -1);
+    assert(cancelled == 1);
+
+    /** the losers of promise_any are cancelled as soon as one resolves */
+    operation_t* op2 = NULL;
+    promise_handle_t p2 = operation_start(2,&op2);
+    promise_handle_t p3 = operation_start(3,NULL);
+    promise_handle_t p4 = operation_start(4,NULL);
+    promise_handle_t any = promise_any(manager,3,p2,p3,p4);
+    promise_await(manager,any,then,"any",true,catch,"any",true);
+    operation_finish(p2,op2);
+    assert(cancelled == 3);
+
+    /** cancelling promise_all cancels all its pending sub promises */
+    promise_handle_t p5 = operation_start(5,NULL);
+    promise_handle_t p6 = operation_start(6,NULL);
+    promise_handle_t all = promise_all(manager,2,p5,p6);
+    promise_await(manager,all,then,"all",true,catch,"all",true);
+    promise_cancel(manager,all);
+    assert(cancelled == 5);
+
+    /** cancelling an async function cancels what it is awaiting and frees its frame */
+    promise_handle_t async_promise = read_twice(7);
+    promise_await(manager,async_promise,then,"read_twice",true,catch,"read_twice",true);
+    promise_cancel(manager,async_promise);
+    assert(cancelled == 6);
+
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats) == 0)
+        printf("cancelled:%llu live:%zu\n",stats.cancelled,stats.live_promises);
+
+    promise_manager_free(manager);
+    return 0;
+}
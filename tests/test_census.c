@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+
+#define LEAKED 10
+
+static promise_manager_handle_t manager = NULL;
+static promise_handle_t gate = NULL;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+ASYNC(wait_source,(),
+    double value;,
+    )
+{
+    AWAIT_RESULT(number,VAR(value),gate);
+    RETURN(number,VAR(value),NULL,NULL);
+    ASYNC_END();
+}
+
+static void add_one(promise_value_t* value, void* ctx)
+{
+    value->data.number += 1;
+}
+
+/** returns the line of the dump naming site, NULL if none */
+static char* find_site(char* text, const char* site)
+{
+    char* at = strstr(text,site);
+    if(!at)
+        return NULL;
+    while(at > text && at[-1] != '\n')
+        at--;
+    return at;
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    FILE* file = tmpfile();
+    assert(file);
+    if(promise_manager_dump_pending(manager,file) < 0)
+    {
+        printf("census is compiled out, build with PROMISE_CENSUS=1\n");
+        fclose(file);
+        promise_manager_free(manager);
+        return 0;
+    }
+    fclose(file);
+
+    /** never settled, never freed */
+    int leak_line = __LINE__ + 2;
+    for(int i=0;i<LEAKED;i++)
+        promise_new(manager);
+    /** settled but nobody consumes it */
+    int settled_line = __LINE__ + 1;
+    promise_resolve(manager,promise_new(manager),(promise_data_t){.number=1},NULL,NULL);
+    /** a fused pipeline keeps the site of its first stage */
+    promise_handle_t source = promise_new(manager);
+    int then_line = __LINE__ + 1;
+    promise_handle_t derived = promise_then(manager,source,add_one,NULL);
+    assert(promise_then(manager,derived,add_one,NULL) == derived);
+    /** an ASYNC function is counted where it is defined */
+    gate = promise_new(manager);
+    wait_source();
+    /** a group holds its block */
+    int all_line = __LINE__ + 1;
+    promise_all(manager,2,promise_delay(manager,1000),promise_delay(manager,2000));
+
+    file = tmpfile();
+    assert(file);
+    int pending = promise_manager_dump_pending(manager,file);
+    long size = ftell(file);
+    char* text = malloc(size + 1);
+    rewind(file);
+    assert(fread(text,1,size,file) == (size_t)size);
+    text[size] = 0;
+    fclose(file);
+    printf("%s",text);
+    assert(pending == LEAKED + 1 + 2 + 2 + 3);
+
+    char site[64];
+    size_t count = 0, settled = 0, bytes = 0;
+    snprintf(site,sizeof(site),"test_census.c:%d\n",leak_line);
+    char* line = find_site(text,site);
+    assert(line && sscanf(line,"%zu %zu %zu",&count,&settled,&bytes) == 3);
+    assert(count == LEAKED && settled == 0 && bytes > 0);
+    /** the largest site comes first */
+    assert(line == strchr(strchr(text,'\n') + 1,'\n') + 1);
+    snprintf(site,sizeof(site),"test_census.c:%d\n",settled_line);
+    line = find_site(text,site);
+    assert(line && sscanf(line,"%zu %zu",&count,&settled) == 2);
+    assert(count == 1 && settled == 1);
+    snprintf(site,sizeof(site),"test_census.c:%d\n",then_line);
+    line = find_site(text,site);
+    assert(line && sscanf(line,"%zu",&count) == 1 && count == 1);
+    snprintf(site,sizeof(site),"test_census.c:%d\n",all_line);
+    line = find_site(text,site);
+    assert(line && sscanf(line,"%zu",&count) == 1 && count == 3);
+    free(text);
+
+    /** lets the ASYNC function give its frame back */
+    promise_resolve(manager,gate,(promise_data_t){.number=1},NULL,NULL);
+    promise_manager_free(manager);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "promise.h"
+
+#define PIPELINE_LENGTH 100
+
+static promise_manager_handle_t manager = NULL;
+static int source_cancelled = 0;
+
+static void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+static void add_one(promise_value_t* value, void* ctx)
+{
+    value->data.number += 1;
+}
+
+static void fail_if_odd(promise_value_t* value, void* ctx)
+{
+    if((int)value->data.number % 2)
+    {
+        value->data.ptr = strdup("odd");
+        value->free_data = free_with_ctx;
+        value->free_ctx = NULL;
+        value->rejected = true;
+    }
+}
+
+/** recovers from the rejection, the reason is owned here */
+static void recover(promise_value_t* value, void* ctx)
+{
+    printf("recovered from %s\n",(char*)value->data.ptr);
+    if(value->free_data)
+        value->free_data(value->data.ptr,value->free_ctx);
+    value->data.number = -1;
+    value->free_data = NULL;
+    value->rejected = false;
+}
+
+static void to_string(promise_value_t* value, void* ctx)
+{
+    char* string = malloc(32);
+    snprintf(string,32,"%s%d",(char*)ctx,(int)value->data.number);
+    value->data.ptr = string;
+    value->free_data = free_with_ctx;
+    value->free_ctx = NULL;
+}
+
+static void number_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %d\n",(char*)ctx,(int)data.number);
+}
+
+static void string_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %s\n",(char*)ctx,(char*)data.ptr);
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected with %s\n",(char*)ctx,(char*)reason.ptr);
+    if(free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+}
+
+static void source_cancel(void* ctx)
+{
+    source_cancelled++;
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    promise_manager_stats_t stats;
+    bool has_stats = promise_manager_get_stats(manager,&stats) == 0;
+
+    /** a pipeline of stages is fused into a single derived promise */
+    promise_handle_t source = promise_new(manager);
+    promise_handle_t derived = promise_then(manager,source,add_one,NULL);
+    for(int i=1;i<PIPELINE_LENGTH;i++)
+        assert(promise_then(manager,derived,add_one,NULL) == derived);
+    if(has_stats)
+    {
+        promise_manager_get_stats(manager,&stats);
+        assert(stats.live_promises == 2);
+        assert(stats.fused_stages == PIPELINE_LENGTH - 1);
+    }
+    promise_await(manager,derived,number_then,"pipeline",false,catch,"pipeline",false);
+    promise_resolve(manager,source,(promise_data_t){.number=0},NULL,NULL);
+
+    /** rejections skip the then stages up to a catch stage */
+    for(int i=0;i<2;i++)
+    {
+        source = promise_new(manager);
+        derived = promise_then(manager,source,fail_if_odd,NULL);
+        derived = promise_then(manager,derived,add_one,NULL);
+        derived = promise_catch(manager,derived,recover,NULL);
+        derived = promise_then(manager,derived,to_string,"value ");
+        promise_await(manager,derived,string_then,"recover",true,catch,"recover",true);
+        promise_resolve(manager,source,(promise_data_t){.number=i},NULL,NULL);
+    }
+
+    /** a rejection passes through the then stages */
+    source = promise_new(manager);
+    derived = promise_then(manager,source,to_string,"unused ");
+    promise_await(manager,derived,string_then,"pass through",true,catch,"pass through",true);
+    promise_reject(manager,source,(promise_data_t){.ptr=strdup("error")},free_with_ctx,NULL);
+
+    /** an awaited derived promise is not fused */
+    source = promise_new(manager);
+    derived = promise_then(manager,source,add_one,NULL);
+    promise_await(manager,derived,number_then,"first consumer",false,catch,"first consumer",false);
+    promise_handle_t second = promise_then(manager,derived,add_one,NULL);
+    assert(second != derived);
+    promise_await(manager,second,number_then,"second consumer",false,catch,"second consumer",false);
+    promise_resolve(manager,source,(promise_data_t){.number=0},NULL,NULL);
+
+    /** cancelling the derived promise cancels the source */
+    source = promise_new(manager);
+    promise_set_cancel_handler(manager,source,source_cancel,NULL);
+    derived = promise_then(manager,source,add_one,NULL);
+    promise_cancel(manager,derived);
+    assert(source_cancelled == 1);
+
+    if(has_stats)
+    {
+        promise_manager_get_stats(manager,&stats);
+        assert(stats.live_promises == 0);
+    }
+    promise_manager_free(manager);
+    return 0;
+}
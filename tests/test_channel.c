@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+#include "async_channel.h"
+
+#define ITEMS 100
+#define CAPACITY 4
+#define IDLE_WAITS 100
+
+static promise_manager_handle_t manager = NULL;
+static int consumed = 0;
+static int peak_length = 0;
+static int idle_freed = 0;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+static void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+ASYNC(produce,(async_channel_handle_t out),
+    async_channel_handle_t out;int i;char* item;,
+    ARG_INIT(out);)
+{
+    for(VAR(i)=0;VAR(i)<ITEMS;VAR(i)++)
+    {
+        VAR(item) = malloc(16);
+        snprintf(VAR(item),16,"item %d",VAR(i));
+        AWAIT_SEND(VAR(out),ptr,VAR(item),free_with_ctx,NULL);
+        if(async_channel_length(VAR(out)) > peak_length)
+            peak_length = async_channel_length(VAR(out));
+    }
+    async_channel_close(VAR(out));
+    RETURN(number,VAR(i),NULL,NULL);
+    ASYNC_END();
+}
+
+/** upper cases the items, their ownership moves along */
+ASYNC(transform,(async_channel_handle_t in, async_channel_handle_t out),
+    async_channel_handle_t in;async_channel_handle_t out;
+    char* item;void(*free_item)(void*,void*);void* free_ctx;bool open;,
+    ARG_INIT(in);ARG_INIT(out);)
+{
+    VAR(open) = true;
+    while(VAR(open))
+    {
+        TRY
+        {
+            AWAIT_RECV(VAR(in),ptr,VAR(item),VAR(free_item),VAR(free_ctx));
+            SYNC_IN_TRY(
+                for(char* c = VAR(item);*c;c++)
+                    *c = toupper(*c);
+            );
+            AWAIT_SEND(VAR(out),ptr,VAR(item),VAR(free_item),VAR(free_ctx));
+        }
+        CATCH(error)
+        {
+            assert(error.ptr == ASYNC_CHANNEL_CLOSED);
+            VAR(open) = false;
+        }
+    }
+    async_channel_close(VAR(out));
+    RETURN(number,0,NULL,NULL);
+    ASYNC_END();
+}
+
+ASYNC(consume,(async_channel_handle_t in),
+    async_channel_handle_t in;
+    char* item;void(*free_item)(void*,void*);void* free_ctx;bool open;,
+    ARG_INIT(in);)
+{
+    VAR(open) = true;
+    while(VAR(open))
+    {
+        TRY
+        {
+            AWAIT_RECV(VAR(in),ptr,VAR(item),VAR(free_item),VAR(free_ctx));
+            SYNC_IN_TRY(
+                assert(strncmp(VAR(item),"ITEM ",5) == 0);
+                assert(atoi(VAR(item) + 5) == consumed);
+                consumed++;
+                VAR(free_item)(VAR(item),VAR(free_ctx));
+            );
+        }
+        CATCH(error)
+        {
+            VAR(open) = false;
+        }
+    }
+    RETURN(number,consumed,NULL,NULL);
+    ASYNC_END();
+}
+
+static void count_free(void* data, void* ctx)
+{
+    idle_freed++;
+    free(data);
+}
+
+/** every wait times out on an idle channel, the abandoned ones leave it at once */
+ASYNC(wait_idle,(async_channel_handle_t channel),
+    async_channel_handle_t channel;int i;,
+    ARG_INIT(channel);)
+{
+    for(VAR(i)=0;VAR(i)<IDLE_WAITS;VAR(i)++)
+    {
+        TRY
+        {
+            AWAIT_TIMEOUT(async_channel_recv(VAR(channel)),1);
+        }
+        CATCH(error)
+        {
+            assert(error.ptr == PROMISE_TIMEOUT);
+        }
+        TRY
+        {
+            AWAIT_TIMEOUT(async_channel_send(VAR(channel),(promise_data_t){.ptr=strdup("idle")},count_free,NULL),1);
+        }
+        CATCH(error)
+        {
+            /** the item of a cancelled send is dropped right away */
+            assert(error.ptr == PROMISE_TIMEOUT);
+            assert(idle_freed == VAR(i) + 1);
+        }
+    }
+    RETURN(number,VAR(i),NULL,NULL);
+    ASYNC_END();
+}
+
+static void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %d\n",(char*)ctx,(int)data.number);
+}
+
+static void recv_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("recv resolved with %s\n",(char*)data.ptr);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected with %s\n",(char*)ctx,(char*)reason.ptr);
+}
+
+/** the first receiver told of the close frees the channel */
+static int closed_receivers = 0;
+static void free_on_close(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    assert(reason.ptr == ASYNC_CHANNEL_CLOSED);
+    if(closed_receivers++ == 0)
+        async_channel_free(ctx);
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+
+    /** a buffered stage then a direct handoff, memory stays bounded */
+    async_channel_handle_t buffered = async_channel_new(manager,CAPACITY);
+    async_channel_handle_t direct = async_channel_new(manager,0);
+    assert(buffered && direct);
+    promise_await(manager,consume(direct),then,"consume",false,catch,"consume",false);
+    promise_await(manager,transform(buffered,direct),then,"transform",false,catch,"transform",false);
+    promise_await(manager,produce(buffered),then,"produce",false,catch,"produce",false);
+    assert(consumed == ITEMS);
+    assert(peak_length <= CAPACITY);
+    async_channel_free(buffered);
+    async_channel_free(direct);
+
+    /** senders wait for room, a cancelled send drops its item */
+    async_channel_handle_t channel = async_channel_new(manager,1);
+    promise_handle_t first = async_channel_send(channel,(promise_data_t){.ptr=strdup("first")},free_with_ctx,NULL);
+    promise_handle_t second = async_channel_send(channel,(promise_data_t){.ptr=strdup("second")},free_with_ctx,NULL);
+    promise_handle_t third = async_channel_send(channel,(promise_data_t){.ptr=strdup("third")},free_with_ctx,NULL);
+    promise_await(manager,first,then,"first send",false,catch,"first send",false);
+    promise_await(manager,third,then,"third send",false,catch,"third send",false);
+    promise_cancel(manager,second);
+    promise_await(manager,async_channel_recv(channel),recv_then,NULL,false,catch,"recv",false);
+    assert(async_channel_length(channel) == 1);
+
+    /** closing rejects the waiting senders, buffered items are still received */
+    promise_await(manager,async_channel_send(channel,(promise_data_t){.ptr=strdup("fourth")},free_with_ctx,NULL),
+        then,"fourth send",false,catch,"fourth send",false);
+    assert(async_channel_close(channel) == 0);
+    assert(async_channel_close(channel) != 0);
+    promise_await(manager,async_channel_recv(channel),recv_then,NULL,false,catch,"recv",false);
+    promise_await(manager,async_channel_recv(channel),recv_then,NULL,false,catch,"recv",false);
+    async_channel_free(channel);
+
+    /** a receiver may free the channel while it is being closed */
+    channel = async_channel_new(manager,0);
+    promise_await(manager,async_channel_recv(channel),recv_then,NULL,false,free_on_close,channel,false);
+    promise_await(manager,async_channel_recv(channel),recv_then,NULL,false,free_on_close,channel,false);
+    assert(async_channel_close(channel) == 0);
+    assert(closed_receivers == 2);
+
+    /** timed out receives and sends do not pile up */
+    channel = async_channel_new(manager,0);
+    promise_await(manager,wait_idle(channel),then,"wait_idle",false,catch,"wait_idle",false);
+    for(int i=0;i<IDLE_WAITS*2;i++)
+        promise_manager_advance_time(manager,promise_manager_now(manager) + 1);
+    assert(idle_freed == IDLE_WAITS);
+    async_channel_free(channel);
+
+    /** the channel frees what is left */
+    channel = async_channel_new(manager,2);
+    promise_destroy(manager,async_channel_send(channel,(promise_data_t){.ptr=strdup("left")},free_with_ctx,NULL));
+    promise_destroy(manager,async_channel_send(channel,(promise_data_t){.ptr=strdup("over")},free_with_ctx,NULL));
+    async_channel_free(channel);
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats) == 0)
+        assert(stats.live_promises == 0);
+    promise_manager_free(manager);
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <poll.h>
+#include "promise.h"
+#include "promise_executor.h"
+#include "async_function.h"
+
+#define JOBS 1000
+
+static promise_executor_handle_t executor = NULL;
+static int settled = 0;
+static long sum = 0;
+
+#define GLOBAL_PROMISE_MANAGER (promise_executor_current_manager())
+
+static void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+static promise_handle_t square_job(promise_manager_handle_t shard, void* ctx)
+{
+    promise_handle_t promise = promise_new(shard);
+    long* result = malloc(sizeof(long));
+    *result = (long)ctx * (long)ctx;
+    promise_resolve(shard,promise,(promise_data_t){.ptr=result},free_with_ctx,NULL);
+    return promise;
+}
+
+/** runs on a worker, awaits a job spawned onto its own deque */
+ASYNC(sum_of_squares,(long a, long b),
+    long a;long b;long* x;long* y;,
+    ARG_INIT(a);
+    ARG_INIT(b);)
+{
+    AWAIT_RESULT(ptr,VAR(x),promise_executor_submit(executor,GLOBAL_PROMISE_MANAGER,square_job,(void*)VAR(a)));
+    AWAIT_RESULT(ptr,VAR(y),promise_executor_submit(executor,GLOBAL_PROMISE_MANAGER,square_job,(void*)VAR(b)));
+    RETURN(number,*VAR(x)+*VAR(y),NULL,NULL);
+    ASYNC_END();
+}
+
+static promise_handle_t sum_job(promise_manager_handle_t shard, void* ctx)
+{
+    return sum_of_squares((long)ctx,1);
+}
+
+static promise_handle_t failing_job(promise_manager_handle_t shard, void* ctx)
+{
+    return NULL;
+}
+
+static void test_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    settled++;
+    sum += (long)data.number;
+}
+
+static void test_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    settled++;
+    printf("Error\n");
+}
+
+int main(int argc, char const *argv[])
+{
+    promise_manager_options_t options = {
+        .initial_capacity = 1024,
+        .max_retained_bytes = 1024*1024,
+        .remote_settle = true
+    };
+    promise_manager_handle_t manager = promise_manager_new_with_options(&options);
+    assert(manager);
+    executor = promise_executor_new(4);
+    assert(executor);
+
+    for(long i=0;i<JOBS;i++)
+    {
+        promise_handle_t promise = promise_executor_submit(executor,manager,sum_job,(void*)i);
+        assert(promise);
+        promise_await(manager,promise,test_then,NULL,false,test_catch,NULL,false);
+    }
+    promise_handle_t promise = promise_executor_submit(executor,manager,failing_job,NULL);
+    promise_await(manager,promise,test_then,NULL,false,test_catch,NULL,false);
+
+    struct pollfd pfd = {.fd = promise_manager_get_fd(manager), .events = POLLIN};
+    while(settled < JOBS + 1)
+    {
+        if(poll(&pfd,1,5000) <= 0)
+            break;
+        promise_manager_process_remote(manager);
+    }
+    printf("Settled:%d Sum:%ld\n",settled,sum);
+
+    promise_executor_free(executor);
+    promise_manager_free(manager);
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "promise.h"
+#include "promise_reactor.h"
+#include "promise_io.h"
+#include "async_function.h"
+
+#define BLOCK_SIZE 4096
+#define BLOCKS 64
+
+static promise_manager_handle_t manager = NULL;
+static promise_reactor_handle_t reactor = NULL;
+static promise_io_handle_t io = NULL;
+
+static char blocks[BLOCKS][BLOCK_SIZE];
+static int written = 0;
+static int errors = 0;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+/** writes a block, syncs, then reads it back */
+ASYNC(round_trip,(int fd),
+    int fd;double bytes;char* buffer;,
+    ARG_INIT(fd);)
+{
+    VAR(buffer) = blocks[0];
+    memset(VAR(buffer),'r',BLOCK_SIZE);
+    AWAIT_RESULT(number,VAR(bytes),promise_write(io,VAR(fd),VAR(buffer),BLOCK_SIZE,BLOCKS*BLOCK_SIZE));
+    assert(VAR(bytes) == BLOCK_SIZE);
+    AWAIT(promise_fsync(io,VAR(fd)));
+    memset(VAR(buffer),0,BLOCK_SIZE);
+    AWAIT_RESULT(number,VAR(bytes),promise_read(io,VAR(fd),VAR(buffer),BLOCK_SIZE,BLOCKS*BLOCK_SIZE));
+    assert(VAR(bytes) == BLOCK_SIZE && VAR(buffer)[0] == 'r' && VAR(buffer)[BLOCK_SIZE-1] == 'r');
+    RETURN(number,VAR(bytes),NULL,NULL);
+    ASYNC_END();
+}
+
+static void write_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    assert(data.number == BLOCK_SIZE);
+    written++;
+}
+
+static void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %d\n",(char*)ctx,(int)data.number);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected with %s\n",(char*)ctx,strerror((int)reason.number));
+    errors++;
+}
+
+int main(int argc, char const *argv[])
+{
+    char path[] = "/tmp/test_io_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+
+    manager = promise_manager_new();
+    assert(manager);
+    reactor = promise_reactor_new(manager);
+    assert(reactor);
+    io = promise_io_new(manager,reactor,NULL);
+    assert(io);
+    printf("backend: %s\n",promise_io_backend(io));
+    struct iovec iovec = {.iov_base = blocks,.iov_len = sizeof(blocks)};
+    assert(promise_io_register_buffers(io,&iovec,1) == 0);
+
+    /** every write queued in this iteration goes out in one batch */
+    for(int i=0;i<BLOCKS;i++)
+    {
+        memset(blocks[i],'a' + i%26,BLOCK_SIZE);
+        promise_await(manager,promise_write(io,fd,blocks[i],BLOCK_SIZE,(off_t)i*BLOCK_SIZE),
+            write_then,NULL,false,catch,"write",false);
+    }
+    /** cancelled before submission, never written */
+    promise_cancel(manager,promise_write(io,fd,blocks[0],BLOCK_SIZE,(off_t)BLOCKS*BLOCK_SIZE*2));
+    assert(promise_loop_run(reactor) == 0);
+    assert(written == BLOCKS);
+    assert(lseek(fd,0,SEEK_END) == BLOCKS*BLOCK_SIZE);
+    printf("%d blocks written\n",written);
+
+    promise_await(manager,round_trip(fd),then,"round_trip",false,catch,"round_trip",false);
+    assert(promise_loop_run(reactor) == 0);
+
+    /** errors reject with the errno */
+    promise_await(manager,promise_read(io,-1,blocks[0],BLOCK_SIZE,0),then,"bad fd",false,catch,"bad fd",false);
+    int write_only = open("/dev/null",O_WRONLY);
+    promise_await(manager,promise_read(io,write_only,blocks[0],BLOCK_SIZE,0),then,"read",false,catch,"read",false);
+    assert(promise_loop_run(reactor) == 0);
+    assert(errors == 1);
+    close(write_only);
+    promise_io_free(io);
+
+    /** without a reactor the caller submits and reaps */
+    io = promise_io_new(manager,NULL,&(promise_io_options_t){.threads = 2});
+    assert(io);
+    static char buffer[BLOCKS][BLOCK_SIZE];
+    int read_count = 0;
+    for(int i=0;i<BLOCKS;i++)
+        promise_await(manager,promise_read(io,fd,buffer[i],BLOCK_SIZE,(off_t)i*BLOCK_SIZE),write_then,NULL,false,catch,"read",false);
+    assert(promise_io_submit(io) == BLOCKS);
+    assert(promise_io_submit(io) == 0);
+    while(read_count < BLOCKS)
+    {
+        struct pollfd pfd = {.fd = promise_io_get_fd(io),.events = POLLIN};
+        assert(poll(&pfd,1,1000) == 1);
+        read_count += promise_io_process(io);
+    }
+    for(int i=0;i<BLOCKS;i++)
+        assert(buffer[i][0] == 'a' + i%26 && buffer[i][BLOCK_SIZE-1] == 'a' + i%26);
+    printf("%d blocks read back\n",read_count);
+
+    /** requests in flight are waited for, their promises stay pending */
+    promise_read(io,fd,buffer[0],BLOCK_SIZE,0);
+    promise_io_submit(io);
+    promise_io_free(io);
+
+    /** requests queued but not submitted at free time do not keep the loop waiting */
+    io = promise_io_new(manager,reactor,NULL);
+    assert(io);
+    promise_read(io,fd,buffer[0],BLOCK_SIZE,0);
+    promise_io_free(io);
+    assert(promise_loop_run(reactor) == 0);
+
+    promise_reactor_free(reactor);
+    promise_manager_free(manager);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+
+static promise_manager_handle_t manager = NULL;
+static int started = 0;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+/** resolves synchronously once started */
+LAZY_ASYNC(lookup,(int key),
+    int key;,
+    ARG_INIT(key);)
+{
+    started++;
+    printf("lookup %d started\n",VAR(key));
+    RETURN(number,VAR(key)*10,NULL,NULL);
+    ASYNC_END();
+}
+
+/** suspends on an external promise */
+LAZY_ASYNC(fetch,(promise_handle_t source),
+    promise_handle_t source;double result;,
+    ARG_INIT(source);)
+{
+    started++;
+    AWAIT_RESULT(number,VAR(result),VAR(source));
+    RETURN(number,VAR(result),NULL,NULL);
+    ASYNC_END();
+}
+
+static void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %d\n",(char*)ctx,(int)data.number);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected\n",(char*)ctx);
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+
+    /** never awaited, never run */
+    promise_destroy(manager,lookup(1));
+    promise_cancel(manager,lookup(2));
+    assert(started == 0);
+
+    /** started by the await, not by the call */
+    promise_handle_t promise = lookup(3);
+    assert(started == 0);
+    promise_await(manager,promise,then,"lookup",false,catch,"lookup",false);
+    assert(started == 1);
+
+    /** the group starts its branches in order, the first one settles promise_any */
+    promise = promise_any(manager,2,lookup(4),lookup(5));
+    assert(promise);
+    assert(started == 2);
+    promise_await(manager,promise,then,"any",false,catch,"any",false);
+
+    /** a started lazy function is cancelled like an eager one */
+    promise_handle_t source = promise_new(manager);
+    promise = fetch(source);
+    promise_await(manager,promise,then,"fetch",false,catch,"fetch",false);
+    assert(started == 3);
+    promise_cancel(manager,promise);
+    assert(promise_resolve(manager,source,(promise_data_t){.number=1},NULL,NULL) != 0);
+
+    /** the manager discards what is left */
+    fetch(promise_new(manager));
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats) == 0)
+        assert(stats.live_promises == 2);
+    promise_manager_free(manager);
+    assert(started == 3);
+    return 0;
+}
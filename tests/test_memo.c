@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "promise.h"
+#include "promise_memo.h"
+
+#define MAX_CALLS 16
+
+static promise_manager_handle_t manager = NULL;
+static promise_handle_t calls[MAX_CALLS];
+static int call_count = 0;
+static int resolved = 0;
+static int rejected = 0;
+static int cancelled = 0;
+
+static void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+/** the backend lookup, settled by hand */
+static promise_handle_t lookup(const void* key, size_t key_len, void* ctx)
+{
+    printf("lookup %.*s\n",(int)key_len,(const char*)key);
+    promise_handle_t promise = promise_new(manager);
+    calls[call_count++] = promise;
+    return promise;
+}
+
+static void count_cancel(void* ctx)
+{
+    cancelled++;
+}
+
+static int copy_string(const promise_value_t* value, promise_value_t* copy, void* ctx)
+{
+    copy->data.ptr = value->data.ptr ? strdup(value->data.ptr) : NULL;
+    copy->free_data = free_with_ctx;
+    return 0;
+}
+
+/** takes its copy over */
+static void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %s\n",(char*)ctx,(char*)data.ptr);
+    resolved++;
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected with %s\n",(char*)ctx,(char*)reason.ptr);
+    rejected++;
+    if(free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+}
+
+static void get(promise_memo_handle_t memo, const char* key, char* name)
+{
+    promise_handle_t promise = promise_memo_get(memo,key,strlen(key));
+    assert(promise);
+    promise_await(manager,promise,then,name,true,catch,name,true);
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    promise_memo_handle_t memo = promise_memo_new(manager,lookup,NULL,
+        &(promise_memo_options_t){.capacity = 2,.ttl_ms = 1000,.copy = copy_string});
+    assert(memo);
+
+    /** concurrent lookups share one call, each waiter owns a copy */
+    for(int i=0;i<8;i++)
+        get(memo,"a","waiter");
+    assert(call_count == 1);
+    promise_resolve(manager,calls[0],(promise_data_t){.ptr=strdup("A")},free_with_ctx,NULL);
+    assert(resolved == 8);
+
+    /** served from cache until the ttl */
+    get(memo,"a","cached");
+    assert(call_count == 1 && resolved == 9);
+    promise_manager_advance_time(manager,promise_manager_now(manager) + 1000);
+    get(memo,"a","expired");
+    assert(call_count == 2);
+    promise_resolve(manager,calls[1],(promise_data_t){.ptr=strdup("A2")},free_with_ctx,NULL);
+
+    /** the least recently used value is evicted */
+    get(memo,"b","b");
+    promise_resolve(manager,calls[2],(promise_data_t){.ptr=strdup("B")},free_with_ctx,NULL);
+    get(memo,"a","a");
+    get(memo,"c","c");
+    promise_resolve(manager,calls[3],(promise_data_t){.ptr=strdup("C")},free_with_ctx,NULL);
+    assert(call_count == 4);
+    get(memo,"a","a");
+    assert(call_count == 4);
+    get(memo,"b","b evicted");
+    assert(call_count == 5);
+
+    /** rejections reach the waiters but are not cached */
+    get(memo,"b","b again");
+    promise_reject(manager,calls[4],(promise_data_t){.ptr=strdup("error")},free_with_ctx,NULL);
+    assert(rejected == 2);
+    get(memo,"b","b retried");
+    assert(call_count == 6);
+
+    /** invalidated in flight, the waiters still get the value */
+    assert(promise_memo_invalidate(memo,"b",1) == 0);
+    get(memo,"b","b invalidated");
+    assert(call_count == 7);
+    promise_resolve(manager,calls[5],(promise_data_t){.ptr=strdup("B2")},free_with_ctx,NULL);
+
+    /** the call is cancelled once every waiter is gone, timed out lookups do not pile up */
+    promise_handle_t waiters[3];
+    for(int i=0;i<3;i++)
+        waiters[i] = promise_memo_get(memo,"d",1);
+    assert(call_count == 8);
+    promise_set_cancel_handler(manager,calls[7],count_cancel,NULL);
+    for(int round=0;round<100;round++)
+        promise_cancel(manager,promise_memo_get(memo,"d",1));
+    promise_destroy(manager,waiters[0]);
+    promise_cancel(manager,waiters[1]);
+    assert(cancelled == 0);
+    promise_cancel(manager,waiters[2]);
+    assert(cancelled == 1);
+    assert(promise_resolve(manager,calls[7],(promise_data_t){.ptr=NULL},NULL,NULL) != 0);
+    get(memo,"d","d retried");
+    assert(call_count == 9);
+    promise_resolve(manager,calls[8],(promise_data_t){.ptr=strdup("D")},free_with_ctx,NULL);
+
+    /** in flight work is cancelled with the memo */
+    promise_memo_free(memo);
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats) == 0)
+        assert(stats.live_promises == 0);
+    printf("%d resolved, %d rejected, %d calls\n",resolved,rejected,call_count);
+    promise_manager_free(manager);
+    return 0;
+}
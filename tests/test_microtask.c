@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <assert.h>
+#include "promise.h"
+
+#define CHAIN_LENGTH 1000000
+
+static promise_manager_handle_t manager = NULL;
+static promise_handle_t chain[CHAIN_LENGTH];
+
+static void chain_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    int index = (int)data.number;
+    if(index + 1 < CHAIN_LENGTH)
+        promise_resolve(manager,chain[index+1],(promise_data_t){.number=index+1},NULL,NULL);
+    else
+        printf("Chain end:%d\n",index);
+}
+
+static void test_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    printf("Then:%s %d\n",(char*)ctx,(int)data.number);
+}
+
+static void test_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    printf("Catch:%s %d\n",(char*)ctx,(int)reason.number);
+}
+
+int main(int argc, char const *argv[])
+{
+    promise_manager_options_t options = {
+        .initial_capacity = 64,
+        .max_retained_bytes = 64*1024,
+        .deferred_dispatch = true
+    };
+    manager = promise_manager_new_with_options(&options);
+    assert(manager);
+
+    /** handlers only run from promise_manager_run */
+    promise_handle_t promise1 = promise_new(manager);
+    promise_handle_t promise2 = promise_new(manager);
+    promise_await(manager,promise1,test_then,"promise1",false,test_catch,"promise1",false);
+    promise_await(manager,promise2,test_then,"promise2",false,test_catch,"promise2",false);
+    promise_resolve(manager,promise1,(promise_data_t){.number=1},NULL,NULL);
+    promise_reject(manager,promise2,(promise_data_t){.number=2},NULL,NULL);
+    printf("Settled\n");
+    bool more = promise_manager_run(manager,1);
+    printf("More:%d\n",more);
+    more = promise_manager_run(manager,1);
+    printf("More:%d\n",more);
+
+    /** a destroyed promise is skipped */
+    promise_handle_t promise3 = promise_new(manager);
+    promise_await(manager,promise3,test_then,"promise3",false,test_catch,"promise3",false);
+    promise_resolve(manager,promise3,(promise_data_t){.number=3},NULL,NULL);
+    promise_destroy(manager,promise3);
+    assert(!promise_manager_run(manager,0));
+
+    /** a long chain does not grow the stack */
+    for(int i=0;i<CHAIN_LENGTH;i++)
+    {
+        chain[i] = promise_new(manager);
+        promise_await(manager,chain[i],chain_then,NULL,false,test_catch,"chain",false);
+    }
+    promise_resolve(manager,chain[0],(promise_data_t){.number=0},NULL,NULL);
+    int ticks = 0;
+    while(promise_manager_run(manager,100000))
+        ticks++;
+    printf("Ticks:%d\n",ticks);
+
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats)==0)
+    {
+        printf("Created:%llu Resolved:%llu Rejected:%llu Destroyed:%llu Live:%zu Peak:%zu\n",
+            stats.created,stats.resolved,stats.rejected,stats.destroyed,stats.live_promises,stats.peak_live_promises);
+        unsigned long long dispatched = 0;
+        for(int i=0;i<PROMISE_STATS_HISTOGRAM_BUCKETS;i++)
+            dispatched += stats.dispatch_delay_ns[i];
+        printf("Dispatched:%llu\n",dispatched);
+    }
+
+    promise_manager_free(manager);
+    return 0;
+}
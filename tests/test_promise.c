@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <assert.h>
 #include "promise.h"
 
 static promise_manager_handle_t manager = NULL;
@@ -65,12 +66,46 @@ static void test_catch_any(promise_data_t data, void* ctx, void(*free_ptr)(void*
 }
 
 
+#define BATCH_LENGTH 4
+static promise_handle_t batch[BATCH_LENGTH];
+static int batch_handled = 0;
+
+static void test_then_batch(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    /** handlers run in the batch order, after the whole batch is resolved */
+    assert((int)data.number == batch_handled);
+    assert(promise_resolve(manager,batch[BATCH_LENGTH-1],data,NULL,NULL) != 0);
+    printf("Batch#%d\n",batch_handled++);
+}
+
 static void free_with_ctx(void* data, void* ctx)
 {
     if(data)
         free(data);
 }
 
+#define STREAM_LENGTH 3
+static promise_handle_t stream[STREAM_LENGTH];
+static int streamed = 0;
+
+static void test_then_stream(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    assert(streamed == STREAM_LENGTH);
+    printf("Streamed %d items\n",(int)data.number);
+}
+
+/** items arrive as they resolve and are freed right away */
+static void test_stream_item(int index, promise_data_t data, void(*free_ptr)(void*,void*), void* free_ctx, void* ctx)
+{
+    printf("Stream#%d:%s\n",index,(char*)data.ptr);
+    streamed++;
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+    /** stop early */
+    if(ctx)
+        promise_cancel(manager,*(promise_handle_t*)ctx);
+}
+
 int main(int argc, char const *argv[])
 {
     manager = promise_manager_new();
@@ -127,7 +162,38 @@ int main(int argc, char const *argv[])
     promise_data_t data8 = {.ptr = strdup("data8")};
     if(promise_resolve(manager,promise8,data8,free_with_ctx,NULL)!=0)
         free(data8.ptr);
-    
+
+    promise_data_t values[BATCH_LENGTH];
+    for(int i=0;i<BATCH_LENGTH;i++)
+    {
+        batch[i] = promise_new(manager);
+        values[i].number = i;
+        promise_await(manager,batch[i],test_then_batch,NULL,false,test_catch,NULL,false);
+    }
+    /** a duplicate fails the whole batch */
+    promise_handle_t duplicates[] = {batch[0],batch[1],batch[0]};
+    assert(promise_resolve_n(manager,3,duplicates,values,NULL,NULL) != 0);
+    assert(batch_handled == 0);
+    assert(promise_resolve_n(manager,BATCH_LENGTH,batch,values,NULL,NULL) == 0);
+    assert(batch_handled == BATCH_LENGTH);
+
+    for(int i=0;i<STREAM_LENGTH;i++)
+        stream[i] = promise_new(manager);
+    promise_handle_t stream_promise = promise_all_stream_n(manager,STREAM_LENGTH,stream,test_stream_item,NULL);
+    promise_await(manager,stream_promise,test_then_stream,NULL,false,test_catch,NULL,false);
+    for(int i=STREAM_LENGTH-1;i>=0;i--)
+    {
+        assert(streamed == STREAM_LENGTH-1-i);
+        promise_resolve(manager,stream[i],(promise_data_t){.ptr=strdup("item")},free_with_ctx,NULL);
+    }
+    /** on_item frees the stream */
+    stream[0] = promise_new(manager);
+    stream[1] = promise_new(manager);
+    stream_promise = promise_all_stream_n(manager,2,stream,test_stream_item,&stream_promise);
+    promise_resolve(manager,stream[1],(promise_data_t){.ptr=strdup("last")},free_with_ctx,NULL);
+    assert(promise_resolve(manager,stream[0],(promise_data_t){.ptr=NULL},NULL,NULL) != 0);
+    assert(streamed == STREAM_LENGTH + 1);
+
 
     promise_manager_free(manager);
     manager = NULL;
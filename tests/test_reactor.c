@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "promise.h"
+#include "promise_reactor.h"
+#include "async_function.h"
+
+#define PINGS 5
+
+static promise_manager_handle_t manager = NULL;
+static promise_reactor_handle_t reactor = NULL;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+/** reads until the peer is done, one AWAIT per readable edge */
+ASYNC(reader,(int fd),
+    int fd;int bytes;int awaits;bool quit;,
+    ARG_INIT(fd);)
+{
+    while(!VAR(quit))
+    {
+        AWAIT(promise_fd_readable(reactor,VAR(fd)));
+        VAR(awaits)++;
+        char buffer[64];
+        ssize_t rc;
+        while((rc = read(VAR(fd),buffer,sizeof(buffer))) > 0)
+        {
+            VAR(bytes) += rc;
+            if(VAR(bytes) == (PINGS + 1)*4)
+                VAR(quit) = true;
+        }
+        if(rc == 0)
+            break;
+        assert(errno == EAGAIN);
+    }
+    assert(VAR(awaits) <= PINGS + 1);
+    printf("reader got %d bytes\n",VAR(bytes));
+    RETURN(number,VAR(bytes),NULL,NULL);
+    ASYNC_END();
+}
+
+/** writes a ping every 2ms of timer time */
+ASYNC(writer,(int fd),
+    int fd;int i;,
+    ARG_INIT(fd);)
+{
+    AWAIT(promise_fd_writable(reactor,VAR(fd)));
+    for(VAR(i)=0;VAR(i)<PINGS;VAR(i)++)
+    {
+        AWAIT(promise_delay(manager,2));
+        assert(write(VAR(fd),"ping",4) == 4);
+    }
+    assert(write(VAR(fd),"quit",4) == 4);
+    RETURN(number,0,NULL,NULL);
+    ASYNC_END();
+}
+
+static void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved\n",(char*)ctx);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected%s\n",(char*)ctx,reason.ptr == PROMISE_FD_REMOVED ? " by fd removal" : "");
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    reactor = promise_reactor_new(manager);
+    assert(reactor);
+
+    int fds[2];
+    assert(socketpair(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK,0,fds) == 0);
+    promise_await(manager,reader(fds[0]),then,"reader",false,catch,"reader",false);
+    promise_await(manager,writer(fds[1]),then,"writer",false,catch,"writer",false);
+    /** only one pending readable promise per fd */
+    assert(promise_fd_readable(reactor,fds[0]) == NULL);
+    assert(promise_loop_run(reactor) == 0);
+
+    /** removing an awaited fd rejects its promises */
+    promise_await(manager,promise_fd_readable(reactor,fds[0]),then,"readable",false,catch,"readable",false);
+    assert(promise_reactor_remove(reactor,fds[0]) == 0);
+    assert(promise_reactor_remove(reactor,fds[0]) == -1);
+
+    /** a cancelled wait frees the fd for the next one */
+    promise_handle_t readable = promise_fd_readable(reactor,fds[0]);
+    promise_cancel(manager,readable);
+    promise_await(manager,promise_fd_readable(reactor,fds[0]),then,"readable after cancel",false,catch,"readable",false);
+    assert(write(fds[1],"x",1) == 1);
+    assert(promise_loop_run(reactor) == 0);
+
+    /** so does a destroyed one, and the loop no longer waits for it */
+    readable = promise_fd_readable(reactor,fds[1]);
+    assert(readable);
+    promise_destroy(manager,readable);
+    readable = promise_fd_readable(reactor,fds[1]);
+    assert(readable);
+    promise_destroy(manager,readable);
+    assert(promise_loop_run(reactor) == 0);
+
+    promise_reactor_remove(reactor,fds[0]);
+    promise_reactor_remove(reactor,fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    promise_reactor_free(reactor);
+    promise_manager_free(manager);
+    return 0;
+}
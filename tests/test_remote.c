@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include "promise.h"
+
+#define THREADS 4
+#define PROMISES_PER_THREAD 100000
+
+static promise_manager_handle_t manager = NULL;
+static promise_handle_t promises[THREADS][PROMISES_PER_THREAD];
+static int settled = 0;
+static long sum = 0;
+
+static void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+static void test_then(promise_data_t data, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    settled++;
+    sum += *(int*)data.ptr;
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+static void test_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*, void*), void* free_ctx)
+{
+    settled++;
+}
+
+static void* worker(void* arg)
+{
+    int id = (int)(long)arg;
+    for(int i=0;i<PROMISES_PER_THREAD;i++)
+    {
+        int* result = malloc(sizeof(int));
+        *result = 1;
+        if(i % 2)
+        {
+            promise_resolve_remote(manager,promises[id][i],(promise_data_t){.ptr=result},free_with_ctx,NULL);
+        }
+        else
+        {
+            free(result);
+            promise_reject_remote(manager,promises[id][i],(promise_data_t){.number=-1},NULL,NULL);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+    promise_manager_options_t options = {
+        .initial_capacity = 1024,
+        .max_retained_bytes = 1024*1024,
+        .remote_settle = true
+    };
+    manager = promise_manager_new_with_options(&options);
+    assert(manager);
+    assert(promise_manager_get_fd(manager) >= 0);
+
+    for(int t=0;t<THREADS;t++)
+    {
+        for(int i=0;i<PROMISES_PER_THREAD;i++)
+        {
+            promises[t][i] = promise_new(manager);
+            promise_await(manager,promises[t][i],test_then,NULL,true,test_catch,NULL,false);
+        }
+    }
+    pthread_t threads[THREADS];
+    for(int t=0;t<THREADS;t++)
+        pthread_create(&threads[t],NULL,worker,(void*)(long)t);
+
+    struct pollfd pfd = {.fd = promise_manager_get_fd(manager), .events = POLLIN};
+    int wakeups = 0;
+    while(settled < THREADS*PROMISES_PER_THREAD)
+    {
+        if(poll(&pfd,1,1000) <= 0)
+            break;
+        promise_manager_process_remote(manager);
+        wakeups++;
+    }
+    for(int t=0;t<THREADS;t++)
+        pthread_join(threads[t],NULL);
+
+    printf("Settled:%d Sum:%ld\n",settled,sum);
+    printf("Batched:%s\n",wakeups < settled ? "yes" : "no");
+
+    /** settling a stale promise frees the data */
+    promise_handle_t stale = promise_new(manager);
+    promise_destroy(manager,stale);
+    promise_resolve_remote(manager,stale,(promise_data_t){.ptr=malloc(16)},free_with_ctx,NULL);
+    promise_manager_process_remote(manager);
+
+    promise_manager_free(manager);
+    return 0;
+}
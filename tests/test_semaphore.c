@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+#include "async_semaphore.h"
+
+#define JOBS 16
+#define LIMIT 3
+
+static promise_manager_handle_t manager = NULL;
+static async_semaphore_handle_t semaphore = NULL;
+static promise_handle_t backend[JOBS];
+static int in_flight = 0;
+static int peak_in_flight = 0;
+static int done = 0;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+/** holds a permit while waiting for the backend */
+ASYNC(job,(int index),
+    int index;,
+    ARG_INIT(index);)
+{
+    AWAIT_ACQUIRE(semaphore);
+    in_flight++;
+    if(in_flight > peak_in_flight)
+        peak_in_flight = in_flight;
+    backend[VAR(index)] = promise_new(manager);
+    AWAIT(backend[VAR(index)]);
+    in_flight--;
+    async_semaphore_release(semaphore);
+    RETURN(number,VAR(index),NULL,NULL);
+    ASYNC_END();
+}
+
+static void job_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    done++;
+}
+
+static void granted_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    *(int*)ctx = ++done;
+}
+
+/** items with an odd index resolve synchronously */
+static promise_handle_t map_item(int index, void* ctx)
+{
+    in_flight++;
+    if(in_flight > peak_in_flight)
+        peak_in_flight = in_flight;
+    promise_handle_t promise = promise_new(manager);
+    if(index % 2)
+    {
+        in_flight--;
+        promise_resolve(manager,promise,(promise_data_t){.number=index},NULL,NULL);
+        return promise;
+    }
+    backend[index] = promise;
+    return promise;
+}
+
+static void list_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    promise_data_list_t* list = data.ptr;
+    for(int i=0;i<list->length;i++)
+        assert(list->items[i].data.number == i);
+    printf("%s resolved with %d items\n",(char*)ctx,list->length);
+    done++;
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected with %d\n",(char*)ctx,(int)reason.number);
+    done++;
+}
+
+static int next_backend()
+{
+    for(int i=0;i<JOBS;i++)
+    {
+        if(backend[i])
+            return i;
+    }
+    return -1;
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    semaphore = async_semaphore_new(manager,LIMIT);
+    assert(semaphore);
+
+    /** at most LIMIT jobs reach the backend at once */
+    for(int i=0;i<JOBS;i++)
+        promise_await(manager,job(i),job_then,NULL,false,catch,"job",false);
+    assert(in_flight == LIMIT && async_semaphore_available(semaphore) == 0);
+    for(int i;(i = next_backend()) >= 0;)
+    {
+        promise_handle_t promise = backend[i];
+        backend[i] = NULL;
+        promise_resolve(manager,promise,(promise_data_t){.number=i},NULL,NULL);
+    }
+    assert(done == JOBS && peak_in_flight == LIMIT);
+    assert(async_semaphore_available(semaphore) == LIMIT);
+    printf("%d jobs, peak %d in flight\n",done,peak_in_flight);
+
+    /** cancelled acquires give up their place */
+    assert(async_semaphore_try_acquire(semaphore) == 0);
+    assert(async_semaphore_try_acquire(semaphore) == 0);
+    assert(async_semaphore_try_acquire(semaphore) == 0);
+    assert(async_semaphore_try_acquire(semaphore) != 0);
+    promise_handle_t first = async_semaphore_acquire(semaphore);
+    promise_handle_t second = async_semaphore_acquire(semaphore);
+    promise_cancel(manager,first);
+    async_semaphore_release(semaphore);
+    assert(async_semaphore_available(semaphore) == 0);
+    promise_destroy(manager,second);
+    /** they leave the queue at once, the others keep their order */
+    for(int i=0;i<1000;i++)
+        promise_cancel(manager,async_semaphore_acquire(semaphore));
+    first = async_semaphore_acquire(semaphore);
+    second = async_semaphore_acquire(semaphore);
+    promise_handle_t third = async_semaphore_acquire(semaphore);
+    int order[2] = {0,0};
+    done = 0;
+    promise_await(manager,first,granted_then,&order[0],false,catch,"first",false);
+    promise_await(manager,third,granted_then,&order[1],false,catch,"third",false);
+    promise_cancel(manager,second);
+    async_semaphore_release(semaphore);
+    assert(order[0] == 1 && order[1] == 0);
+    async_semaphore_release(semaphore);
+    assert(order[1] == 2);
+    async_semaphore_release(semaphore);
+    async_semaphore_release(semaphore);
+    async_semaphore_release(semaphore);
+    assert(async_semaphore_available(semaphore) == LIMIT);
+
+    /** promise_map_limited starts a new item as each one settles */
+    done = 0;
+    peak_in_flight = 0;
+    promise_await(manager,promise_map_limited(manager,JOBS,map_item,NULL,LIMIT),
+        list_then,"map",false,catch,"map",false);
+    assert(in_flight == LIMIT);
+    for(int i;(i = next_backend()) >= 0;)
+    {
+        promise_handle_t promise = backend[i];
+        backend[i] = NULL;
+        in_flight--;
+        promise_resolve(manager,promise,(promise_data_t){.number=i},NULL,NULL);
+    }
+    assert(done == 1 && peak_in_flight == LIMIT);
+
+    /** the first rejection stops the map and cancels the rest */
+    promise_await(manager,promise_map_limited(manager,JOBS,map_item,NULL,LIMIT),
+        list_then,"failing map",false,catch,"failing map",false);
+    promise_reject(manager,backend[2],(promise_data_t){.number=-1},NULL,NULL);
+    assert(done == 2);
+    for(int i=0;i<JOBS;i++)
+    {
+        if(backend[i])
+            assert(promise_resolve(manager,backend[i],(promise_data_t){.number=i},NULL,NULL) != 0);
+    }
+
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats) == 0)
+        assert(stats.live_promises == 0);
+    async_semaphore_free(semaphore);
+    promise_manager_free(manager);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+
+#define RANDOM_TIMERS 10000
+#define RANDOM_MAX_DELAY 300000
+
+static promise_manager_handle_t manager = NULL;
+
+typedef struct
+{
+    uint64_t expire_ms;
+    uint64_t fired_ms;
+} timer_record_t;
+
+static timer_record_t records[RANDOM_TIMERS];
+static int inner_cancelled = 0;
+
+void free_with_ctx(void* data, void* ctx)
+{
+    if(data)
+        free(data);
+}
+
+void record_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    timer_record_t* record = (timer_record_t*)ctx;
+    record->fired_ms = promise_manager_now(manager);
+}
+
+void record_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("delay should not be rejected\n");
+}
+
+void print_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %d\n",(char*)ctx,data.ptr ? *(int*)data.ptr : 0);
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+void print_catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected%s\n",(char*)ctx,reason.ptr == PROMISE_TIMEOUT ? " by timeout" : "");
+    if(free_ptr)
+        free_ptr(reason.ptr,free_ctx);
+}
+
+void inner_cancel(void* ctx)
+{
+    inner_cancelled++;
+}
+
+promise_handle_t slow_operation()
+{
+    promise_handle_t promise = promise_new(manager);
+    promise_set_cancel_handler(manager,promise,inner_cancel,NULL);
+    return promise;
+}
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+ASYNC(wait_then_time_out,(int dummy),
+    int dummy;,
+    ARG_INIT(dummy);)
+{
+    AWAIT(promise_delay(ctx_545bb8c->manager,10));
+    TRY
+    {
+        AWAIT_TIMEOUT(slow_operation(),50);
+    }
+    CATCH(error)
+    {
+        RETURN(number,error.ptr == PROMISE_TIMEOUT ? 1 : 0,NULL,NULL);
+    }
+    RETURN(number,0,NULL,NULL);
+    ASYNC_END();
+}
+
+void number_then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved with %d\n",(char*)ctx,(int)data.number);
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    uint64_t start = promise_manager_now(manager);
+
+    /** random delays fire on the first advance reaching their deadline, at their deadline */
+    srand(1);
+    for(int i=0;i<RANDOM_TIMERS;i++)
+    {
+        uint64_t ms = rand()%RANDOM_MAX_DELAY;
+        records[i].expire_ms = start + (ms ? ms : 1);
+        promise_await(manager,promise_delay(manager,ms),record_then,&records[i],false,record_catch,NULL,false);
+    }
+    uint64_t now = start;
+    int fired = 0;
+    while(now < start + RANDOM_MAX_DELAY)
+    {
+        uint64_t last = now;
+        now += 1 + rand()%200;
+        fired += promise_manager_advance_time(manager,now);
+        for(int i=0;i<RANDOM_TIMERS;i++)
+        {
+            if(records[i].expire_ms > last && records[i].expire_ms <= now)
+                assert(records[i].fired_ms == records[i].expire_ms);
+            else if(records[i].expire_ms > now)
+                assert(records[i].fired_ms == 0);
+        }
+    }
+    assert(fired == RANDOM_TIMERS);
+    printf("%d random timers fired in time\n",fired);
+
+    /** cancelling a delay removes its timer */
+    promise_handle_t delay = promise_delay(manager,1000);
+    promise_await(manager,delay,record_then,&records[0],false,record_catch,NULL,false);
+    promise_cancel(manager,delay);
+    assert(promise_manager_advance_time(manager,now + 2000) == 0);
+    now += 2000;
+
+    /** the inner promise wins */
+    promise_handle_t inner = slow_operation();
+    promise_handle_t timeout = promise_timeout(manager,inner,100);
+    promise_await(manager,timeout,print_then,"timeout",true,print_catch,"timeout",true);
+    int* value = malloc(sizeof(int));
+    *value = 42;
+    promise_resolve(manager,inner,(promise_data_t){.ptr=value},free_with_ctx,NULL);
+
+    /** the timer wins, the inner promise is cancelled */
+    timeout = promise_timeout(manager,slow_operation(),100);
+    promise_await(manager,timeout,print_then,"timeout",true,print_catch,"timeout",true);
+    promise_manager_advance_time(manager,now + 99);
+    assert(inner_cancelled == 0);
+    promise_manager_advance_time(manager,now + 100);
+    assert(inner_cancelled == 1);
+    now += 100;
+
+    /** far deadlines cascade down the wheel */
+    timer_record_t far = {.expire_ms = now + 10*24*3600*1000ULL};
+    promise_await(manager,promise_delay(manager,10*24*3600*1000ULL),record_then,&far,false,record_catch,NULL,false);
+    promise_manager_advance_time(manager,far.expire_ms - 1);
+    assert(far.fired_ms == 0);
+    promise_manager_advance_time(manager,far.expire_ms);
+    assert(far.fired_ms == far.expire_ms);
+    now = far.expire_ms;
+
+    promise_await(manager,wait_then_time_out(0),number_then,"AWAIT_TIMEOUT",false,print_catch,"AWAIT_TIMEOUT",false);
+    promise_manager_advance_time(manager,now + 10);
+    promise_manager_advance_time(manager,now + 60);
+    assert(inner_cancelled == 2);
+
+    promise_manager_stats_t stats;
+    if(promise_manager_get_stats(manager,&stats) == 0)
+        assert(stats.live_timers == 0);
+
+    /** pending timers are freed with the manager */
+    promise_delay(manager,10);
+    promise_timeout(manager,slow_operation(),10);
+    promise_manager_free(manager);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "promise.h"
+#include "async_function.h"
+
+static promise_manager_handle_t manager = NULL;
+static promise_handle_t source = NULL;
+
+#define GLOBAL_PROMISE_MANAGER (manager)
+
+ASYNC(wait_source,(),
+    double value;,
+    )
+{
+    AWAIT_RESULT(number,VAR(value),source);
+    RETURN(number,VAR(value) + 1,NULL,NULL);
+    ASYNC_END();
+}
+
+static void then(promise_data_t data, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s resolved\n",(char*)ctx);
+    if(free_ptr)
+        free_ptr(data.ptr,free_ctx);
+}
+
+static void catch(promise_data_t reason, void* ctx, void(*free_ptr)(void*,void*), void* free_ctx)
+{
+    printf("%s rejected\n",(char*)ctx);
+}
+
+static int count(const char* text, const char* pattern)
+{
+    int n = 0;
+    for(const char* at = strstr(text,pattern);at;at = strstr(at + 1,pattern))
+        n++;
+    return n;
+}
+
+int main(int argc, char const *argv[])
+{
+    manager = promise_manager_new();
+    assert(manager);
+    if(promise_manager_trace_start(manager,64) != 0)
+    {
+        printf("tracing is compiled out, build with PROMISE_TRACE=1\n");
+        FILE* file = tmpfile();
+        assert(promise_manager_trace_dump(manager,file) == -1);
+        fclose(file);
+        promise_manager_free(manager);
+        return 0;
+    }
+
+    /** an ASYNC step, a group and a cancellation */
+    source = promise_new(manager);
+    promise_handle_t async = wait_source();
+    promise_handle_t other = promise_new(manager);
+    promise_await(manager,promise_all(manager,2,async,other),then,"all",false,catch,"all",false);
+    promise_cancel(manager,promise_new(manager));
+    promise_resolve(manager,source,(promise_data_t){.number=1},NULL,NULL);
+    promise_resolve(manager,other,(promise_data_t){.number=2},NULL,NULL);
+
+    FILE* file = tmpfile();
+    assert(file);
+    int events = promise_manager_trace_dump(manager,file);
+    long size = ftell(file);
+    char* text = malloc(size + 1);
+    rewind(file);
+    assert(fread(text,1,size,file) == (size_t)size);
+    text[size] = 0;
+    fclose(file);
+    printf("%d events, %ld bytes\n",events,size);
+    assert(events > 0);
+    assert(strncmp(text,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[",39) == 0);
+    assert(text[size - 2] == '}' || text[size - 1] == '}');
+    assert(count(text,"\"ph\":\"b\"") == 5);
+    assert(count(text,"\"ph\":\"e\"") == 5);
+    assert(count(text,"\"ph\":\"X\"") > 0);
+    assert(count(text,"test_trace.c:") == 1);
+    assert(count(text,"\"name\":\"await\"") == 2);
+    free(text);
+
+    /** the ring keeps the newest events */
+    for(int i=0;i<100;i++)
+        promise_cancel(manager,promise_new(manager));
+    file = tmpfile();
+    assert(promise_manager_trace_dump(manager,file) == 64);
+    fclose(file);
+
+    promise_manager_trace_stop(manager);
+    file = tmpfile();
+    assert(promise_manager_trace_dump(manager,file) == -1);
+    fclose(file);
+    promise_manager_free(manager);
+    return 0;
+}